@@ -0,0 +1,847 @@
+// archive.cpp
+//
+// Reads the names of the members of a tar or zip archive.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+// for open(), pread(), fstat(), mmap(), posix_spawnp(), waitpid()
+#include <fcntl.h>
+#include <spawn.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#include "archive.hpp"
+#include "lfbin.hpp"
+
+using namespace std;
+
+extern char **environ;
+
+
+
+// tar: a header block, and where its fields are
+
+const size_t tar_block = 512;
+
+const size_t tar_name = 0, tar_name_len = 100;
+const size_t tar_size = 124, tar_size_len = 12;
+const size_t tar_mtime = 136, tar_mtime_len = 12;
+const size_t tar_chksum = 148, tar_chksum_len = 8;
+const size_t tar_type = 156;
+const size_t tar_magic = 257;
+const size_t tar_prefix = 345, tar_prefix_len = 155;
+
+const uint64_t tar_meta_max = 1 << 20;	// longest long name or pax header
+
+// zip: the records of the central directory, and where their fields are
+
+const size_t zip_eocd_len = 22;	// end of central directory
+const size_t zip_comment_max = 0xffff;
+const size_t zip64_locator_len = 20;
+const size_t zip64_eocd_len = 56;
+const size_t zip_entry_len = 46;	// central directory file header
+
+const uint16_t zip_extra_zip64 = 0x0001;
+const uint16_t zip_extra_time = 0x5455;	// "UT", extended timestamp
+
+const size_t pipe_chunk = 1 << 16;	// bytes asked for by each read()
+
+const char ch_slash = '/';
+
+static const string s_dot_slash("./");
+
+
+
+// tar_suffixes[]
+//
+// The names of compressed tar files, and how each is compressed.
+
+struct tar_suffix
+{
+	CSZ suffix;
+	archive_filter filter;
+};
+
+const tar_suffix tar_suffixes[] =
+{
+	{ ".tar.gz", af_gzip }, { ".tgz", af_gzip },
+	{ ".tar.zst", af_zstd }, { ".tzst", af_zstd },
+	{ ".tar.xz", af_xz }, { ".txz", af_xz },
+	{ ".tar.bz2", af_bzip2 }, { ".tbz2", af_bzip2 }, { ".tbz", af_bzip2 },
+};
+
+const int tar_suffixes_max = sizeof(tar_suffixes) / sizeof(tar_suffixes[0]);
+
+
+
+// filter_command[] and filter_magic[]
+//
+// For each archive_filter: the program that decompresses it, and the
+// bytes its files start with.
+
+const CSZ filter_command[] = { NULL, "gzip", "zstd", "xz", "bzip2" };
+
+const CSZ filter_magic[] =
+{
+	"", "\x1f\x8b", "\x28\xb5\x2f\xfd", "\xfd" "7zXZ", "BZh",
+};
+
+
+
+// ParseOctal()
+//
+// Reads a number field of a tar header: octal digits, maybe with blanks
+// before them, ended by a blank or NUL; or, with the top bit of the
+// first byte set, a binary number (as GNU tar writes sizes over 8 GB).
+
+uint64_t
+ParseOctal(const unsigned char *p, size_t len)
+{
+	uint64_t u = 0;
+
+	if (p[0] & 0x80)
+	{
+		for (size_t i = 1; i < len; ++i)
+			u = (u << 8) | p[i];
+		return u;
+	}
+
+	size_t i = 0;
+	while (i < len && p[i] == ' ')
+		++i;
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; ++i)
+		u = (u << 3) | (p[i] - '0');
+
+	return u;
+}
+
+
+
+// TarChecksumOK()
+//
+// True if a header block's checksum is right.  The checksum is the sum
+// of the bytes of the header, with the checksum field taken as blanks.
+
+bool
+TarChecksumOK(const unsigned char *h)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < tar_block; ++i)
+	{
+		if (i >= tar_chksum && i < tar_chksum + tar_chksum_len)
+			sum += ' ';
+		else
+			sum += h[i];
+	}
+
+	return sum == ParseOctal(h + tar_chksum, tar_chksum_len);
+}
+
+
+
+inline bool
+IsZeroBlock(const unsigned char *h)
+{
+	for (size_t i = 0; i < tar_block; ++i)
+		if (h[i] != 0)
+			return false;
+
+	return true;
+}
+
+
+
+// SniffArchive()
+//
+// Works out what kind of archive a file is, from the bytes it starts
+// with and, for a compressed tar file, its name: a compressed file
+// could hold anything, so it has to be named as a tar file.
+
+archive_kind
+SniffArchive(int fd, CSREF path, archive_filter& filter)
+{
+	unsigned char h[tar_block];
+	ssize_t n = pread(fd, h, sizeof(h), 0);
+	filter = af_none;
+
+	if (n >= 4 && h[0] == 'P' && h[1] == 'K'
+			&& ((h[2] == 3 && h[3] == 4) || (h[2] == 5 && h[3] == 6)))
+		return ak_zip;
+
+	for (int i = 0; i < tar_suffixes_max; ++i)
+	{
+		const size_t len = strlen(tar_suffixes[i].suffix);
+		CSZ magic = filter_magic[tar_suffixes[i].filter];
+
+		if (path.length() > len && strcasecmp(path.c_str()
+				+ path.length() - len, tar_suffixes[i].suffix) == 0
+				&& n >= ssize_t(strlen(magic))
+				&& memcmp(h, magic, strlen(magic)) == 0)
+		{
+			filter = tar_suffixes[i].filter;
+			return ak_tar;
+		}
+	}
+
+	if (n == ssize_t(tar_block) && TarChecksumOK(h))
+		return ak_tar;
+
+	return ak_none;
+}
+
+
+
+bool
+IsArchive(CSREF path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	archive_filter filter;
+	archive_kind kind = SniffArchive(fd, path, filter);
+	close(fd);
+
+	return kind != ak_none;
+}
+
+
+
+// TrimName()
+//
+// Takes any "./" or "/" off the start of a member's name, and any "/"
+// off the end.
+
+void
+TrimName(string& name)
+{
+	size_t i = 0;
+	for (;;)
+	{
+		if (name.compare(i, s_dot_slash.length(), s_dot_slash) == 0)
+			i += s_dot_slash.length();
+		else if (i < name.length() && name[i] == ch_slash)
+			++i;
+		else
+			break;
+	}
+	name.erase(0, i);
+
+	size_t len = name.length();
+	while (len > 0 && name[len - 1] == ch_slash)
+		--len;
+	name.erase(len);
+}
+
+
+
+// DosTime()
+//
+// Turns the date and time of a zip entry, which are local time, into a
+// time_t.
+
+long long
+DosTime(uint16_t date, uint16_t time)
+{
+	struct tm t;
+	memset(&t, 0, sizeof(t));
+
+	t.tm_year = (date >> 9) + 80;
+	t.tm_mon = ((date >> 5) & 0x0f) - 1;
+	t.tm_mday = date & 0x1f;
+	t.tm_hour = time >> 11;
+	t.tm_min = (time >> 5) & 0x3f;
+	t.tm_sec = (time & 0x1f) * 2;
+	t.tm_isdst = -1;
+
+	return mktime(&t);
+}
+
+
+
+// constructor and destructor
+
+archive_reader::archive_reader()
+{
+	kind = ak_none;
+	failed = false;
+	map_base = NULL;
+	map_size = 0;
+	pos = 0;
+	fd = -1;
+	child = -1;
+	buf_pos = buf_end = 0;
+	at_eof = false;
+	finished = false;
+	zip_left = 0;
+	is_dir = false;
+	size = 0;
+	mtime = 0;
+}
+
+
+
+archive_reader::~archive_reader()
+{
+	Close();
+}
+
+
+
+bool
+archive_reader::Open(CSREF path)
+{
+	Close();
+	failed = false;
+	finished = false;
+
+	int in_fd = open(path.c_str(), O_RDONLY);
+	if (in_fd < 0)
+		return false;
+
+	archive_filter filter;
+	kind = SniffArchive(in_fd, path, filter);
+	if (kind == ak_none)
+	{
+		close(in_fd);
+		return false;
+	}
+
+	if (filter != af_none)
+	{
+		bool b = Spawn(in_fd, filter);
+		close(in_fd);	// the child has it
+		return b;
+	}
+
+	struct stat sb;
+	if (fstat(in_fd, &sb) != 0 || sb.st_size == 0)
+	{
+		close(in_fd);
+		return false;
+	}
+
+	void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+	close(in_fd);	// the mapping stays
+	if (p == MAP_FAILED)
+		return false;
+
+	map_base = (const unsigned char *)p;
+	map_size = sb.st_size;
+	pos = 0;
+
+	// a tar file is read a header here and there, a zip file only at
+	// the end
+	madvise(p, map_size, MADV_RANDOM);
+
+	if (kind == ak_zip && !OpenZip())
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+
+
+void
+archive_reader::Close()
+{
+	if (map_base != NULL)
+		munmap((void *)map_base, map_size);
+	map_base = NULL;
+	map_size = 0;
+
+	EndStream();
+	kind = ak_none;
+}
+
+
+
+// archive_reader::Spawn()
+//
+// Starts the program that decompresses the file open on in_fd, with
+// its output on a pipe to fd.
+
+bool
+archive_reader::Spawn(int in_fd, archive_filter filter)
+{
+	int p[2];
+	if (pipe(p) != 0)
+		return false;
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, in_fd, 0);
+	posix_spawn_file_actions_adddup2(&actions, p[1], 1);
+	posix_spawn_file_actions_addclose(&actions, p[0]);
+	posix_spawn_file_actions_addclose(&actions, p[1]);
+
+	CSZ command = filter_command[filter];
+	char *argv[] = { (char *)command, (char *)"-dc", NULL };
+	int rc = posix_spawnp(&child, command, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+
+	close(p[1]);
+	if (rc != 0)
+	{
+		close(p[0]);
+		child = -1;
+		return false;
+	}
+
+	fd = p[0];
+	buf.resize(pipe_chunk);
+	buf_pos = buf_end = 0;
+	at_eof = false;
+	return true;
+}
+
+
+
+// archive_reader::EndStream()
+//
+// Closes the pipe from the decompressing program, and waits for it.  If
+// the tar file ended early, that program failing is why.  If it didn't,
+// the program may still have had padding to write, and closing the
+// pipe ends it.
+
+void
+archive_reader::EndStream()
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+
+	if (child < 0)
+		return;
+
+	int status;
+	pid_t rc;
+	do
+		rc = waitpid(child, &status, 0);
+	while (rc < 0 && errno == EINTR);
+	child = -1;
+
+	if (!finished && (rc < 0 || !WIFEXITED(status)
+			|| WEXITSTATUS(status) != 0))
+		failed = true;
+}
+
+
+
+// archive_reader::Blocks()
+//
+// Returns the next n blocks of a tar file, or NULL if the file ends
+// first.  The pointer is good until the next call.
+
+const unsigned char *
+archive_reader::Blocks(size_t n)
+{
+	const size_t bytes = n * tar_block;
+
+	if (map_base != NULL)
+	{
+		if (map_size - pos < bytes)
+			return NULL;
+
+		const unsigned char *p = map_base + pos;
+		pos += bytes;
+		return p;
+	}
+
+	while (buf_end - buf_pos < bytes)
+	{
+		if (at_eof)
+			return NULL;
+
+		memmove(&buf[0], &buf[buf_pos], buf_end - buf_pos);
+		buf_end -= buf_pos;
+		buf_pos = 0;
+		if (buf.size() < bytes)
+			buf.resize(bytes);
+
+		ssize_t rc;
+		do
+			rc = read(fd, &buf[buf_end], buf.size() - buf_end);
+		while (rc < 0 && errno == EINTR);
+
+		if (rc < 0)
+			failed = true;
+		if (rc <= 0)
+			at_eof = true;
+		else
+			buf_end += rc;
+	}
+
+	const unsigned char *p = &buf[buf_pos];
+	buf_pos += bytes;
+	return p;
+}
+
+
+
+// archive_reader::Skip()
+//
+// Skips over the data of a tar member.  In a mapped file that only
+// moves pos; from a pipe, the data has to be read and thrown away.
+
+bool
+archive_reader::Skip(uint64_t bytes)
+{
+	if (map_base != NULL)
+	{
+		if (map_size - pos < bytes)
+			return false;
+
+		pos += bytes;
+		return true;
+	}
+
+	size_t n = min(uint64_t(buf_end - buf_pos), bytes);
+	buf_pos += n;
+	bytes -= n;
+
+	while (bytes > 0)
+	{
+		ssize_t rc = read(fd, &buf[0], min(uint64_t(buf.size()), bytes));
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return false;
+		bytes -= rc;
+	}
+
+	return true;
+}
+
+
+
+// ParsePax()
+//
+// Picks the records lf cares about out of a pax extended header: each
+// record is "<length> <key>=<value>\n".
+
+void
+ParsePax(CSZ p, size_t len, string& path, bool& have_path,
+		uint64_t& size, bool& have_size, long long& mtime, bool& have_mtime)
+{
+	size_t i = 0;
+	while (i < len)
+	{
+		size_t rec_len = 0;
+		size_t j = i;
+		while (j < len && p[j] >= '0' && p[j] <= '9')
+			rec_len = rec_len * 10 + (p[j++] - '0');
+		if (j == len || p[j] != ' ' || rec_len == 0 || rec_len > len - i)
+			return;	// not a record
+
+		const size_t end = i + rec_len - 1;	// the newline
+		CSZ key = p + j + 1;
+		CSZ eq = (CSZ)memchr(key, '=', p + end - key);
+		if (eq == NULL)
+			return;
+
+		string value(eq + 1, p + end);
+		if (eq - key == 4 && memcmp(key, "path", 4) == 0)
+		{
+			path = value;
+			have_path = true;
+		}
+		else if (eq - key == 4 && memcmp(key, "size", 4) == 0)
+		{
+			size = strtoull(value.c_str(), NULL, 10);
+			have_size = true;
+		}
+		else if (eq - key == 5 && memcmp(key, "mtime", 5) == 0)
+		{
+			mtime = strtoll(value.c_str(), NULL, 10);
+			have_mtime = true;
+		}
+
+		i += rec_len;
+	}
+}
+
+
+
+bool
+archive_reader::Next()
+{
+	if (failed || finished)
+		return false;
+
+	bool b = (kind == ak_zip) ? NextZip() : NextTar();
+	if (!b && kind == ak_tar)
+		EndStream();
+
+	return b;
+}
+
+
+
+// archive_reader::NextTar()
+//
+// Reads headers up to the next member.  A GNU long name, or a pax
+// extended header, comes in a member of its own before the one it is
+// about.  The end of a tar file is a block of zeros; a file that just
+// stops after a member is taken as ended too.
+
+bool
+archive_reader::NextTar()
+{
+	string long_name, pax_path;
+	bool have_long_name = false, have_pax_path = false;
+	uint64_t pax_size = 0;
+	bool have_pax_size = false;
+	long long pax_mtime = 0;
+	bool have_pax_mtime = false;
+
+	for (;;)
+	{
+		const unsigned char *h = Blocks(1);
+		if (h == NULL)
+		{
+			// from a pipe, EndStream() finds out if this was an error
+			finished = (map_base != NULL);
+			return false;
+		}
+		if (IsZeroBlock(h))
+		{
+			finished = true;
+			return false;
+		}
+		if (!TarChecksumOK(h))
+		{
+			failed = true;
+			return false;
+		}
+
+		const char type = h[tar_type];
+		uint64_t data_len = ParseOctal(h + tar_size, tar_size_len);
+		const uint64_t data_blocks = (data_len + tar_block - 1) / tar_block;
+
+		if (type == 'L' || type == 'x')
+		{
+			if (data_len > tar_meta_max)
+			{
+				failed = true;
+				return false;
+			}
+
+			CSZ data = (CSZ)Blocks(data_blocks);
+			if (data == NULL)
+			{
+				failed = true;
+				return false;
+			}
+
+			if (type == 'L')
+			{
+				long_name.assign(data, strnlen(data, data_len));
+				have_long_name = true;
+			}
+			else
+				ParsePax(data, data_len, pax_path, have_pax_path,
+						pax_size, have_pax_size, pax_mtime, have_pax_mtime);
+			continue;
+		}
+
+		if (have_pax_size)
+			data_len = pax_size;
+
+		// hard and symbolic links, devices, directories and FIFOs have
+		// no data after them
+		const bool has_data = (strchr("123456", type) == NULL || type == 0);
+		const uint64_t skip = has_data
+				? (data_len + tar_block - 1) / tar_block * tar_block : 0;
+
+		if (type == 'g' || type == 'K' || type == 'V')
+		{
+			// not a member
+			if (!Skip(skip))
+			{
+				failed = true;
+				return false;
+			}
+			continue;
+		}
+
+		// Skip() may read over the header, so use it first
+		if (have_pax_path)
+			name = pax_path;
+		else if (have_long_name)
+			name = long_name;
+		else
+		{
+			CSZ p = (CSZ)h + tar_name;
+			name.assign(p, strnlen(p, tar_name_len));
+
+			// POSIX ustar (not GNU) can split a long name in two
+			p = (CSZ)h + tar_prefix;
+			if (memcmp(h + tar_magic, "ustar", 6) == 0 && p[0] != 0)
+			{
+				name.insert(0, 1, ch_slash);
+				name.insert(0, p, strnlen(p, tar_prefix_len));
+			}
+		}
+
+		is_dir = (type == '5' || type == 'D'
+				|| (!name.empty() && name[name.length() - 1] == ch_slash));
+		size = (has_data && !is_dir) ? data_len : 0;
+		mtime = have_pax_mtime ? pax_mtime
+				: ParseOctal(h + tar_mtime, tar_mtime_len);
+
+		if (!Skip(skip))
+		{
+			failed = true;
+			return false;
+		}
+
+		TrimName(name);
+		if (name.empty())
+		{
+			// "./" itself; anything before it was about it
+			have_long_name = have_pax_path = false;
+			have_pax_size = have_pax_mtime = false;
+			continue;
+		}
+
+		return true;
+	}
+}
+
+
+
+// archive_reader::OpenZip()
+//
+// Finds the central directory of a zip file, from the record at the
+// end of the file (after which there may be a comment), and for a Zip64
+// file from the record before that.
+
+bool
+archive_reader::OpenZip()
+{
+	if (map_size < zip_eocd_len)
+		return false;
+
+	size_t i = map_size - zip_eocd_len;
+	const size_t stop = (i > zip_comment_max) ? i - zip_comment_max : 0;
+	for (;;)
+	{
+		if (memcmp(map_base + i, "PK\5\6", 4) == 0)
+			break;
+		if (i == stop)
+			return false;
+		--i;
+	}
+
+	const unsigned char *e = map_base + i;
+	zip_left = GetLE16(e + 10);
+	uint64_t cd_len = GetLE32(e + 12);
+	pos = GetLE32(e + 16);
+
+	if ((zip_left == 0xffff || cd_len == 0xffffffff || pos == 0xffffffff)
+			&& i >= zip64_locator_len
+			&& memcmp(e - zip64_locator_len, "PK\6\7", 4) == 0)
+	{
+		uint64_t at = GetLE64(e - zip64_locator_len + 8);
+		if (map_size < zip64_eocd_len || at > map_size - zip64_eocd_len
+				|| memcmp(map_base + at, "PK\6\6", 4) != 0)
+			return false;
+
+		const unsigned char *e64 = map_base + at;
+		zip_left = GetLE64(e64 + 32);
+		cd_len = GetLE64(e64 + 40);
+		pos = GetLE64(e64 + 48);
+		if (pos > map_size || cd_len > map_size - pos)
+			return false;
+	}
+
+	return pos <= map_size && cd_len <= map_size - pos;
+}
+
+
+
+// archive_reader::NextZip()
+//
+// Reads the next entry of the central directory.  The size is in a
+// Zip64 extra field if it is too big for its own field, and a more
+// exact mtime may be in an extended timestamp extra field.
+
+bool
+archive_reader::NextZip()
+{
+	for (;;)
+	{
+		if (zip_left == 0)
+		{
+			finished = true;
+			return false;
+		}
+
+		if (map_size - pos < zip_entry_len
+				|| memcmp(map_base + pos, "PK\1\2", 4) != 0)
+		{
+			failed = true;
+			return false;
+		}
+
+		const unsigned char *e = map_base + pos;
+		const size_t name_len = GetLE16(e + 28);
+		const size_t extra_len = GetLE16(e + 30);
+		const size_t comment_len = GetLE16(e + 32);
+		const size_t entry_len = zip_entry_len + name_len + extra_len
+				+ comment_len;
+		if (map_size - pos < entry_len)
+		{
+			failed = true;
+			return false;
+		}
+
+		name.assign((CSZ)e + zip_entry_len, name_len);
+		is_dir = (name_len > 0 && name[name_len - 1] == ch_slash);
+		size = GetLE32(e + 24);
+		mtime = DosTime(GetLE16(e + 14), GetLE16(e + 12));
+
+		const unsigned char *x = e + zip_entry_len + name_len;
+		const unsigned char *x_end = x + extra_len;
+		while (x_end - x >= 4)
+		{
+			const uint16_t id = GetLE16(x);
+			const size_t len = GetLE16(x + 2);
+			if (size_t(x_end - x - 4) < len)
+				break;
+
+			if (id == zip_extra_zip64 && size == 0xffffffff && len >= 8)
+				size = GetLE64(x + 4);	// the size comes first
+			else if (id == zip_extra_time && len >= 5 && (x[4] & 1))
+				mtime = GetLE32(x + 5);
+
+			x += 4 + len;
+		}
+
+		pos += entry_len;
+		--zip_left;
+
+		if (is_dir)
+			size = 0;
+		TrimName(name);
+		if (!name.empty())
+			return true;
+	}
+}
@@ -0,0 +1,139 @@
+// archive.hpp
+//
+// Reads the names of the members of a tar or zip archive, for lf
+// --archives, without extracting anything.
+//
+// A zip file is mapped with mmap(), and only its central directory, at
+// the end, is read.  An uncompressed tar file is mapped too, and only
+// the header block of each member is read; the data in between is
+// skipped over, so it is never read from the disk at all.  A compressed
+// tar file (.tar.gz, .tgz, .tar.zst, .tar.xz, .tar.bz2) is run through
+// the program that decompresses it ("gzip -dc" and so on), and the
+// headers are picked out of the stream as it goes by.
+//
+// Tar headers may be POSIX ustar, GNU (with long names) or pax (with
+// path, size and mtime records).  Zip files may be Zip64.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// if (IsArchive("release.tar.gz"))
+// {
+//	archive_reader a;
+//	if (!a.Open("release.tar.gz"))
+//		error...
+//	while (a.Next())
+//		do something with a.name, a.is_dir, a.size and a.mtime...
+//	if (!a.good())
+//		error: the archive is damaged, or couldn't be decompressed...
+// }
+
+
+
+#ifndef ARCHIVE_HPP
+
+#define ARCHIVE_HPP
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+
+
+enum archive_kind
+{
+	ak_none,
+	ak_tar,
+	ak_zip,
+};
+
+enum archive_filter
+{
+	af_none,
+	af_gzip,
+	af_zstd,
+	af_xz,
+	af_bzip2,
+};
+
+
+
+// IsArchive()
+//
+// Looks at the start of a file, and its name, to see if it is an
+// archive that archive_reader can read.
+
+bool IsArchive(CSREF path);
+
+
+
+class archive_reader
+{
+	private:
+		archive_kind kind;
+		bool failed;
+
+		// a mapped file: a zip file, or a tar file that isn't
+		// compressed
+		const unsigned char *map_base;
+		size_t map_size;
+		size_t pos;	// in the mapping
+
+		// a compressed tar file, read from a pipe
+		int fd;
+		pid_t child;	// the program decompressing it
+		std::vector<unsigned char> buf;
+		size_t buf_pos, buf_end;
+		bool at_eof;
+		bool finished;	// read up to the blocks that end a tar file
+
+		uint64_t zip_left;	// zip entries not read yet
+
+		bool Spawn(int in_fd, archive_filter filter);
+		void EndStream();
+		const unsigned char *Blocks(size_t n);
+		bool Skip(uint64_t bytes);
+		bool OpenZip();
+		bool NextTar();
+		bool NextZip();
+
+		// not copyable
+		archive_reader(const archive_reader& rhs);
+		archive_reader& operator=(const archive_reader& rhs);
+
+	public:
+		archive_reader();
+		~archive_reader();
+
+		// opens an archive; returns false if it can't be read, or isn't
+		// an archive
+		bool Open(CSREF path);
+		void Close();
+
+		// reads the next member; returns false at the end or on error
+		bool Next();
+
+		// true if the archive was read to its end without trouble
+		bool good() const { return !failed; }
+
+		// the member Next() read; the name has any "./" or "/" at the
+		// start, and any "/" at the end, taken off
+		std::string name;
+		bool is_dir;
+		long long size;
+		long long mtime;
+};
+
+
+
+#endif // ARCHIVE_HPP
@@ -0,0 +1,259 @@
+#!/bin/sh
+#
+# Benchmark harness for lf.  Normally run with "make bench", which
+# builds lf and lfgen first and passes their paths in.
+#
+# For each fixture directory (built by lfgen, and kept between runs so
+# it only has to be built once) and each option set, runs lf several
+# times with --timing and records the median and 95th percentile of the
+# total time.  Then runs it once more with --stats=json to record memory
+# allocations and peak resident size; that run is not timed, because the
+# counters themselves cost a little.
+#
+# Results are written as JSON, one result per line, so that they are
+# easy to read with diff or awk as well as with a JSON parser.  If a
+# baseline file exists, each median is compared with the baseline, and
+# the script fails if any of them got slower by more than the threshold.
+#
+# With -p, lf runs with the given library in LD_PRELOAD; this is meant
+# for slowfs.so, to see how lf does on a slow network filesystem.
+# Results from such runs are tagged with the library's settings, so
+# they are not compared with results from runs without it.
+#
+# Usage: lfbench.sh [-l lf] [-g lfgen] [-d fixture_dir] [-n "sizes"]
+#                   [-r runs] [-o results] [-b baseline] [-t percent]
+#                   [-p preload] [-s]
+#
+# Example: save a baseline, make a change, then compare:
+#
+#	make bench BENCH_SAVE=1
+#	make bench
+#
+# Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+LF=Release/lf
+LFGEN=Release/lfgen
+FIXTURES=/dev/shm/lf-bench
+SIZES="1000 100000"
+RUNS=7
+RESULTS=bench_output.json
+BASELINE=bench/baseline.json
+THRESHOLD=10
+SAVE=0
+PRELOAD=
+
+while getopts "l:g:d:n:r:o:b:t:p:s" opt; do
+	case $opt in
+	l) LF=$OPTARG ;;
+	g) LFGEN=$OPTARG ;;
+	d) FIXTURES=$OPTARG ;;
+	n) SIZES=$OPTARG ;;
+	r) RUNS=$OPTARG ;;
+	o) RESULTS=$OPTARG ;;
+	b) BASELINE=$OPTARG ;;
+	t) THRESHOLD=$OPTARG ;;
+	p) PRELOAD=$OPTARG ;;
+	s) SAVE=1 ;;
+	*) echo "Usage: lfbench.sh [-l lf] [-g lfgen] [-d dir] [-n sizes]" \
+			"[-r runs] [-o results] [-b baseline] [-t percent]" \
+			"[-p preload] [-s]" >&2
+		exit 2 ;;
+	esac
+done
+
+# Fixture kinds: name, then lfgen options (the size is added later).
+#	mixed	Zipf-distributed extensions, some UTF-8 and "foo-2.18" names
+#	flat	many extensions, all equally common
+#	onext	a single extension, so everything is in one big bucket
+#	long	long names
+#	utf8	mostly non-ASCII names
+FIXTURE_KINDS="
+mixed:-z -e 200 -u 10 -s 10 -d 20
+flat:-e 2000
+onext:-e 1
+long:-e 50 -l 60,200
+utf8:-e 50 -u 90
+"
+
+# Option sets: one per sort mode, plus the other expensive paths.
+OPTION_SETS="
+default:
+ascii:-A
+ascii-ic:-I
+locale:-L
+lower:-F
+all:-a
+jsonl:--format=jsonl
+per-ext:--per-ext=10
+"
+
+# keep locale-dependent results comparable between machines
+LC_ALL=C.UTF-8
+export LC_ALL
+unset LFOPTS
+
+for f in "$LF" "$LFGEN"; do
+	if test ! -x "$f"; then
+		echo "lfbench: $f not found; build it first" >&2
+		exit 1
+	fi
+done
+
+
+
+# Fixture kind size
+#
+# Makes sure the fixture directory exists, and prints its path.  A stamp
+# file holding the lfgen options shows the directory is complete and was
+# built with the same options.
+
+Fixture()
+{
+	dir="$FIXTURES/$1-$2"
+	opts="$3 -n $2"
+
+	if test ! -f "$dir.stamp" || test "$(cat "$dir.stamp")" != "$opts"; then
+		rm -rf "$dir" "$dir.stamp"
+		mkdir -p "$FIXTURES" || exit 1
+		echo "lfbench: building $dir" >&2
+		"$LFGEN" $opts "$dir" || exit 1
+		echo "$opts" > "$dir.stamp"
+	fi
+
+	echo "$dir"
+}
+
+
+
+# RunLf args...
+#
+# Runs lf, with the preload library if there is one.
+
+RunLf()
+{
+	if test -n "$PRELOAD"; then
+		LD_PRELOAD="$PRELOAD" "$LF" "$@"
+	else
+		"$LF" "$@"
+	fi
+}
+
+
+
+# JsonNum key
+#
+# Pulls one number out of the --stats=json report on standard input.
+
+JsonNum()
+{
+	sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p"
+}
+
+
+
+# tag for the options column, so slow runs aren't compared with fast ones
+tag=
+if test -n "$PRELOAD"; then
+	case $PRELOAD in
+	/*) ;;
+	*) PRELOAD=$(pwd)/$PRELOAD ;;
+	esac
+	tag="+slowfs(${SLOWFS_US:-200}us"
+	tag="$tag,${SLOWFS_JITTER_US:-0}us,${SLOWFS_READDIR_BATCH:-32})"
+fi
+
+tmp_times="${TMPDIR:-/tmp}/lfbench.$$"
+trap 'rm -f "$tmp_times"' 0
+
+echo "[" > "$RESULTS"
+
+for size in $SIZES; do
+	echo "$FIXTURE_KINDS" | while IFS=: read -r kind gen_opts; do
+		test -z "$kind" && continue
+		dir=$(Fixture "$kind" "$size" "$gen_opts") || exit 1
+
+		echo "$OPTION_SETS" | while IFS=: read -r set lf_opts; do
+			test -z "$set" && continue
+
+			: > "$tmp_times"
+			i=0
+			while test $i -lt "$RUNS"; do
+				RunLf --timing $lf_opts "$dir" 2>&1 >/dev/null |
+						sed -n 's/^timing: total *\([0-9.]*\) ms/\1/p' \
+						>> "$tmp_times"
+				i=$((i + 1))
+			done
+
+			# median, and 95th percentile by nearest rank
+			n=$(wc -l < "$tmp_times")
+			median=$(sort -n "$tmp_times" | sed -n "$(( (n + 1) / 2 ))p")
+			p95=$(sort -n "$tmp_times" | sed -n "$(( (n * 95 + 99) / 100 ))p")
+
+			stats=$(RunLf --stats=json $lf_opts "$dir" 2>&1 >/dev/null)
+			allocs=$(echo "$stats" | JsonNum allocs)
+			alloc_bytes=$(echo "$stats" | JsonNum alloc_bytes)
+			rss=$(echo "$stats" | JsonNum peak_rss_kb)
+
+			printf '{"fixture":"%s-%s","options":"%s","runs":%s,' \
+					"$kind" "$size" "$set$tag" "$RUNS"
+			printf '"median_ms":%s,"p95_ms":%s,' "$median" "$p95"
+			printf '"allocs":%s,"alloc_bytes":%s,"peak_rss_kb":%s}\n' \
+					"$allocs" "$alloc_bytes" "$rss"
+		done
+	done
+done | sed '1!s/^/,/' >> "$RESULTS"
+
+echo "]" >> "$RESULTS"
+
+
+
+if test "$SAVE" = 1; then
+	cp "$RESULTS" "$BASELINE" || exit 1
+	echo "lfbench: saved baseline $BASELINE"
+	exit 0
+fi
+
+if test ! -f "$BASELINE"; then
+	cat "$RESULTS"
+	echo "lfbench: no baseline $BASELINE; run with -s to save one"
+	exit 0
+fi
+
+# Compare with the baseline.  Results too fast to time reliably (under
+# a millisecond) are shown but never counted as regressions.
+awk -v threshold="$THRESHOLD" '
+function field(line, key,    s) {
+	s = line
+	if (!sub(".*\"" key "\":\"?", "", s))
+		return ""
+	sub("[\",}].*", "", s)
+	return s
+}
+/"fixture"/ {
+	key = field($0, "fixture") " " field($0, "options")
+	ms = field($0, "median_ms")
+	if (FILENAME == ARGV[1]) {
+		base[key] = ms
+		next
+	}
+	if (!(key in base)) {
+		printf "%-32s %10.3f ms   (new)\n", key, ms
+		next
+	}
+	change = (base[key] > 0) ? (ms - base[key]) * 100 / base[key] : 0
+	flag = ""
+	if (change > threshold && ms >= 1.0) {
+		flag = "   REGRESSION"
+		++regressions
+	}
+	printf "%-32s %10.3f ms %+7.1f%%%s\n", key, ms, change, flag
+}
+END {
+	if (regressions > 0) {
+		printf "lfbench: %d regressions over %s%%\n", regressions, threshold
+		exit 1
+	}
+}
+' "$BASELINE" "$RESULTS"
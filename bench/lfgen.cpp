@@ -0,0 +1,375 @@
+// lfgen.cpp
+//
+// Builds a directory full of empty files, for benchmarking lf.
+//
+// The same arguments always build the same directory: names come from a
+// seeded pseudo-random generator, not from the clock.  Point it at a
+// tmpfs (such as /dev/shm) so that the benchmark measures lf and not
+// the disk.
+//
+// lfgen [option...] dir
+//
+// -n count	how many files to make (default 1000)
+// -e count	how many different extensions (default 20)
+// -z		pick extensions with a Zipf distribution, so a few are
+//		very common and most are rare (default: all equally likely)
+// -l min,max	range of lengths for the part of the name before the
+//		extension (default 4,24)
+// -u percent	how many names contain non-ASCII UTF-8 characters
+// -s percent	how many names look like "foo-2.18", with a numeric suffix
+//		that lf must not treat as an extension
+// -d count	how many subdirectories to make (default 0)
+// -r seed	seed for the generator (default 1)
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// for open(), mkdir()
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#include "util.hpp"
+
+using namespace std;
+
+
+
+namespace	// begin unnamed namespace
+{
+
+
+CSZ const usage_str =
+		"Usage: lfgen [-n count] [-e count] [-z] [-l min,max] [-u percent]\n"
+		"             [-s percent] [-d count] [-r seed] dir\n";
+
+// common extensions come first, so the most frequent ones look real
+CSZ const common_exts[] =
+{
+	"c", "h", "cpp", "hpp", "o", "txt", "html", "xml", "py", "sh",
+	"jpg", "png", "gz", "tar", "pdf", "md", "json", "log", "mk", "1",
+};
+const int common_exts_count = sizeof(common_exts) / sizeof(common_exts[0]);
+
+// pieces of non-ASCII text: two-, three- and four-byte UTF-8
+CSZ const utf8_bits[] =
+{
+	"\xc3\xa9",		// e acute
+	"\xc3\x9f",		// sharp s
+	"\xc3\xbc",		// u umlaut
+	"\xc3\xb1",		// n tilde
+	"\xd0\x96",		// Cyrillic zhe
+	"\xce\xbb",		// Greek lambda
+	"\xe6\x97\xa5\xe6\x9c\xac",	// "Japan"
+	"\xe2\x82\xac",	// euro sign
+	"\xf0\x9f\x98\x80",	// grinning face
+};
+const int utf8_bits_count = sizeof(utf8_bits) / sizeof(utf8_bits[0]);
+
+CSZ const alphabet =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+
+CSZ const stems[] =
+{
+	"lib", "foo", "gcc", "linux", "perl", "python", "emacs", "vim",
+};
+const int stems_count = sizeof(stems) / sizeof(stems[0]);
+
+
+
+// xorshift64* generator: fast, and the same on every platform
+unsigned long long rng_state;
+
+unsigned long long
+Rand()
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 2685821657736338717ULL;
+}
+
+
+
+// RandBelow()
+//
+// Returns a number from 0 to n - 1.
+
+long
+RandBelow(long n)
+{
+	return (Rand() >> 11) % n;
+}
+
+
+
+// RandDouble()
+//
+// Returns a number from 0.0 up to (not including) 1.0.
+
+double
+RandDouble()
+{
+	return (Rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+
+bool
+Percent(int pct)
+{
+	return RandBelow(100) < pct;
+}
+
+
+
+// ExtName()
+//
+// The name of extension number i.
+
+string
+ExtName(int i)
+{
+	if (i < common_exts_count)
+		return common_exts[i];
+
+	char buf[32];
+	sprintf(buf, "x%d", i);
+	return buf;
+}
+
+
+
+// zipf_cdf[i] is the chance that extension i or a lower one is picked
+vector<double> zipf_cdf;
+
+void
+InitZipf(int count)
+{
+	double sum = 0.0;
+
+	zipf_cdf.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		sum += 1.0 / (i + 1);
+		zipf_cdf[i] = sum;
+	}
+	for (int i = 0; i < count; ++i)
+		zipf_cdf[i] /= sum;
+}
+
+
+
+int
+PickZipf()
+{
+	double x = RandDouble();
+	int lo = 0;
+	int hi = zipf_cdf.size() - 1;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (zipf_cdf[mid] < x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+
+// MakeBase()
+//
+// Makes the part of a name before the extension.  len_min and len_max
+// count characters, not bytes; a UTF-8 piece counts as one character.
+
+string
+MakeBase(int len_min, int len_max, bool unicode)
+{
+	string s;
+	int len = len_min + RandBelow(len_max - len_min + 1);
+
+	for (int i = 0; i < len; ++i)
+	{
+		if (unicode && RandBelow(4) == 0)
+			s += utf8_bits[RandBelow(utf8_bits_count)];
+		else
+			s += alphabet[RandBelow(strlen(alphabet))];
+	}
+
+	// a leading dash would look like an option; a leading dot, hidden
+	if (s[0] == '-')
+		s[0] = 'm';
+
+	return s;
+}
+
+
+
+bool
+ParseNum(CSZ csz, long& n)
+{
+	char *pend;
+
+	errno = 0;
+	n = strtol(csz, &pend, 10);
+	return errno == 0 && pend != csz && *pend == '\0' && n >= 0;
+}
+
+
+
+void
+Usage()
+{
+	fputs(usage_str, stderr);
+	exit(2);
+}
+
+
+} // end unnamed namespace
+
+
+
+int
+main(int argc, char *argv[])
+{
+	long count = 1000;
+	long ext_count = 20;
+	bool zipf = false;
+	int len_min = 4;
+	int len_max = 24;
+	long pct_unicode = 0;
+	long pct_suffix = 0;
+	long dir_count = 0;
+	long seed = 1;
+
+	int ch;
+	while ((ch = getopt(argc, argv, "n:e:zl:u:s:d:r:")) != -1)
+	{
+		bool ok = true;
+
+		switch (ch)
+		{
+		case 'n':
+			ok = ParseNum(optarg, count);
+			break;
+		case 'e':
+			ok = ParseNum(optarg, ext_count) && ext_count > 0;
+			break;
+		case 'z':
+			zipf = true;
+			break;
+		case 'l':
+			ok = sscanf(optarg, "%d,%d", &len_min, &len_max) == 2
+					&& len_min > 0 && len_min <= len_max;
+			break;
+		case 'u':
+			ok = ParseNum(optarg, pct_unicode) && pct_unicode <= 100;
+			break;
+		case 's':
+			ok = ParseNum(optarg, pct_suffix) && pct_suffix <= 100;
+			break;
+		case 'd':
+			ok = ParseNum(optarg, dir_count);
+			break;
+		case 'r':
+			ok = ParseNum(optarg, seed);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+
+		if (!ok)
+			Usage();
+	}
+
+	if (optind != argc - 1)
+		Usage();
+
+	CSZ dir = argv[optind];
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+	{
+		perror(dir);
+		return 1;
+	}
+	if (chdir(dir) != 0)
+	{
+		perror(dir);
+		return 1;
+	}
+
+	// a zero state would make xorshift return zeroes forever
+	rng_state = 0x9e3779b97f4a7c15ULL ^ seed;
+	if (zipf)
+		InitZipf(ext_count);
+
+	char buf[64];
+	for (long i = 0; i < dir_count; ++i)
+	{
+		sprintf(buf, "dir%ld", i);
+		if (mkdir(buf, 0755) != 0 && errno != EEXIST)
+		{
+			perror(buf);
+			return 1;
+		}
+	}
+
+	long made = 0;
+	long tries = 0;
+	while (made < count)
+	{
+		string name;
+
+		if (Percent(pct_suffix))
+		{
+			// "foo-2.18": lf treats this as a name with no extension
+			sprintf(buf, "-%ld.%ld", RandBelow(100), RandBelow(1000));
+			name = stems[RandBelow(stems_count)];
+			name += buf;
+		}
+		else
+		{
+			name = MakeBase(len_min, len_max, Percent(pct_unicode));
+
+			int i_ext = zipf ? PickZipf() : RandBelow(ext_count);
+			name += '.';
+			name += ExtName(i_ext);
+		}
+
+		int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0)
+		{
+			if (errno != EEXIST)
+			{
+				perror(name.c_str());
+				return 1;
+			}
+
+			// short names run out; don't loop forever looking for more
+			if (++tries > 100 * count + 1000)
+			{
+				fprintf(stderr, "lfgen: only %ld unique names\n", made);
+				return 1;
+			}
+			continue;
+		}
+
+		close(fd);
+		++made;
+	}
+
+	return 0;
+}
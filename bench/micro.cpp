@@ -0,0 +1,352 @@
+// micro.cpp
+//
+// Microbenchmarks for the functions lf calls once per name: the sort
+// comparison in each sort order, ScanForExtension(), ForceToLower(),
+// ReplaceSpaces(), IsNum() and MakeFullPathName().  ScanForExtension() is
+// timed twice, the second time with the built-in compound extensions.
+//
+// This file includes lf.cpp itself (with its main() left out), so the
+// functions measured are exactly the ones lf runs, compiled the same
+// way, and nothing had to be exported from lf.cpp just for benchmarks.
+//
+// bench_micro [-n names] [-p passes] [-d dir] [locale...]
+//
+// -n names	how many names in the made-up corpus (default 10000)
+// -p passes	how many times to run each function over the corpus
+// -d dir	use the names in dir instead of a made-up corpus
+//
+// The locale-dependent functions are run once for each locale named
+// (default: C, en_US.UTF-8 and fr_FR.UTF-8); a locale that isn't
+// installed is reported and skipped.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// lf.cpp keeps some of its types in an unnamed namespace, which g++
+// only warns about when the file is included rather than compiled
+#pragma GCC diagnostic ignored "-Wsubobject-linkage"
+
+#define LF_BENCH_MICRO
+#include "lf.cpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+
+
+namespace	// begin unnamed namespace
+{
+
+
+CSZ const default_locales[] = { "C", "en_US.UTF-8", "fr_FR.UTF-8" };
+
+const string bench_path("/home/user/src/project");
+
+vector<string> corpus;
+int passes = 20;
+
+// results are added into this so the compiler can't throw away the work
+volatile long sink;
+
+
+
+long
+NowNs()
+{
+	return ClockNs(CLOCK_MONOTONIC);
+}
+
+
+
+unsigned long long
+NowCycles()
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+
+
+// MakeCorpus()
+//
+// Makes up names that look like the contents of real directories:
+// source files, build products, versioned tarballs, documents with
+// spaces and capitals, names with no extension, and some UTF-8.
+
+void
+MakeCorpus(int count)
+{
+	CSZ const stems[] =
+	{
+		"main", "util", "Makefile", "README", "lf_strings", "filetest",
+		"libfoo-2.18", "photo 001", "Annual Report", "\xc3\xa9t\xc3\xa9",
+		"r\xc3\xa9sum\xc3\xa9", "\xe6\x97\xa5\xe6\x9c\xac", "index", "x",
+	};
+	CSZ const exts[] =
+	{
+		".c", ".h", ".cpp", ".hpp", ".o", ".txt", ".JPG", ".tar.gz",
+		".html", "", ".md5sum", ".1", ".Py", ".bak",
+	};
+	const int stems_count = sizeof(stems) / sizeof(stems[0]);
+	const int exts_count = sizeof(exts) / sizeof(exts[0]);
+
+	unsigned long state = 12345;
+	char buf[32];
+
+	corpus.clear();
+	for (int i = 0; i < count; ++i)
+	{
+		// simple LCG; the corpus only has to be the same every run
+		state = state * 6364136223846793005UL + 1442695040888963407UL;
+		unsigned long r = state >> 33;
+
+		string name = stems[r % stems_count];
+		sprintf(buf, "%lu", (r / stems_count) % 1000);
+		name += buf;
+		name += exts[(r / stems_count / 1000) % exts_count];
+		corpus.push_back(name);
+	}
+}
+
+
+
+bool
+ReadCorpus(CSZ dir)
+{
+	DIR *pdir = opendir(dir);
+	if (pdir == NULL)
+		return false;
+
+	corpus.clear();
+	struct dirent *pdirent;
+	while ((pdirent = readdir(pdir)) != NULL)
+		corpus.push_back(pdirent->d_name);
+
+	closedir(pdir);
+	return !corpus.empty();
+}
+
+
+
+void
+Report(CSZ locale_name, CSZ kernel, long calls, long ns,
+		unsigned long long cycles)
+{
+	char buf[128];
+
+	sprintf(buf, "%-12s %-24s %10ld %9.1f", locale_name, kernel, calls,
+			double(ns) / calls);
+	out << buf;
+#ifdef HAVE_RDTSC
+	sprintf(buf, " %9.1f", double(cycles) / calls);
+	out << buf;
+#endif
+	out << '\n';
+}
+
+
+
+// Run()
+//
+// Times one function over the whole corpus, passes times over.  The
+// function gets the index of a name, and returns a number to feed to
+// the sink.
+
+template <class FN>
+void
+Run(CSZ locale_name, CSZ kernel, FN fn)
+{
+	const int n = corpus.size();
+	long total = 0;
+
+	// one pass to warm up caches and the branch predictor
+	for (int i = 0; i < n; ++i)
+		total += fn(i);
+
+	long ns0 = NowNs();
+	unsigned long long cycles0 = NowCycles();
+
+	for (int pass = 0; pass < passes; ++pass)
+		for (int i = 0; i < n; ++i)
+			total += fn(i);
+
+	unsigned long long cycles = NowCycles() - cycles0;
+	long ns = NowNs() - ns0;
+
+	sink += total;
+	Report(locale_name, kernel, long(n) * passes, ns, cycles);
+}
+
+
+
+// Other()
+//
+// Index of the name to compare with name i.  Stepping by a large prime
+// pairs up names from all over the corpus, as a sort does, rather than
+// just neighbours.
+
+inline int
+Other(int i)
+{
+	return (i + 7919) % corpus.size();
+}
+
+
+
+void
+RunCompare(CSZ locale_name, sort_method sort, CSZ kernel)
+{
+	mycompare cmp;
+
+	options.sort = sort;
+	Run(locale_name, kernel, [&](int i) {
+		return long(cmp(corpus[i], corpus[Other(i)]));
+	});
+}
+
+
+
+// RunLocale()
+//
+// Runs the locale-dependent functions with one locale.
+
+void
+RunLocale(CSZ locale_name)
+{
+	try
+	{
+		def_locale = locale(locale_name);
+	}
+	catch (...)
+	{
+		out << locale_name << ": locale not installed; skipped\n";
+		return;
+	}
+	pdef_ctype = &use_facet<ctype<char> >(def_locale);
+	pdef_collate = &use_facet<collate<char> >(def_locale);
+
+	RunCompare(locale_name, sort_locale, "compare locale");
+
+	Run(locale_name, "ForceToLower", [](int i) {
+		string s = corpus[i];
+		ForceToLower(s);
+		return long(s.length());
+	});
+}
+
+
+
+void
+Usage()
+{
+	errout << "Usage: bench_micro [-n names] [-p passes] [-d dir] "
+			"[locale...]\n";
+	errout.flush();
+	exit(2);
+}
+
+
+} // end unnamed namespace
+
+
+
+int
+main(int argc, char *argv[])
+{
+	int names = 10000;
+	CSZ dir = NULL;
+
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; ++i)
+	{
+		if (i + 1 >= argc)
+			Usage();
+
+		if (strcmp(argv[i], "-n") == 0)
+		{
+			if (!ConvertAtoI(argv[++i], names) || names < 2)
+				Usage();
+		}
+		else if (strcmp(argv[i], "-p") == 0)
+		{
+			if (!ConvertAtoI(argv[++i], passes) || passes < 1)
+				Usage();
+		}
+		else if (strcmp(argv[i], "-d") == 0)
+			dir = argv[++i];
+		else
+			Usage();
+	}
+
+	if (dir != NULL)
+	{
+		if (!ReadCorpus(dir))
+		{
+			Err(dir, err_str[bad_filename]);
+			return 1;
+		}
+	}
+	else
+		MakeCorpus(names);
+
+	SetStrings();
+	options.s_replace_space = "_";
+	UseClassicLocale();
+
+	out << "locale       function                      calls   ns/call";
+#ifdef HAVE_RDTSC
+	out << "  cyc/call";
+#endif
+	out << '\n';
+
+	// these don't depend on the locale
+	RunCompare("-", sort_ascii, "compare ascii");
+	RunCompare("-", sort_ascii_ic, "compare ascii-ic");
+
+	Run("-", "ScanForExtension", [](int i) {
+		return long(ScanForExtension(corpus[i]));
+	});
+
+	// again, with the built-in compound extensions to look for first
+	for (int j = 0; j < builtin_compound_exts_max; ++j)
+		compound_exts.Add(builtin_compound_exts[j]);
+	compound_exts.Build();
+	Run("-", "ScanForExtension comp", [](int i) {
+		return long(ScanForExtension(corpus[i]));
+	});
+	Run("-", "IsNum", [](int i) {
+		return long(IsNum(corpus[i]));
+	});
+	Run("-", "string copy", [](int i) {
+		string s = corpus[i];
+		return long(s.length());
+	});
+	Run("-", "ReplaceSpaces", [](int i) {
+		string s = corpus[i];
+		ReplaceSpaces(s);
+		return long(s.length());
+	});
+	Run("-", "MakeFullPathName", [](int i) {
+		return long(MakeFullPathName(corpus[i], bench_path).length());
+	});
+
+	if (i < argc)
+	{
+		for (; i < argc; ++i)
+			RunLocale(argv[i]);
+	}
+	else
+	{
+		for (CSZ locale_name : default_locales)
+			RunLocale(locale_name);
+	}
+
+	out.flush();
+	return 0;
+}
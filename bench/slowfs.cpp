@@ -0,0 +1,377 @@
+// slowfs.cpp
+//
+// A shared library to load with LD_PRELOAD, which makes directory and
+// stat() calls slow, the way they are on a network filesystem.  With
+// it, a benchmark on a fast local tmpfs can show whether a change
+// helps or hurts on NFS, where every trip to the server costs a round
+// trip on the network.
+//
+// LD_PRELOAD=Release/slowfs.so SLOWFS_US=300 Release/lf /dev/shm/dir
+//
+// Settings come from the environment:
+//
+// SLOWFS_US		latency of one round trip, in microseconds
+//			(default 200)
+// SLOWFS_JITTER_US	each delay is SLOWFS_US plus or minus up to this
+//			much, chosen at random (default 0)
+// SLOWFS_READDIR_BATCH	how many directory entries one round trip
+//			brings back; readdir() only waits when it starts a
+//			new batch (default 32; NFS typically returns a
+//			few dozen entries per READDIR call)
+//
+// Calls that are slowed down: opendir(), fdopendir(), readdir(),
+// readdir64(), getdents64(), stat(), lstat(), fstatat(), statx() and
+// their 64-bit and old-glibc (__xstat and friends) names.  Each one
+// waits once per call, except readdir() as described above.  The wait
+// is a sleep, not a busy loop, so threads that wait at the same time
+// overlap, as requests to a real server would.
+//
+// Note that glibc's readdir() calls getdents64() internally, without
+// going through the dynamic linker, so a program calling readdir() is
+// only slowed down by the batch rule, not twice.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cerrno>
+#include <cstdlib>
+
+// for dlsym()
+#include <dlfcn.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+namespace	// begin unnamed namespace
+{
+
+
+long latency_ns = -1;	// -1: not read from the environment yet
+long jitter_ns;
+long readdir_batch;
+
+// entries left in the current readdir() batch, for this thread; a
+// thread usually reads one directory at a time
+thread_local long batch_left;
+thread_local unsigned int rand_state;
+
+
+
+long
+EnvNum(const char *name, long default_value)
+{
+	const char *value = getenv(name);
+	if (value == NULL || *value == '\0')
+		return default_value;
+
+	char *pend;
+	long n = strtol(value, &pend, 10);
+	if (*pend != '\0' || n < 0)
+		return default_value;
+
+	return n;
+}
+
+
+
+void
+Init()
+{
+	jitter_ns = EnvNum("SLOWFS_JITTER_US", 0) * 1000;
+	readdir_batch = EnvNum("SLOWFS_READDIR_BATCH", 32);
+	if (readdir_batch < 1)
+		readdir_batch = 1;
+
+	// set this last; it is the flag that the others are ready
+	latency_ns = EnvNum("SLOWFS_US", 200) * 1000;
+}
+
+
+
+// Delay()
+//
+// Waits for one round trip.  Keeps errno as the caller left it, since
+// it is usually called just before or after the real function.
+
+void
+Delay()
+{
+	if (latency_ns < 0)
+		Init();
+
+	long ns = latency_ns;
+	if (jitter_ns > 0)
+	{
+		if (rand_state == 0)
+			rand_state = static_cast<unsigned int>(
+					reinterpret_cast<unsigned long>(&rand_state));
+		ns += rand_r(&rand_state) % (2 * jitter_ns + 1) - jitter_ns;
+	}
+	if (ns <= 0)
+		return;
+
+	int saved_errno = errno;
+	timespec ts;
+
+	ts.tv_sec = ns / 1000000000L;
+	ts.tv_nsec = ns % 1000000000L;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		;
+
+	errno = saved_errno;
+}
+
+
+
+void
+DelayReaddir()
+{
+	if (latency_ns < 0)
+		Init();
+
+	if (batch_left <= 0)
+	{
+		Delay();
+		batch_left = readdir_batch;
+	}
+	--batch_left;
+}
+
+
+
+// Real()
+//
+// Finds the function that would have been called without this library.
+
+template <class FN>
+FN
+Real(FN& fn, const char *name)
+{
+	if (fn == 0)
+		fn = reinterpret_cast<FN>(dlsym(RTLD_NEXT, name));
+	return fn;
+}
+
+
+} // end unnamed namespace
+
+
+
+// The wrappers.  If the real function can't be found (an old-glibc name
+// on a new glibc, say) the call fails with ENOSYS; nothing should call
+// a name its C library doesn't have.
+
+#define NO_REAL(rc)	do { errno = ENOSYS; return rc; } while (0)
+
+extern "C"
+{
+
+
+DIR *
+opendir(const char *name)
+{
+	static DIR *(*fn)(const char *);
+
+	if (Real(fn, "opendir") == 0)
+		NO_REAL(0);
+	Delay();
+	batch_left = 0;
+	return fn(name);
+}
+
+
+
+DIR *
+fdopendir(int fd)
+{
+	static DIR *(*fn)(int);
+
+	if (Real(fn, "fdopendir") == 0)
+		NO_REAL(0);
+	Delay();
+	batch_left = 0;
+	return fn(fd);
+}
+
+
+
+struct dirent *
+readdir(DIR *pdir)
+{
+	static struct dirent *(*fn)(DIR *);
+
+	if (Real(fn, "readdir") == 0)
+		NO_REAL(0);
+	DelayReaddir();
+	return fn(pdir);
+}
+
+
+
+struct dirent64 *
+readdir64(DIR *pdir)
+{
+	static struct dirent64 *(*fn)(DIR *);
+
+	if (Real(fn, "readdir64") == 0)
+		NO_REAL(0);
+	DelayReaddir();
+	return fn(pdir);
+}
+
+
+
+ssize_t
+getdents64(int fd, void *buf, size_t n)
+{
+	static ssize_t (*fn)(int, void *, size_t);
+
+	if (Real(fn, "getdents64") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(fd, buf, n);
+}
+
+
+
+int
+stat(const char *path, struct stat *pst)
+{
+	static int (*fn)(const char *, struct stat *);
+
+	if (Real(fn, "stat") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(path, pst);
+}
+
+
+
+int
+lstat(const char *path, struct stat *pst)
+{
+	static int (*fn)(const char *, struct stat *);
+
+	if (Real(fn, "lstat") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(path, pst);
+}
+
+
+
+int
+fstatat(int dirfd, const char *path, struct stat *pst, int flags)
+{
+	static int (*fn)(int, const char *, struct stat *, int);
+
+	if (Real(fn, "fstatat") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(dirfd, path, pst, flags);
+}
+
+
+
+int
+stat64(const char *path, struct stat64 *pst)
+{
+	static int (*fn)(const char *, struct stat64 *);
+
+	if (Real(fn, "stat64") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(path, pst);
+}
+
+
+
+int
+lstat64(const char *path, struct stat64 *pst)
+{
+	static int (*fn)(const char *, struct stat64 *);
+
+	if (Real(fn, "lstat64") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(path, pst);
+}
+
+
+
+int
+fstatat64(int dirfd, const char *path, struct stat64 *pst, int flags)
+{
+	static int (*fn)(int, const char *, struct stat64 *, int);
+
+	if (Real(fn, "fstatat64") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(dirfd, path, pst, flags);
+}
+
+
+
+int
+statx(int dirfd, const char *path, int flags, unsigned int mask,
+		struct statx *pstx)
+{
+	static int (*fn)(int, const char *, int, unsigned int, struct statx *);
+
+	if (Real(fn, "statx") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(dirfd, path, flags, mask, pstx);
+}
+
+
+
+// Before glibc 2.33, stat() and friends were inline functions in
+// <sys/stat.h> that called these.
+
+int
+__xstat(int ver, const char *path, struct stat *pst)
+{
+	static int (*fn)(int, const char *, struct stat *);
+
+	if (Real(fn, "__xstat") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(ver, path, pst);
+}
+
+
+
+int
+__lxstat(int ver, const char *path, struct stat *pst)
+{
+	static int (*fn)(int, const char *, struct stat *);
+
+	if (Real(fn, "__lxstat") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(ver, path, pst);
+}
+
+
+
+int
+__fxstatat(int ver, int dirfd, const char *path, struct stat *pst,
+		int flags)
+{
+	static int (*fn)(int, int, const char *, struct stat *, int);
+
+	if (Real(fn, "__fxstatat") == 0)
+		NO_REAL(-1);
+	Delay();
+	return fn(ver, dirfd, path, pst, flags);
+}
+
+
+} // extern "C"
@@ -39,6 +39,9 @@ typedef STATBUF *PSTATBUF;
 // for errno
 #include <errno.h>
 
+// for AT_FDCWD
+#include <fcntl.h>
+
 // for stat()
 #include <sys/types.h>
 #include <unistd.h>
@@ -53,14 +56,15 @@ using namespace std;
 // Tests the pathname and figures out what type of file it is.
 // Returns false if the file does not exist.
 // Returns true and modifies the filetype& argument if file exists.
+// The name may be relative to an open directory, dir_fd.
 
 bool
-filetest::check_type(CSREF pathname, filetest::filetype& ft)
+filetest::check_type(int dir_fd, CSZ name, filetest::filetype& ft)
 {
 	STATBUF sb;
 	bool b;
 
-	int rc = c_stat::stat(pathname.c_str(), &sb);
+	int rc = c_stat::fstatat(dir_fd, name, &sb, 0);
 
 	// stat() returns an error if the file is too big!  This is annoying
 	// if we are just trying to find out the file type.  So, just ignore
@@ -89,6 +93,119 @@ filetest::check_type(CSREF pathname, filetest::filetype& ft)
 
 
 
+bool
+filetest::check_type(CSREF pathname, filetest::filetype& ft)
+{
+	return filetest::check_type(AT_FDCWD, pathname.c_str(), ft);
+}
+
+
+
+// TypeFromMode()
+//
+// The filetype for a file mode from stat().
+
+filetest::filetype
+TypeFromMode(unsigned mode)
+{
+	if (S_ISDIR(mode))
+		return filetest::ft_dir;
+	else if (S_ISREG(mode))
+		return filetest::ft_file;
+	else
+		return filetest::ft_special_file;
+}
+
+
+
+// StatTypeAnd()
+//
+// Gets the type of a file and one more thing about it: its size, or
+// its modification time in nanoseconds.  Where there is statx(), only
+// those two are asked for, so a filesystem that has to work to fill in
+// the rest of a stat buffer (a network filesystem, say) need not
+// bother.  The name is looked up relative to an open directory, so the
+// kernel doesn't walk the whole path again for every name in the
+// directory.
+
+enum stat_field { sf_size, sf_mtime };
+
+bool
+StatTypeAnd(int dir_fd, CSZ name, stat_field field, filetest::filetype& ft,
+		long long& value)
+{
+#ifdef STATX_SIZE
+	struct c_stat::statx stx;
+	unsigned mask = STATX_TYPE | (field == sf_size ? STATX_SIZE : STATX_MTIME);
+
+	if (c_stat::statx(dir_fd, name, 0, mask, &stx) != 0)
+		return false;
+
+	ft = TypeFromMode(stx.stx_mode);
+	if (field == sf_size)
+		value = stx.stx_size;
+	else
+		value = stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+#else
+	STATBUF sb;
+
+	if (c_stat::fstatat(dir_fd, name, &sb, 0) != 0)
+		return false;
+
+	ft = TypeFromMode(sb.st_mode);
+	if (field == sf_size)
+		value = sb.st_size;
+	else
+		value = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+#endif
+
+	return true;
+}
+
+
+
+// filetest::check_type_size()
+// filetest::check_type_mtime()
+//
+// Like check_type(), but also get the size or the modification time
+// (in nanoseconds) of the file.
+
+bool
+filetest::check_type_size(int dir_fd, CSZ name, filetest::filetype& ft,
+		long long& size)
+{
+	return StatTypeAnd(dir_fd, name, sf_size, ft, size);
+}
+
+
+
+bool
+filetest::check_type_size(CSREF pathname, filetest::filetype& ft,
+		long long& size)
+{
+	return StatTypeAnd(AT_FDCWD, pathname.c_str(), sf_size, ft, size);
+}
+
+
+
+bool
+filetest::check_type_mtime(int dir_fd, CSZ name, filetest::filetype& ft,
+		long long& mtime_ns)
+{
+	return StatTypeAnd(dir_fd, name, sf_mtime, ft, mtime_ns);
+}
+
+
+
+bool
+filetest::check_type_mtime(CSREF pathname, filetest::filetype& ft,
+		long long& mtime_ns)
+{
+	return StatTypeAnd(AT_FDCWD, pathname.c_str(), sf_mtime, ft, mtime_ns);
+}
+
+
+
 bool
 filetest::check_type(CSREF basename, CSREF path, filetest::filetype& ft)
 {
@@ -26,6 +26,17 @@ namespace filetest
 
 	bool check_type(CSREF basename, CSREF path, filetype& ft);
 	bool check_type(CSREF pathname, filetype& ft);
+	bool check_type(int dir_fd, CSZ name, filetype& ft);
+
+	// also get the size or the modification time; the name is relative
+	// to the open directory dir_fd, or to the current directory for the
+	// pathname form
+	bool check_type_size(int dir_fd, CSZ name, filetype& ft,
+			long long& size);
+	bool check_type_size(CSREF pathname, filetype& ft, long long& size);
+	bool check_type_mtime(int dir_fd, CSZ name, filetype& ft,
+			long long& mtime_ns);
+	bool check_type_mtime(CSREF pathname, filetype& ft, long long& mtime_ns);
 };
 
 
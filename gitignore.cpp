@@ -0,0 +1,701 @@
+// gitignore.cpp
+//
+// Ignore rules, for lf --gitignore.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <algorithm>
+
+// for open(), read(), fnmatch(), realpath()
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+#include "gitignore.hpp"
+
+using namespace std;
+
+
+
+const char ch_backslash = '\\';
+const char ch_slash = '/';
+
+const size_t word_bits = 64;
+
+static const string s_globstar("**");
+
+
+
+// ParseGlob()
+//
+// Turns a glob for a name into its steps.  A backslash quotes the
+// character after it; a "[" with no "]" to close it is just a "[".
+// Several "*" in a row are the same as one.
+
+void
+ParseGlob(CSREF glob, VEC_GLOB_TOKEN& tokens)
+{
+	const size_t len = glob.length();
+
+	tokens.clear();
+	for (size_t i = 0; i < len; ++i)
+	{
+		glob_token t;
+		t.is_star = false;
+
+		char ch = glob[i];
+		if (ch == '*')
+		{
+			if (tokens.empty() || !tokens.back().is_star)
+			{
+				t.is_star = true;
+				tokens.push_back(t);
+			}
+			continue;
+		}
+
+		if (ch == '?')
+			t.chars.set();
+		else if (ch == '[')
+		{
+			size_t j = i + 1;
+			bool negate = false;
+			if (j < len && (glob[j] == '!' || glob[j] == '^'))
+			{
+				negate = true;
+				++j;
+			}
+
+			// a "]" right at the start is one of the characters
+			for (size_t first = j; j < len && (glob[j] != ']' || j == first);
+					++j)
+			{
+				unsigned char lo = glob[j];
+				if (lo == ch_backslash && j + 1 < len)
+					lo = glob[++j];
+
+				unsigned char hi = lo;
+				if (j + 2 < len && glob[j + 1] == '-' && glob[j + 2] != ']')
+				{
+					j += 2;
+					hi = glob[j];
+					if (hi == ch_backslash && j + 1 < len)
+						hi = glob[++j];
+				}
+
+				for (unsigned c = lo; c <= hi; ++c)
+					t.chars.set(c);
+			}
+
+			if (j < len)
+			{
+				if (negate)
+					t.chars.flip();
+				i = j;	// the "]"
+			}
+			else
+			{
+				t.chars.reset();
+				t.chars.set((unsigned char)'[');
+			}
+		}
+		else
+		{
+			if (ch == ch_backslash && i + 1 < len)
+				ch = glob[++i];
+			t.chars.set((unsigned char)ch);
+		}
+
+		tokens.push_back(t);
+	}
+}
+
+
+
+// glob_set::Add()
+// glob_set::Build()
+//
+// Each glob of n steps gets n + 1 bits of state; bit j means the first
+// j steps have matched.  A step that takes one byte moves its bit up by
+// one; a "*" moves its bit up by one without taking a byte, and keeps
+// the bit after it on for any byte.  Only bytes that aren't taken
+// clear a bit, so a glob's bits never spill over into the next glob's.
+
+void
+glob_set::Add(const VEC_GLOB_TOKEN& tokens, int rule)
+{
+	globs.push_back(tokens);
+	rules.push_back(rule);
+}
+
+
+
+inline void
+SetBit(vector<uint64_t>& v, size_t offset, size_t bit)
+{
+	v[offset + bit / word_bits] |= uint64_t(1) << (bit % word_bits);
+}
+
+
+
+// ShiftStars()
+//
+// Turns on the bit after each "*" that is on: the "*" matching nothing.
+// A "*" is never followed by another, so one shift is enough.
+
+inline void
+ShiftStars(uint64_t *state, const uint64_t *star, size_t words)
+{
+	uint64_t carry = 0;
+
+	for (size_t w = 0; w < words; ++w)
+	{
+		uint64_t t = state[w] & star[w];
+		state[w] |= (t << 1) | carry;
+		carry = t >> (word_bits - 1);
+	}
+}
+
+
+
+void
+glob_set::Build()
+{
+	size_t bits = 0;
+	for (size_t g = 0; g < globs.size(); ++g)
+		bits += globs[g].size() + 1;
+
+	words = (bits + word_bits - 1) / word_bits;
+	consume.assign(256 * words, 0);
+	loop.assign(256 * words, 0);
+	star.assign(words, 0);
+	start.assign(words, 0);
+	accept.assign(words, 0);
+	accept_rule.assign(words * word_bits, -1);
+
+	size_t base = 0;
+	for (size_t g = 0; g < globs.size(); ++g)
+	{
+		const VEC_GLOB_TOKEN& tokens = globs[g];
+
+		SetBit(start, 0, base);
+		for (size_t j = 0; j < tokens.size(); ++j)
+		{
+			if (tokens[j].is_star)
+			{
+				SetBit(star, 0, base + j);
+				for (unsigned c = 0; c < 256; ++c)
+					SetBit(loop, c * words, base + j + 1);
+			}
+			else
+			{
+				for (unsigned c = 0; c < 256; ++c)
+					if (tokens[j].chars.test(c))
+						SetBit(consume, c * words, base + j);
+			}
+		}
+
+		const size_t end = base + tokens.size();
+		SetBit(accept, 0, end);
+		accept_rule[end] = rules[g];
+
+		base = end + 1;
+	}
+
+	ShiftStars(&start[0], &star[0], words);
+
+	vector<VEC_GLOB_TOKEN>().swap(globs);
+	vector<int>().swap(rules);
+}
+
+
+
+int
+glob_set::Match(CSZ name, size_t len) const
+{
+	if (words == 0)
+		return -1;
+
+	// names are matched on several threads at once with --count
+	thread_local vector<uint64_t> state, next;
+	state.assign(start.begin(), start.end());
+	next.resize(words);
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		const size_t row = (unsigned char)name[i] * words;
+		uint64_t carry = 0;
+		uint64_t live = 0;
+
+		for (size_t w = 0; w < words; ++w)
+		{
+			uint64_t t = state[w] & consume[row + w];
+			next[w] = (t << 1) | carry | (state[w] & loop[row + w]);
+			carry = t >> (word_bits - 1);
+		}
+		ShiftStars(&next[0], &star[0], words);
+
+		for (size_t w = 0; w < words; ++w)
+			live |= next[w];
+		if (live == 0)
+			return -1;	// no glob can match any more
+
+		state.swap(next);
+	}
+
+	// globs were added in rule order, so the highest bit wins
+	for (size_t w = words; w-- > 0; )
+	{
+		uint64_t a = state[w] & accept[w];
+		if (a != 0)
+		{
+			size_t bit = (word_bits - 1) - __builtin_clzll(a);
+			return accept_rule[w * word_bits + bit];
+		}
+	}
+
+	return -1;
+}
+
+
+
+// name_rules::Add()
+//
+// Sorts a pattern into its table: an exact name, a "*" and then an
+// exact suffix, or any other glob.
+
+void
+name_rules::Add(CSREF pattern, int rule)
+{
+	VEC_GLOB_TOKEN tokens;
+	ParseGlob(pattern, tokens);
+
+	const size_t first = (!tokens.empty() && tokens[0].is_star) ? 1 : 0;
+	string s;
+	for (size_t j = first; j < tokens.size(); ++j)
+	{
+		if (tokens[j].is_star || tokens[j].chars.count() != 1)
+			break;
+		for (unsigned c = 0; c < 256; ++c)
+			if (tokens[j].chars.test(c))
+				s += char(c);
+	}
+
+	if (s.empty() || first + s.length() != tokens.size())
+		globs.Add(tokens, rule);
+	else if (first == 0)
+		pending_names.push_back(make_pair(s, rule));
+	else
+		pending_suffixes.push_back(make_pair(s, rule));
+}
+
+
+
+// by_key
+//
+// Orders (key, rule) pairs by key; a stable sort keeps them in rule
+// order within each key.
+
+struct by_key
+{
+	bool
+	operator()(const pair<string, int>& a, const pair<string, int>& b) const
+	{
+		return a.first < b.first;
+	}
+};
+
+
+
+// name_rules::BuildTable()
+//
+// Puts each key in a perfect hash table once, with the last rule added
+// for it, which is the one that wins.
+
+void
+name_rules::BuildTable(vector<pair<string, int> >& v, perfect_hash& ph)
+{
+	stable_sort(v.begin(), v.end(), by_key());
+
+	for (size_t i = 0; i < v.size(); ++i)
+		if (i + 1 == v.size() || v[i + 1].first != v[i].first)
+			ph.Add(v[i].first, v[i].second);
+
+	if (!v.empty())
+		ph.Build();
+}
+
+
+
+void
+name_rules::Build()
+{
+	for (size_t i = 0; i < pending_suffixes.size(); ++i)
+		suffix_lengths.push_back(pending_suffixes[i].first.length());
+	sort(suffix_lengths.begin(), suffix_lengths.end());
+	suffix_lengths.erase(unique(suffix_lengths.begin(), suffix_lengths.end()),
+			suffix_lengths.end());
+
+	BuildTable(pending_names, names);
+	BuildTable(pending_suffixes, suffixes);
+	globs.Build();
+
+	vector<pair<string, int> >().swap(pending_names);
+	vector<pair<string, int> >().swap(pending_suffixes);
+}
+
+
+
+int
+name_rules::Match(CSZ name, size_t len) const
+{
+	int rule = names.Lookup(name, len);
+
+	for (size_t i = 0; i < suffix_lengths.size(); ++i)
+	{
+		const size_t n = suffix_lengths[i];
+		if (n > len)
+			break;
+		rule = max(rule, suffixes.Lookup(name + len - n, n));
+	}
+
+	return max(rule, globs.Match(name, len));
+}
+
+
+
+bool
+name_rules::empty() const
+{
+	return names.size() == 0 && suffixes.size() == 0 && globs.empty();
+}
+
+
+
+// SplitPath()
+//
+// Splits a path into its parts, leaving out empty ones.
+
+void
+SplitPath(CSREF path, vector<string>& parts)
+{
+	parts.clear();
+
+	size_t i = 0;
+	while (i < path.length())
+	{
+		size_t j = path.find(ch_slash, i);
+		if (j == string::npos)
+			j = path.length();
+		if (j > i)
+			parts.push_back(path.substr(i, j - i));
+		i = j + 1;
+	}
+}
+
+
+
+// AddStars()
+//
+// A "**" part can match no parts at all, so wherever a match could be
+// at a "**", it could as well be at the part after it.
+
+void
+AddStars(const vector<string>& parts, vector<bool>& at)
+{
+	for (size_t i = 0; i < parts.size(); ++i)
+		if (at[i] && parts[i] == s_globstar)
+			at[i + 1] = true;
+}
+
+
+
+// NamePatterns()
+//
+// Boils an anchored pattern down to patterns for the names in one
+// directory, rel, given relative to the directory of the ignore file.
+// The pattern's parts are matched against the parts of rel; then each
+// place the match could be at gives a pattern for the last part, if the
+// pattern ends there.  A "**" matches any number of parts, except at
+// the end, where it has to match at least one: "foo/**" is everything
+// inside foo, but not foo.
+
+void
+NamePatterns(CSREF pattern, CSREF rel, vector<string>& out)
+{
+	vector<string> parts, rel_parts;
+	SplitPath(pattern, parts);
+	SplitPath(rel, rel_parts);
+
+	const size_t n = parts.size();
+	if (n == 0)
+		return;
+
+	vector<bool> at(n + 1, false);
+	at[0] = true;
+	AddStars(parts, at);
+
+	for (size_t r = 0; r < rel_parts.size(); ++r)
+	{
+		vector<bool> next(n + 1, false);
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (!at[i])
+				continue;
+			if (parts[i] == s_globstar)
+				next[i] = true;
+			else if (fnmatch(parts[i].c_str(), rel_parts[r].c_str(), 0) == 0)
+				next[i + 1] = true;
+		}
+		AddStars(parts, next);
+		at.swap(next);
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (!at[i])
+			continue;
+
+		if (parts[i] == s_globstar)
+		{
+			size_t j = i + 1;
+			while (j < n && parts[j] == s_globstar)
+				++j;
+			if (j == n)
+				out.push_back("*");
+		}
+		else if (i + 1 == n)
+			out.push_back(parts[i]);
+	}
+}
+
+
+
+// ignore_rules::AddPattern()
+//
+// Adds the rules for one line of an ignore file.
+
+void
+ignore_rules::AddPattern(string line, CSREF rel)
+{
+	if (!line.empty() && line[line.length() - 1] == '\r')
+		line.erase(line.length() - 1);
+
+	// spaces at the end don't count, unless quoted with a backslash
+	while (!line.empty() && line[line.length() - 1] == ' '
+			&& !(line.length() >= 2 && line[line.length() - 2] == ch_backslash))
+		line.erase(line.length() - 1);
+
+	if (line.empty() || line[0] == '#')
+		return;
+
+	bool negate = false;
+	if (line[0] == '!')
+	{
+		negate = true;
+		line.erase(0, 1);
+	}
+	else if (line.length() >= 2 && line[0] == ch_backslash
+			&& (line[1] == '!' || line[1] == '#'))
+		line.erase(0, 1);
+
+	bool dir_only = false;
+	if (!line.empty() && line[line.length() - 1] == ch_slash)
+	{
+		dir_only = true;
+		line.erase(line.length() - 1);
+	}
+
+	if (line.empty())
+		return;
+
+	vector<string> patterns;
+	if (line.find(ch_slash) == string::npos)
+		patterns.push_back(line);	// not anchored; any directory
+	else
+		NamePatterns(line, rel, patterns);
+
+	if (patterns.empty())
+		return;	// can't match in this directory
+
+	const int rule = negated.size();
+	negated.push_back(negate);
+
+	name_rules& r = dir_only ? dirs_only : any_type;
+	for (size_t i = 0; i < patterns.size(); ++i)
+		r.Add(patterns[i], rule);
+}
+
+
+
+// ReadIgnoreFile()
+//
+// Reads the lines of an ignore file, if there is one, into files.  The
+// patterns in it are relative to the directory that ends at dir_end in
+// the full path name of the directory being listed.
+
+void
+ReadIgnoreFile(CSREF path, size_t dir_end, vector<ignore_file>& files)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	string text;
+	char buf[4096];
+	for (;;)
+	{
+		ssize_t rc = read(fd, buf, sizeof(buf));
+		if (rc <= 0)
+			break;
+		text.append(buf, rc);
+	}
+	close(fd);
+
+	files.push_back(ignore_file());
+	files.back().dir_end = dir_end;
+
+	size_t i = 0;
+	while (i < text.length())
+	{
+		size_t j = text.find('\n', i);
+		if (j == string::npos)
+			j = text.length();
+		files.back().lines.push_back(text.substr(i, j - i));
+		i = j + 1;
+	}
+}
+
+
+
+// ignore_rules::Compile()
+//
+// Compiles the patterns of files into the rules for the directory that
+// ends at dir_end in abs.
+
+void
+ignore_rules::Compile(const vector<ignore_file>& files, CSREF abs,
+		size_t dir_end)
+{
+	// rule 0: never list the repository itself
+	negated.push_back(false);
+	any_type.Add(".git", 0);
+
+	for (size_t f = 0; f < files.size(); ++f)
+	{
+		const size_t start = files[f].dir_end;
+		const string rel = abs.substr(start, dir_end - start);
+
+		for (size_t i = 0; i < files[f].lines.size(); ++i)
+			AddPattern(files[f].lines[i], rel);
+	}
+
+	any_type.Build();
+	dirs_only.Build();
+}
+
+
+
+// ignore_rules::Load()
+//
+// Looks up from dir for the top of a git work tree (a directory with a
+// .git in it), and reads the ignore files from there down to dir.  As
+// in git, if any directory on the way down is ignored, so is everything
+// in it, whatever the ignore files further down say.
+
+void
+ignore_rules::Load(CSREF dir)
+{
+	static CSZ const ignore_names[] = { ".gitignore", ".ignore" };
+	const size_t ignore_names_count =
+			sizeof(ignore_names) / sizeof(ignore_names[0]);
+
+	string abs = dir;
+	char resolved[PATH_MAX];
+	if (realpath(dir.c_str(), resolved) != NULL)
+		abs = resolved;
+
+	// find the top of the work tree; if there isn't one, just dir
+	size_t top = abs.length();
+	bool in_tree = false;
+	for (size_t i = abs.length(); ; )
+	{
+		string d = abs.substr(0, i);
+		if (access(MakeFullPathName(".git", d.empty() ? "/" : d).c_str(),
+				F_OK) == 0)
+		{
+			top = i;
+			in_tree = true;
+			break;
+		}
+
+		if (i == 0)
+			break;
+		i = abs.rfind(ch_slash, i - 1);
+		if (i == string::npos)
+			break;
+	}
+
+	vector<ignore_file> files;
+	if (in_tree)
+		ReadIgnoreFile(MakeFullPathName(".git/info/exclude",
+				top == 0 ? "/" : abs.substr(0, top)), top, files);
+
+	for (size_t i = top; ; )
+	{
+		if (i > top)
+		{
+			// is this directory ignored by the rules of the one above?
+			const size_t parent = abs.rfind(ch_slash, i - 1);
+			ignore_rules up;
+			bool if_file, if_dir;
+
+			up.Compile(files, abs, parent);
+			up.Match(abs.c_str() + parent + 1, i - parent - 1,
+					if_file, if_dir);
+			if (if_dir)
+			{
+				all_ignored = true;
+				return;
+			}
+		}
+
+		string d = abs.substr(0, i);
+		for (size_t f = 0; f < ignore_names_count; ++f)
+			ReadIgnoreFile(MakeFullPathName(ignore_names[f],
+					d.empty() ? "/" : d), i, files);
+
+		if (i == abs.length())
+			break;
+		i = abs.find(ch_slash, i + 1);
+		if (i == string::npos)
+			i = abs.length();
+	}
+
+	Compile(files, abs, abs.length());
+}
+
+
+
+void
+ignore_rules::Match(CSZ name, size_t len, bool& if_file, bool& if_dir) const
+{
+	if (all_ignored)
+	{
+		if_file = if_dir = true;
+		return;
+	}
+
+	const int r_any = any_type.Match(name, len);
+	const int r_dir = max(r_any, dirs_only.Match(name, len));
+
+	if_file = r_any >= 0 && !negated[r_any];
+	if_dir = r_dir >= 0 && !negated[r_dir];
+}
@@ -0,0 +1,184 @@
+// gitignore.hpp
+//
+// Ignore rules, for lf --gitignore: the patterns of the .gitignore and
+// .ignore files that apply to one directory, compiled so that each name
+// read from the directory is checked against all of them at once.
+//
+// Patterns are as in gitignore(5): "#" starts a comment, "!" negates, a
+// "/" at the end matches only directories, a "/" anywhere else anchors
+// the pattern to the directory of its file, and "*", "?", "[...]" and
+// "**" are globs.  The files read are .git/info/exclude at the top of
+// the work tree, then .gitignore and .ignore in each directory from
+// there down to the one being listed; a later pattern wins over an
+// earlier one.  Outside a git work tree, only the directory's own files
+// are read.  A name ".git" is always ignored.
+//
+// lf reads one directory at a time, so when the rules are loaded, every
+// pattern is boiled down to a pattern for the names in that directory:
+// an anchored pattern either can't match there at all, or becomes a
+// pattern for the last part of the path.  What is left is compiled by
+// kind.  Exact names, and "*suffix" patterns such as "*.o", go in
+// perfect hash tables, for one lookup per name (and one per length of
+// suffix).  All the other globs are compiled together into one
+// automaton, which runs over each name once however many globs there
+// are.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// ignore_rules ignore;
+// ignore.Load("src");
+//
+// bool if_file, if_dir;
+// ignore.Match("main.o", 6, if_file, if_dir);
+// if (if_file)
+//	main.o is ignored, unless it is a directory (then see if_dir)...
+
+
+
+#ifndef GITIGNORE_HPP
+
+#define GITIGNORE_HPP
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <bitset>
+#include <string>
+#include <vector>
+
+#include "phash.hpp"
+#include "util.hpp"
+
+
+
+// glob_token
+//
+// One step of a glob: either a "*", or one character from a set.
+
+struct glob_token
+{
+	bool is_star;
+	std::bitset<256> chars;	// for a step that is not a "*"
+};
+
+typedef std::vector<glob_token> VEC_GLOB_TOKEN;
+
+
+
+// glob_set
+//
+// A set of globs for names, compiled into a single automaton that is
+// run bit-parallel: there is one bit of state for each step of each
+// glob, and one byte of a name moves all of them at once with a few
+// word operations.  Match() returns the highest rule number of the
+// globs that match a name, or -1 if none do.
+
+class glob_set
+{
+	private:
+		std::vector<VEC_GLOB_TOKEN> globs;	// until Build()
+		std::vector<int> rules;
+
+		size_t words;	// 64-bit words of state
+		std::vector<uint64_t> consume;	// [byte][word]: a step takes byte
+		std::vector<uint64_t> loop;	// [byte][word]: a "*" takes byte
+		std::vector<uint64_t> star;	// the steps that are a "*"
+		std::vector<uint64_t> start;	// the state before any byte
+		std::vector<uint64_t> accept;	// the state at the end of a glob
+		std::vector<int> accept_rule;	// rule, for each accept bit
+
+	public:
+		glob_set() { words = 0; }
+
+		// Add() globs in order of rule number, then Build() once
+		void Add(const VEC_GLOB_TOKEN& tokens, int rule);
+		void Build();
+
+		int Match(CSZ name, size_t len) const;
+
+		bool empty() const { return words == 0; }
+};
+
+
+
+// name_rules
+//
+// Patterns for names, sorted by kind into the tables described above.
+// Match() returns the highest rule number of the patterns that match a
+// name, or -1 if none do.
+
+class name_rules
+{
+	private:
+		std::vector<std::pair<std::string, int> > pending_names;
+		std::vector<std::pair<std::string, int> > pending_suffixes;
+
+		perfect_hash names;	// exact names
+		perfect_hash suffixes;	// "*suffix" patterns, by suffix
+		std::vector<size_t> suffix_lengths;
+		glob_set globs;	// all the rest
+
+		void BuildTable(std::vector<std::pair<std::string, int> >& v,
+				perfect_hash& ph);
+
+	public:
+		// Add() patterns in order of rule number, then Build() once
+		void Add(CSREF pattern, int rule);
+		void Build();
+
+		int Match(CSZ name, size_t len) const;
+
+		bool empty() const;
+};
+
+
+
+// ignore_file
+//
+// The lines of one ignore file, and where its directory ends in the
+// full path name of the directory being listed.
+
+struct ignore_file
+{
+	size_t dir_end;
+	std::vector<std::string> lines;
+};
+
+
+
+// ignore_rules
+//
+// All the rules for one directory.
+
+class ignore_rules
+{
+	private:
+		name_rules any_type;	// rules for names of any type
+		name_rules dirs_only;	// rules ending in "/"
+		std::vector<bool> negated;	// for each rule, true for "!"
+		bool all_ignored;	// the directory itself is ignored
+
+		void AddPattern(std::string line, CSREF rel);
+		void Compile(const std::vector<ignore_file>& files, CSREF abs,
+				size_t dir_end);
+
+	public:
+		ignore_rules() { all_ignored = false; }
+
+		// reads and compiles the rules for the names in directory dir
+		void Load(CSREF dir);
+
+		// whether a name in the directory is ignored: if_file if it
+		// is not a directory, and if_dir if it is
+		void Match(CSZ name, size_t len, bool& if_file, bool& if_dir) const;
+};
+
+
+
+#endif // GITIGNORE_HPP
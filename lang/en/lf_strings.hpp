@@ -32,6 +32,32 @@ CSZ const usage[] =
 	"-w n, --line-width=n\tformat lines to be no longer than n characters.",
 	"-M n, --margin=n\tleave blank n spaces at right of line.",
 	"-v n, --verbose=n\tset verbosity level; 0 is least verbose.",
+	"--format=f\t\tprint records: f is text, null, jsonl or bin.",
+	"--per-ext=n\t\tshow at most n names for each extension.",
+	"--head=n\t\tshow at most n extension lines.",
+	"--\t\t\tend of options; treat any later arguments as names.",
+	"--timing\t\treport how long each phase of startup took.",
+	"--stats[=json]\t\treport times and counters on standard error.",
+	"--trace=file\t\twrite a Chrome trace-event timeline to file.",
+	"--count[=json]\t\tonly count the names with each extension.",
+	"--sizes[=json]\t\tcount the names and bytes with each extension.",
+	"--sort=k\t\tsort names by k: name, size or mtime.",
+	"-r, --reverse\t\tsort names in reverse order.",
+	"--mem-limit=n\t\thold about n bytes of names (or nK, nM, nG).",
+	"--save-snapshot=file\tsave the listing to file, for --diff.",
+	"--diff=file\t\tshow names added and removed since a snapshot.",
+	"--gitignore\t\tleave out names ignored by .gitignore and .ignore.",
+	"--natural\t\tsort numbers in names by value: img2 before img10.",
+	"--compound[=file]\tlook for tar.gz and other compound extensions.",
+	"--no-compound\t\tonly the part after the last dot is an extension.",
+	"--files-from=file\tlist the names in file, one per line (- for stdin).",
+	"-0, --null\t\twith --files-from, names are separated by NUL bytes.",
+	"--no-stat\t\twith --files-from, take every name to be a file.",
+	"--archives\t\tlist the members of tar and zip files given as arguments.",
+	"--build-index=db\twrite a tree index of the directory argument to db.",
+	"--index=db\t\tlist directories from the tree index in db.",
+	"--index-check\t\twith --index, read a directory changed since indexing.",
+	"--color[=when]\t\tcolor names as ls does: always, auto or never.",
 	"",
 	"Report bugs to: " LF_EMAIL,
 	"lf version " LF_VERSION_STR,
@@ -133,6 +159,56 @@ SetStrings()
 	arg_str[repl_spaces_l] = "--replace-spaces";
 	arg_str[verbose_s] = "-v";
 	arg_str[verbose_l] = "--verbose";
+	arg_str[format_s] = NULL;
+	arg_str[format_l] = "--format";
+	arg_str[per_ext_s] = NULL;
+	arg_str[per_ext_l] = "--per-ext";
+	arg_str[head_s] = NULL;
+	arg_str[head_l] = "--head";
+	arg_str[timing_s] = NULL;
+	arg_str[timing_l] = "--timing";
+	arg_str[stats_s] = NULL;
+	arg_str[stats_l] = "--stats";
+	arg_str[trace_s] = NULL;
+	arg_str[trace_l] = "--trace";
+	arg_str[count_s] = NULL;
+	arg_str[count_l] = "--count";
+	arg_str[sizes_s] = NULL;
+	arg_str[sizes_l] = "--sizes";
+	arg_str[sort_by_s] = NULL;
+	arg_str[sort_by_l] = "--sort";
+	arg_str[reverse_s] = "-r";
+	arg_str[reverse_l] = "--reverse";
+	arg_str[mem_limit_s] = NULL;
+	arg_str[mem_limit_l] = "--mem-limit";
+	arg_str[save_snapshot_s] = NULL;
+	arg_str[save_snapshot_l] = "--save-snapshot";
+	arg_str[diff_s] = NULL;
+	arg_str[diff_l] = "--diff";
+	arg_str[gitignore_s] = NULL;
+	arg_str[gitignore_l] = "--gitignore";
+	arg_str[natural_s] = NULL;
+	arg_str[natural_l] = "--natural";
+	arg_str[compound_s] = NULL;
+	arg_str[compound_l] = "--compound";
+	arg_str[no_compound_s] = NULL;
+	arg_str[no_compound_l] = "--no-compound";
+	arg_str[files_from_s] = NULL;
+	arg_str[files_from_l] = "--files-from";
+	arg_str[null_names_s] = "-0";
+	arg_str[null_names_l] = "--null";
+	arg_str[no_stat_s] = NULL;
+	arg_str[no_stat_l] = "--no-stat";
+	arg_str[archives_s] = NULL;
+	arg_str[archives_l] = "--archives";
+	arg_str[build_index_s] = NULL;
+	arg_str[build_index_l] = "--build-index";
+	arg_str[index_s] = NULL;
+	arg_str[index_l] = "--index";
+	arg_str[index_check_s] = NULL;
+	arg_str[index_check_l] = "--index-check";
+	arg_str[color_s] = NULL;
+	arg_str[color_l] = "--color";
 
 	verbose_str[v_list_in_dir] =
 		"Listing files in: ";
@@ -162,6 +238,34 @@ SetStrings()
 		"Ignoring extensions longer than: ";
 	verbose_str[v_ext_width] =
 		"Formatting extension display width of: ";
+	verbose_str[v_per_ext] =
+		"Showing at most this many names per extension: ";
+	verbose_str[v_head] =
+		"Showing at most this many extension lines: ";
+	verbose_str[v_sort_by] =
+		"Sorting the names with each extension by: ";
+	verbose_str[v_reverse] =
+		"Sorting the names in reverse order.";
+	verbose_str[v_mem_limit] =
+		"Holding at most about this many bytes of names in memory: ";
+	verbose_str[v_gitignore] =
+		"Leaving out names matched by .gitignore and .ignore files.";
+	verbose_str[v_natural] =
+		"Sorting runs of digits in names by their value.";
+	verbose_str[v_compound] =
+		"Compound extension rules: ";
+	verbose_str[v_files_from] =
+		"Listing the names read from: ";
+	verbose_str[v_archives] =
+		"Listing the members of archives given as arguments.";
+	verbose_str[v_index] =
+		"Listing from the tree index: ";
+	verbose_str[v_index_dirs] =
+		"Directories in the tree index: ";
+	verbose_str[v_index_names] =
+		"Names in the tree index: ";
+	verbose_str[v_color] =
+		"Coloring names as LS_COLORS says.";
 
 	err_str[bad_dir] =
 		"could not open directory";
@@ -179,8 +283,56 @@ SetStrings()
 		"unable to detect locale; defaulting to ASCII sort.";
 	err_str[bad_lfopts] =
 		"unable to parse the LFOPTS environment variable.";
+	err_str[bad_format] =
+		"unknown output format; use text, null, jsonl or bin.";
+	err_str[bad_stats] =
+		"unknown stats format; use text or json.";
+	err_str[bad_trace] =
+		"cannot write trace file.";
+	err_str[bad_count] =
+		"unknown count format; use text or json.";
+	err_str[bad_sizes] =
+		"unknown sizes format; use text or json.";
+	err_str[bad_sort_key] =
+		"unknown sort key; use name, size or mtime.";
+	err_str[bad_mem_limit] =
+		"need a size, such as 500M or 2G.";
+	err_str[need_sort_name] =
+		"only works with --sort=name.";
+	err_str[bad_run_file] =
+		"could not write a temporary file; try setting TMPDIR.";
+	err_str[bad_save] =
+		"could not write the snapshot file.";
+	err_str[bad_snapshot] =
+		"not a snapshot saved by lf, or cut short.";
+	err_str[bad_snapshot_order] =
+		"snapshot was saved with other sort options; use the same ones.";
+	err_str[bad_snapshot_with] =
+		"can't be used with --count, --mem-limit or --per-ext.";
+	err_str[bad_diff_format] =
+		"can't show a diff as bin; use text, null or jsonl.";
+	err_str[bad_compound_file] =
+		"cannot read compound extension rules.";
+	err_str[bad_compound_rule] =
+		"not a compound extension rule, such as tar.gz or so.N.";
+	err_str[bad_files_from] =
+		"cannot read names from this file.";
+	err_str[bad_archive] =
+		"cannot read this archive.";
+	err_str[bad_index] =
+		"cannot read this tree index.";
+	err_str[bad_build_index] =
+		"cannot write the tree index.";
+	err_str[bad_index_root] =
+		"needs one directory to index.";
+	err_str[bad_color] =
+		"unknown color mode; use always, auto or never.";
+	err_str[bad_ls_colors] =
+		"cannot parse this; not coloring names.";
 
 	dirs_str = "DIRS";
+	more_str = "more";
+	bytes_str = "bytes";
 
 	usage_strings = usage;
 	usage_strings_max = usage_max;
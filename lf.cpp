@@ -27,23 +27,52 @@
 
 // C includes
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 
 // C++ includes
-#include <iostream>
+#include <algorithm>
+#include <condition_variable>
 #include <list>
 #include <locale>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
+#include "archive.hpp"
 #include "filetest.hpp"
 using namespace filetest;
 
+#include "gitignore.hpp"
+#include "lscolors.hpp"
+#include "phash.hpp"
+#include "runfile.hpp"
+#include "shellword.hpp"
+#include "stats.hpp"
+#include "suffixtrie.hpp"
+#include "trace.hpp"
+#include "treeindex.hpp"
 #include "wordexp.hpp"
 
+#include "outbuf.hpp"
+#include "lfbin.hpp"
+#include "lfbinmap.hpp"
+#include "namereader.hpp"
+
 #include "lf.hpp"
 
 
@@ -60,12 +89,26 @@ const char ch_space = ' ';
 
 
 
+// NonEmptySz()
+
+inline bool
+NonEmptySz(CSZ csz)
+{
+	// returns true if csz is a non-NULL pointer to a non-empty string
+	return csz && csz[0] != ch_nul;
+}
+
+
+
 // lf_options -- bundle of options to control the way lf works
 //
 // Tidier than a handful of globals.
 
 namespace {
 	enum sort_method { sort_locale, sort_ascii, sort_ascii_ic };
+	enum sort_key { key_name, key_size, key_mtime };
+	enum out_format { fmt_text, fmt_null, fmt_jsonl, fmt_bin };
+	enum color_when { color_never, color_always, color_auto };
 };
 
 class lf_options
@@ -80,6 +123,14 @@ class lf_options
 		// sort filenames using locale collate order, ASCII order, or
 		// case-insensitive ASCII order
 		sort_method sort;
+		// if true, runs of digits in names sort by their value
+		bool natural;
+
+		// sort the names with each extension by name (in the order
+		// above), by size (largest first), or by modification time
+		// (newest first); if reverse is true, the other way round
+		sort_key sort_by;
+		bool reverse;
 
 		// if true, filenames will be forced to lower-case
 		bool force_lower;
@@ -87,8 +138,29 @@ class lf_options
 		// if true, hidden filenames will be shown
 		bool show_all;
 
+		// if true, leave out names matched by .gitignore files
+		bool gitignore;
+
 		// if false, only print a directory argument; if true, slurp it
 		bool slurp_dir_arg;
+		// if true, list the members of an archive argument, the way a
+		// directory argument is slurped
+		bool archives;
+
+		// if not empty, also list the names read from this file ("-"
+		// for standard input), separated by NUL bytes if null_names,
+		// else by newlines; with no_stat, take them all to be files
+		string files_from;
+		bool null_names;
+		bool no_stat;
+
+		// if not empty, write a tree index of the directory argument to
+		// this file, instead of listing anything
+		string build_index;
+		// if not empty, list directories from the tree index in this
+		// file; with index_check, not one changed since it was built
+		string index_path;
+		bool index_check;
 
 		// how much additional verbosity should be shown?
 		int verbose_level;
@@ -102,8 +174,14 @@ class lf_options
 
 		// use this width for displaying extensions
 		int ext_width;
+		bool ext_width_set;	// given with --ext-width
 		// longest accepted extension; longer extensions will be ignored
 		int ext_limit;
+		// if true, recognize compound extensions such as "tar.gz": the
+		// built-in ones, and the ones in compound_path (if it's empty,
+		// in ~/.lfexts)
+		bool compound;
+		string compound_path;
 
 		// string to separate filenames in listing
 		string name_separator;
@@ -114,6 +192,43 @@ class lf_options
 		bool replace_spaces;
 		string s_replace_space;
 
+		// print the terse text listing, or records in a machine-readable
+		// format?
+		out_format format;
+		// color the text listing as LS_COLORS says?  color_auto is
+		// settled, one way or the other, once the options are read
+		color_when color;
+
+		// if not zero, show at most this many names per extension
+		int per_ext_limit;
+		// if not zero, show at most this many extension lines
+		int head_limit;
+
+		// if true, report how long each phase of startup took
+		bool timing;
+		// if true, report times and counters; as JSON if stats_json
+		bool stats;
+		bool stats_json;
+
+		// if not empty, write a trace of the run to this file
+		string trace_path;
+
+		// if not zero, hold about this many bytes of names in memory,
+		// and spill sorted runs of them to temporary files beyond that
+		long mem_limit;
+
+		// if not empty, save the listing to this file as a snapshot,
+		// or print what changed since the snapshot in this file
+		string snapshot_path;
+		string diff_path;
+
+		// if true, only count the names for each extension, and print
+		// the counts; as JSON if count_json
+		bool count_only;
+		bool count_json;
+		// with count_only, also total the sizes of the files
+		bool sizes;
+
 		lf_options();
 };
 
@@ -125,35 +240,73 @@ lf_options::lf_options()
 	progname = LF_CANONICAL_NAME;
 
 	sort = sort_locale;
+	natural = false;
+	sort_by = key_name;
+	reverse = false;
 	force_lower = false;
 	show_all = false;
+	gitignore = false;
 	slurp_dir_arg = true;
+	archives = false;
+	null_names = false;
+	no_stat = false;
+	index_check = false;
 	verbose_level = 1;
 	line_width = 80;
 	line_margin = 0;
 	ext_width = 4;
+	ext_width_set = false;
 	ext_limit = 4;
+	compound = false;
 	name_separator = s_space;
 	ext_separator = ": ";
 
 	replace_spaces = false;
 	s_replace_space = s_space;
+
+	format = fmt_text;
+	color = color_never;
+
+	per_ext_limit = 0;
+	head_limit = 0;
+
+	timing = false;
+	stats = false;
+	stats_json = false;
+
+	mem_limit = 0;
+
+	count_only = false;
+	count_json = false;
+	sizes = false;
 }
 
 lf_options options;
 
 
 
+// out and errout
+//
+// Buffered standard output and standard error.  lf does not use
+// iostreams at all, so it doesn't pay for setting them up at startup.
+// errout is flushed after every message.
+
+outbuf out(1);
+outbuf errout(2, 4096);
+
+
+
 // PrintStrings()
 //
 // Prints multi-string messages.
 
 void
-PrintStrings(ostream& o, CSZ const strings[], int strings_max, int exit_status)
+PrintStrings(outbuf& o, CSZ const strings[], int strings_max, int exit_status)
 {
 	for (int i = 0; i < strings_max; ++i)
-		o << strings[i] << endl;
+		o << strings[i] << '\n';
 
+	o.flush();
 	exit(exit_status);
 }
 
@@ -180,7 +333,12 @@ Err(CSREF s0, CSREF s1 = "")
 		s.append(s1);
 	}
 
-	cerr << s << endl;
+	// with --count, several directories are read at once
+	static mutex err_mutex;
+	lock_guard<mutex> lock(err_mutex);
+
+	errout << s << '\n';
+	errout.flush();
 }
 
 
@@ -208,16 +366,74 @@ const collate<char> *pdef_collate;
 
 
 
+// UseClassicLocale()
+//
+// Sets up the global locale variables for the "C" locale.  The classic
+// locale is built into the C++ library, so this costs next to nothing.
+
+void
+UseClassicLocale()
+{
+	def_locale = locale::classic();
+	pdef_ctype = &use_facet<ctype<char> >(def_locale);
+	pdef_collate = &use_facet<collate<char> >(def_locale);
+}
+
+
+
+// LocaleEnvIsC()
+//
+// Returns true if the environment selects the "C" locale for a
+// category: the first one set of LC_ALL, the category's own variable,
+// and LANG is "C" or "POSIX", or none of them is set.  "C.UTF-8" counts
+// too: it collates in byte order and lower-cases only ASCII letters,
+// the same as "C" does for the single bytes lf works with.
+
+bool
+LocaleEnvIsC(CSZ category)
+{
+	CSZ vars[] = { "LC_ALL", category, "LANG" };
+
+	for (int i = 0; i < 3; ++i)
+	{
+		CSZ value = getenv(vars[i]);
+		if (NonEmptySz(value))
+			return strcmp(value, "C") == 0 || strcmp(value, "POSIX") == 0
+					|| strcasecmp(value, "C.UTF-8") == 0
+					|| strcasecmp(value, "C.utf8") == 0;
+	}
+
+	return true;
+}
+
+
+
 // InitLocale()
 //
 // This should be called after argument processing.  If there is
 // something wrong with the user's setup and the locale initialization
 // fails, lf prints a warning message; but the user can specify the
 // --ascii or --ascii-ic options explicitly to shut up the message.
+//
+// Loading the user's locale is one of the biggest fixed costs of
+// running lf, so it is only done if the locale will actually be used:
+// for collation in locale sort order, or for --force-lower-case.  If
+// the environment selects the "C" locale anyway, the built-in classic
+// locale does the same job for free.
 
 void
 InitLocale()
 {
+	bool need_collate = (options.sort == sort_locale);
+	bool need_ctype = options.force_lower;
+
+	if ((!need_collate || LocaleEnvIsC("LC_COLLATE"))
+			&& (!need_ctype || LocaleEnvIsC("LC_CTYPE")))
+	{
+		UseClassicLocale();
+		return;
+	}
+
 	try
 	{
 		// empty string means: get user's preferred locale
@@ -236,23 +452,460 @@ InitLocale()
 		if (options.sort == sort_locale)	// User wants locale...
 			Err(err_str[bad_locale]);	// ...but we can't do it; so warn.
 
-		def_locale = locale("C");	// should never fail
-		const ctype<char>& ctype_ref =
-				use_facet<ctype<char> >(def_locale);
-		const collate<char>& collate_ref =
-				use_facet<collate<char> >(def_locale);
+		UseClassicLocale();	// should never fail
+	}
+}
 
-		pdef_ctype = &ctype_ref;
-		pdef_collate = &collate_ref;
+
+
+// CompareCollate()
+//
+// Compares two names in ASCII, ASCII case-insensitive, or user's locale
+// order, and returns less than, equal to, or greater than zero.
+
+inline int
+CompareCollate(CSZ s0, size_t len0, CSZ s1, size_t len1)
+{
+	if (options.sort == sort_ascii)
+		return strcmp(s0, s1);
+	else if (options.sort == sort_ascii_ic)
+		return strcasecmp(s0, s1);
+
+	Assert(options.sort == sort_locale);
+	return (*pdef_collate).compare(s0, s0 + len0, s1, s1 + len1);
+}
+
+
+
+// path names
+//
+// With keep_path, every name read from a directory would be stored with
+// the whole directory path in front of it; for "lf /long/path/dir*" most
+// of every name would be the same few prefixes, over and over, and every
+// comparison would have to get past them.  Instead, each directory that
+// is read gets an entry in path_table, and a name is stored as a "path
+// name": a mark byte that no real name can contain, the index of its
+// directory in two bytes, then the basename.  The full name is only put
+// together when it is printed, by FullName().
+//
+// When names collate byte by byte (ASCII order, or the "C" locale), two
+// path names can often be compared without looking at the prefixes: in
+// the same directory, only the basenames matter; and in two directories
+// where neither path is the start of the other, only the order of the
+// directories matters, which RankPaths() works out once.  Otherwise,
+// the full names are compared a piece at a time (directory, "/" and
+// basename) without putting them together, by ComparePieces(); or, in
+// the order of a locale, put together and compared.
+
+const char ch_path_mark = '\0';	// never in a real name
+const size_t path_mark_len = 3;	// the mark, then the index
+const size_t path_table_max = 0x10000;	// more: store full names
+
+vector<string> path_table;
+
+vector<unsigned> path_rank;	// order of the directories, once ranked
+vector<bool> path_alone;	// no other path starts with this one
+bool path_bytewise;	// names collate byte by byte
+
+
+
+// AddPath()
+//
+// Puts a directory in path_table, and returns its index; or -1 if the
+// table is full.
+
+int
+AddPath(CSREF path)
+{
+	if (path_table.size() == path_table_max)
+		return -1;
+
+	path_table.push_back(path);
+	return path_table.size() - 1;
+}
+
+
+
+inline bool
+IsPathName(CSREF name)
+{
+	return name.length() >= path_mark_len && name[0] == ch_path_mark;
+}
+
+
+
+inline unsigned
+PathIndex(CSREF name)
+{
+	return (unsigned char)name[1] << 8 | (unsigned char)name[2];
+}
+
+
+
+// MakePathName()
+//
+// Turns a basename into a path name, for the directory at path_index.
+
+void
+MakePathName(string& name, int path_index)
+{
+	char mark[path_mark_len] =
+			{ ch_path_mark, char(path_index >> 8), char(path_index) };
+
+	name.insert(0, mark, path_mark_len);
+}
+
+
+
+// FullName()
+//
+// The name as it is printed.  For a path name, this is the full path
+// name, put together in full; any other name is returned as it is.
+
+CSREF
+FullName(CSREF name, string& full)
+{
+	if (!IsPathName(name))
+		return name;
+
+	full = path_table[PathIndex(name)];
+	if (!full.empty() && full[full.length() - 1] != dir_sep_char)
+		full += dir_sep_char;
+	full.append(name, path_mark_len, string::npos);
+
+	return full;
+}
+
+
+
+// PathPrefixOf()
+//
+// True if directory path p0 is the start of p1, so that a name in p0
+// can sort either side of a name in p1.
+
+bool
+PathPrefixOf(CSREF p0, CSREF p1)
+{
+	if (p0.length() > p1.length())
+		return false;
+
+	if (options.sort == sort_ascii_ic)
+		return strncasecmp(p0.c_str(), p1.c_str(), p0.length()) == 0;
+	return p1.compare(0, p0.length(), p0) == 0;
+}
+
+
+
+// by_path
+//
+// Compares two directories by their index in a table of them.
+
+struct by_path
+{
+	const vector<string>& dirs;
+
+	by_path(const vector<string>& v) : dirs(v) {}
+
+	bool
+	operator()(unsigned i0, unsigned i1) const
+	{
+		return CompareCollate(dirs[i0].c_str(), dirs[i0].length(),
+				dirs[i1].c_str(), dirs[i1].length()) < 0;
+	}
+};
+
+
+
+// RankPaths()
+//
+// Works out the order of the directories in path_table, for comparing
+// path names.  Must be called after the names are read and before they
+// are sorted; until then, path names are compared in full.  Directories
+// are compared with a "/" on the end, the way they are in a full name.
+
+void
+RankPaths()
+{
+	const size_t n = path_table.size();
+
+	path_bytewise = (options.sort != sort_locale
+			|| def_locale == locale::classic());
+	if (!path_bytewise || n == path_rank.size())
+		return;
+
+	vector<string> dirs(n);
+	vector<unsigned> order(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		dirs[i] = MakeFullPathName(s_empty, path_table[i]);
+		order[i] = i;
+	}
+
+	sort(order.begin(), order.end(), by_path(dirs));
+
+	path_rank.assign(n, 0);
+	path_alone.assign(n, true);
+	for (size_t r = 0; r < n; ++r)
+	{
+		path_rank[order[r]] = r;
+
+		// any path that starts with another sorts right after it
+		if (r > 0 && PathPrefixOf(dirs[order[r - 1]], dirs[order[r]]))
+		{
+			path_alone[order[r - 1]] = false;
+			path_alone[order[r]] = false;
+		}
+	}
+}
+
+
+
+// NamePieces()
+//
+// Splits the full name of a stored name into the pieces it is put
+// together from, and returns how many there are.
+
+inline int
+NamePieces(CSREF name, CSZ piece[3], size_t len[3])
+{
+	if (!IsPathName(name))
+	{
+		piece[0] = name.data();
+		len[0] = name.length();
+		return 1;
+	}
+
+	CSREF dir = path_table[PathIndex(name)];
+	int n = 0;
+
+	piece[n] = dir.data();
+	len[n++] = dir.length();
+	if (!dir.empty() && dir[dir.length() - 1] != dir_sep_char)
+	{
+		piece[n] = &dir_sep_char;
+		len[n++] = 1;
+	}
+	piece[n] = name.data() + path_mark_len;
+	len[n++] = name.length() - path_mark_len;
+
+	return n;
+}
+
+
+
+// ComparePieces()
+//
+// CompareCollate() for the full names of two stored names, when names
+// collate byte by byte, without putting the full names together: the
+// pieces are compared a run at a time, as far as both have bytes left.
+
+int
+ComparePieces(CSREF s0, CSREF s1)
+{
+	CSZ p0[3], p1[3];
+	size_t n0[3], n1[3];
+	const int k0 = NamePieces(s0, p0, n0);
+	const int k1 = NamePieces(s1, p1, n1);
+
+	int i0 = 0, i1 = 0;	// the piece of each name
+	size_t o0 = 0, o1 = 0;	// how far into that piece
+	for (;;)
+	{
+		while (i0 < k0 && o0 == n0[i0])
+		{
+			++i0;
+			o0 = 0;
+		}
+		while (i1 < k1 && o1 == n1[i1])
+		{
+			++i1;
+			o1 = 0;
+		}
+		if (i0 == k0 || i1 == k1)
+			return (i0 == k0 ? 0 : 1) - (i1 == k1 ? 0 : 1);
+
+		size_t n = min(n0[i0] - o0, n1[i1] - o1);
+		int r = (options.sort == sort_ascii_ic)
+				? strncasecmp(p0[i0] + o0, p1[i1] + o1, n)
+				: memcmp(p0[i0] + o0, p1[i1] + o1, n);
+		if (r != 0)
+			return r;
+
+		o0 += n;
+		o1 += n;
+	}
+}
+
+
+
+// ComparePathNames()
+//
+// CompareCollate() for two names, one or both of them path names.
+
+int
+ComparePathNames(CSREF s0, CSREF s1)
+{
+	if (path_bytewise && IsPathName(s0) && IsPathName(s1))
+	{
+		unsigned i0 = PathIndex(s0);
+		unsigned i1 = PathIndex(s1);
+
+		if (i0 == i1)
+			return CompareCollate(s0.c_str() + path_mark_len,
+					s0.length() - path_mark_len,
+					s1.c_str() + path_mark_len,
+					s1.length() - path_mark_len);
+
+		if (i0 < path_rank.size() && i1 < path_rank.size()
+				&& path_alone[i0] && path_alone[i1])
+			return path_rank[i0] < path_rank[i1] ? -1 : 1;
+	}
+
+	if (path_bytewise)
+		return ComparePieces(s0, s1);
+
+	// buckets are sorted on several threads at once
+	thread_local string full0, full1;
+	CSREF f0 = FullName(s0, full0);
+	CSREF f1 = FullName(s1, full1);
+
+	return CompareCollate(f0.c_str(), f0.length(), f1.c_str(), f1.length());
+}
+
+
+
+// CompareStored()
+//
+// CompareCollate() for two names as they are stored, path names or not.
+
+inline int
+CompareStored(CSREF s0, CSREF s1)
+{
+	if (IsPathName(s0) || IsPathName(s1))
+		return ComparePathNames(s0, s1);
+
+	return CompareCollate(s0.c_str(), s0.length(), s1.c_str(), s1.length());
+}
+
+
+
+// natural order
+//
+// With --natural, a run of digits in a name sorts by its value, so that
+// img2 comes before img10.  Rather than parse the digits over again in
+// every comparison, a name is turned into a key once, and the keys are
+// compared with memcmp().  A key is the runs of text and the runs of
+// digits, in turn, always starting with a (maybe empty) run of text:
+//
+//	text	the run, as it collates: as it is for --ascii, in lower
+//		case for --ascii-ic, and through collate::transform() for
+//		the locale; then a NUL to end it, so a shorter run sorts
+//		first, and a name that goes on sorts after one that stops
+//	digits	how many digits there are, leaving out leading zeros
+//		(plus one, so it is never NUL), then the digits
+//
+// Names with the same key, such as img2 and img02, are put in order by
+// CompareStored().
+
+const char ch_digit_0 = '0';
+const char ch_digit_9 = '9';
+const size_t natural_len_max = 255;	// longer runs of digits share it
+
+inline bool
+IsDigit(char ch)
+{
+	return ch >= ch_digit_0 && ch <= ch_digit_9;
+}
+
+
+
+// NaturalKey()
+//
+// Makes the key for a name, as described above.
+
+void
+NaturalKey(CSREF name, string& key)
+{
+	CSZ const s = name.data();
+	const size_t len = name.length();
+
+	key.clear();
+	for (size_t i = 0; ; )
+	{
+		size_t j = i;
+		while (j < len && !IsDigit(s[j]))
+			++j;
+
+		if (options.sort == sort_ascii)
+			key.append(s + i, j - i);
+		else if (options.sort == sort_ascii_ic)
+		{
+			for (size_t k = i; k < j; ++k)
+				key += tolower((unsigned char)s[k]);
+		}
+		else if (j > i)
+			key += (*pdef_collate).transform(s + i, s + j);
+		key += ch_nul;
+
+		if (j == len)
+			break;
+
+		size_t k = j;
+		while (k < len && IsDigit(s[k]))
+			++k;
+		while (j < k && s[j] == ch_digit_0)
+			++j;
+
+		key += char(min(k - j + 1, natural_len_max));
+		key.append(s + j, k - j);
+		i = k;
 	}
 }
 
 
 
+inline int
+CompareKeys(CSREF key0, CSREF key1)
+{
+	const size_t len = min(key0.length(), key1.length());
+	int rc = memcmp(key0.data(), key1.data(), len);
+
+	if (rc != 0)
+		return rc;
+	if (key0.length() != key1.length())
+		return key0.length() < key1.length() ? -1 : 1;
+	return 0;
+}
+
+
+
+// CompareNatural()
+//
+// Natural order for two names, making their keys on the spot.  Sorting
+// a whole bucket makes each key just once; see SortNameIndexes().
+
+int
+CompareNatural(CSREF s0, CSREF s1)
+{
+	// buckets are sorted on several threads at once
+	thread_local string full0, full1, key0, key1;
+
+	NaturalKey(FullName(s0, full0), key0);
+	NaturalKey(FullName(s1, full1), key1);
+
+	int rc = CompareKeys(key0, key1);
+	if (rc != 0)
+		return rc;
+	return CompareStored(s0, s1);
+}
+
+
+
 // mycompare
 //
 // Custom comparison function that can be used to collate files in
-// ASCII, ASCII case-insensitive, or user's locale order.
+// ASCII, ASCII case-insensitive, or user's locale order, and with
+// --natural, in natural order.
 //
 // Used in the specification of the sorted data structures (see below).
 
@@ -263,16 +916,12 @@ struct mycompare
 	{
 		int rc;
 
-		if (options.sort == sort_ascii)
-			rc = strcmp(s0.c_str(), s1.c_str());
-		else if (options.sort == sort_ascii_ic)
-			rc = strcasecmp(s0.c_str(), s1.c_str());
+		if (options.natural)
+			rc = CompareNatural(s0, s1);
 		else
-		{
-			Assert(options.sort == sort_locale);
-			rc = (*pdef_collate).compare(begin(s0), end(s0),
-					begin(s1), end(s1));
-		}
+			rc = CompareStored(s0, s1);
+
+		StatsInc(sc_compares);
 
 		return rc < 0;
 	}
@@ -337,6 +986,8 @@ CheckStrings()
 	license_strings_max = 0;
 
 	dirs_str = bad;
+	more_str = bad;
+	bytes_str = bad;
 	SetStrings();
 
 	for (int i = 0; i < ARG_STRINGS_MAX; ++i)
@@ -364,6 +1015,10 @@ CheckStrings()
 
 	if (dirs_str == bad)
 			Assert(false);
+	if (more_str == bad)
+			Assert(false);
+	if (bytes_str == bad)
+			Assert(false);
 }
 #endif
 
@@ -388,14 +1043,21 @@ CheckStrings()
 //		ext_map data structure does not keep the extensions in any kind
 //		of sorted order.  This does, so it's convenient to have it.)
 //
-// dirs_set
+// dirs_bucket
 // 		This is where we keep track of directories seen.  When printing
 // 		the file listing, we iterate through this to print the "DIRS:"
 // 		line.
 //
 // ext_map
 //		A mapping from extensions onto basenames.  For each extension
-//		there is a set of basenames.
+//		there is a bucket of basenames.
+//
+// counts
+//		With --count, no names are kept at all: just how many files
+//		have each extension, and how many directories there are, and
+//		with --sizes how many bytes they hold.  A hash table is cheaper
+//		than a set here, since it's updated once per name and only
+//		sorted once, by PrintCounts().
 
 typedef list<string> LIST_STRING;
 typedef LIST_STRING *PLIST_STRING;
@@ -404,761 +1066,4130 @@ LIST_STRING args_try_list;
 typedef set<string, mycompare> SET_STRING;
 typedef SET_STRING *PSET_STRING;
 SET_STRING ext_set;
-SET_STRING dirs_set;
-
-typedef map<string, PSET_STRING> MAP_STRING_SET_STRING;
 
-MAP_STRING_SET_STRING ext_map;
+typedef vector<string> VEC_STRING;
 
+struct count_total
+{
+	long names;
+	long bytes;
 
+	count_total() : names(0), bytes(0) {}
+};
 
-// AddStringToSet()
-//
-// Looks up a string in a set; if the string does not exist in the set
-// already, adds that string.  Returns true if string was added.
+typedef unordered_map<string, count_total> MAP_EXT_TOTAL;
 
-bool
-AddStringToSet(SET_STRING& set_string, CSREF s)
+struct count_table
 {
-	SET_STRING::const_iterator l;
-
-	l = set_string.find(s);
-	bool added = (l == set_string.end());
-	if (added)
-	{
-		// string not in set so insert it
-		pair<SET_STRING::const_iterator, bool> insert_result;
-		insert_result = set_string.insert(s);
-	}
+	count_total dirs;
+	MAP_EXT_TOTAL exts;
 
-	return added;
-}
+	void Merge(const count_table& t);
+};
 
+count_table counts;
 
 
-// UpdateMap()
-//
-// Given a file name and the file's extension, adds that file name to
-// ext_map.  Also makes sure the extension is in the ext_set.
 
 void
-UpdateMap(CSREF basename, CSREF ext)
+count_table::Merge(const count_table& t)
 {
-	SET_STRING::const_iterator l;
+	dirs.names += t.dirs.names;
+	dirs.bytes += t.dirs.bytes;
 
-	bool added = AddStringToSet(ext_set, ext);
-	if (added)
+	MAP_EXT_TOTAL::const_iterator p;
+	for (p = t.exts.begin(); p != t.exts.end(); ++p)
 	{
-		// extension never seen before, so make a new list of names
-		PSET_STRING p = new SET_STRING;
-		ext_map[ext] = p;
+		count_total& total = exts[p->first];
+		total.names += p->second.names;
+		total.bytes += p->second.bytes;
 	}
-
-	pair<SET_STRING::const_iterator, bool> insert_result;
-	insert_result = ext_map[ext]->insert(basename);
 }
 
 
 
-// ForceToLower()
+// bucket
 //
-// Forces a string to lower-case, using the user's locale tolower().
-
-void
-ForceToLower(string& s)
+// Holds the basenames for one extension, or the directory names.  Names
+// are collected unsorted, and Finish() sorts them once, just before they
+// are printed.  One sort of a vector is a lot cheaper than keeping a
+// balanced tree sorted through every insertion.
+//
+// If options.per_ext_limit is set, a bucket never holds more than that
+// many names.  While names are being added, the bucket is a max-heap of
+// the smallest names seen so far; a new name either replaces the
+// largest one kept, or is counted and thrown away.  That way memory is
+// O(k) per bucket and the sort cost is O(n log k) instead of O(n log n).
+//
+// With --sort=size or --sort=mtime, each name comes with a key, and
+// the bucket just collects the names and keys; Finish() does the rest,
+// including the per_ext_limit.
+//
+// seen counts every name added, kept or not, so the listing can say how
+// many names were left out.  The same name can be added twice (a file
+// given twice, or two names that only differ in case with --ascii-ic);
+// without a limit, Finish() drops the duplicates and takes them off
+// seen.  With a limit, when names_may_repeat says that can happen, a
+// name is checked against the ones in the heap before it goes in, so
+// the names kept are all different and a repeat of one isn't counted.
+// A thrown-away name is gone, though, so a repeat of one of those is
+// counted again: then "+N more" may count some names twice.
+
+class bucket
 {
-	int len = s.length();
-	char buf[len + 1];
+	public:
+		VEC_STRING names;
+		vector<long long> keys;	// with sort_by, one for each name
+		long seen;
+		bool finished;
+		bool in_order;	// names were added in name order, so no Sort()
+
+		bucket() { seen = 0; finished = false; in_order = false; }
+
+		void Add(CSREF name, long long key);
+		void Sort();
+		void Finish();
+		void FinishByKey();
+		bool InHeap(CSREF name) const;
+		long Dropped() const { return seen - names.size(); }
+};
 
-	s.copy(buf, len);
-	buf[len] = ch_nul;
+typedef bucket *PBUCKET;
 
-	(*pdef_ctype).tolower(buf, buf + len + 1);
+bucket dirs_bucket;
 
-	s = string(buf);
-}
+typedef map<string, PBUCKET> MAP_STRING_BUCKET;
 
+MAP_STRING_BUCKET ext_map;
 
 
-// ReplaceSpaces()
+
+// name_order
 //
-// Replaces any spaces in a string with options.s_replace_space.
+// The order of the names in a bucket: mycompare, or the reverse of it
+// with --reverse.
 
-void
-ReplaceSpaces(string& s)
+struct name_order
 {
-	const int space_len = 1;	// length of a space
-	const int rlen = options.s_replace_space.length();
+	bool
+	operator()(CSREF s0, CSREF s1) const
+	{
+		mycompare cmp;
 
-	int i = 0;
+		return options.reverse ? cmp(s1, s0) : cmp(s0, s1);
+	}
+};
 
-	for (;;)
+
+
+// names_may_repeat
+//
+// True if the same name, or two names that collate the same, may be
+// added to a bucket: the same directory or file given twice, names read
+// from a file, members of archives, or a sort order in which different
+// names can be equivalent.  Set once the arguments are known.
+
+bool names_may_repeat;
+
+
+
+// EquivalentNames
+//
+// Predicate for unique(): true if neither name sorts before the other.
+// A set treats such names as one name, so this does too.
+
+struct EquivalentNames
+{
+	bool
+	operator()(CSREF s0, CSREF s1) const
 	{
-		i = s.find(ch_space, i);
-		if (i < 0)
-			return;
-		s.replace(i, space_len, options.s_replace_space, 0, rlen);
-		i += rlen;
+		mycompare cmp;
+
+		return !cmp(s0, s1) && !cmp(s1, s0);
 	}
-}
+};
 
 
 
-// TransformName()
+// bucket::InHeap()
 //
-// Applies any transformations specified by user's options to a file name.
+// With a limit: true if a name equivalent to this one is already kept.
+// The heap holds at most per_ext_limit names, and a name is only looked
+// for when it would go in, so this is cheap next to reading the names.
 
-void
-TransformName(string& name)
+bool
+bucket::InHeap(CSREF name) const
 {
-	if (options.force_lower)
-		ForceToLower(name);
+	EquivalentNames same;
 
-	if (options.replace_spaces)
-		ReplaceSpaces(name);
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (same(names[i], name))
+			return true;
+	}
+	return false;
 }
 
 
 
-// AddDir()
+// bucket::Add()
 //
-// Adds a name to the dirs_set.
+// Adds a name to a bucket.  The key is only used with sort_by.
 
 void
-AddDir(CSREF dir_name)
+bucket::Add(CSREF name, long long key)
 {
-	string name = dir_name;
+	const size_t limit = options.per_ext_limit;
+	name_order cmp;
 
-	TransformName(name);
+	Assert(!finished);
+
+	if (options.sort_by != key_name)
+	{
+		++seen;
+		names.push_back(name);
+		keys.push_back(key);
+		return;
+	}
+
+	if (limit == 0)
+	{
+		++seen;
+		names.push_back(name);
+		return;
+	}
+
+	const bool full = names.size() == limit;
+	if (full && !cmp(name, names.front()))
+	{
+		// thrown away, unless it's the largest name kept over again
+		if (!names_may_repeat || cmp(names.front(), name))
+			++seen;
+		return;
+	}
 
-	pair<SET_STRING::const_iterator, bool> insert_result;
-	insert_result = dirs_set.insert(name);
+	if (names_may_repeat && InHeap(name))
+		return;	// already kept, and counted then
+	++seen;
+
+	if (!full)
+	{
+		names.push_back(name);
+		push_heap(names.begin(), names.end(), cmp);
+	}
+	else
+	{
+		// names.front() is the largest name kept; the new name sorts
+		// before it, so takes its place
+		pop_heap(names.begin(), names.end(), cmp);
+		names.back() = name;
+		push_heap(names.begin(), names.end(), cmp);
+	}
 }
 
 
 
-// ScanForExtension()
+// by_name_index
 //
-// Scans backwards through a file name, looking for an extension.
-// Applies several rules to decide whether to keep an extension it
-// finds.  If it doesn't find one, or if the extension it finds doesn't
-// qualify, returns -1; otherwise, returns the index into the string at
-// which the extension starts.
+// Compares two names in a bucket by their index in names[].
 
-int
-ScanForExtension(CSREF name)
+struct by_name_index
 {
-	int i_dot = name.rfind(ch_dot);	// index to the last dot in file name
-	int i_ext = i_dot + 1;	// one past the dot should be the extension
+	const VEC_STRING& names;
 
-	// i_dot will be < 0 if no dot was found; a no-ext file.
-	// i_dot will be == 0 if the first char of name is a dot.
-	// Initial dot is for a hidden file, not for a filename that is all
-	// extension; so if i_dot is 0, call that a no-ext file.
-	// Even under MS Windows where an initial dot isn't special, this is
-	// the right thing to do; a null filename would not make sense.
+	by_name_index(const VEC_STRING& v) : names(v) {}
 
-	if (i_dot <= 0)
-		return -1;
+	bool
+	operator()(unsigned i0, unsigned i1) const
+	{
+		return name_order()(names[i0], names[i1]);
+	}
+};
 
-	int ext_len = name.length() - i_ext;
-	if (ext_len > options.ext_limit)
-		return -1;	// extension is too long!
 
-	// *NIX has lots of files of the form "foo-2.18".  We want to treat
-	// this as a file with no extension, not as a ".18" file with a
-	// basename of "foo-2".  The following code detects this.
 
-	// is the extension numeric?
-	if (!IsNum(name.substr(i_ext)))
-		return i_ext;	// not numeric, so it's fine; return it
+// by_natural_key
+//
+// by_name_index for --natural, with the keys of the names made ahead of
+// time.
 
-	string temp = name.substr(0, i_dot);
-	int i = temp.rfind(ch_dash);
-	if (i < 0)
-		return i_ext;	// no '-' found, so extension is good!
+struct by_natural_key
+{
+	const VEC_STRING& names;
+	const VEC_STRING& keys;
 
-	++i; 	// advance past '-'
-	if (!IsNum(temp.substr(i)))
-		return i_ext;	// non-numeric found after '-' so it's good
+	by_natural_key(const VEC_STRING& v, const VEC_STRING& k)
+			: names(v), keys(k) {}
 
-	return -1;	// looks like "-2.18" so call it no ext
-}
+	bool
+	operator()(unsigned i0, unsigned i1) const
+	{
+		int rc = CompareKeys(keys[i0], keys[i1]);
+		if (rc == 0)
+			rc = CompareStored(names[i0], names[i1]);
 
+		StatsInc(sc_compares);
 
+		return options.reverse ? rc > 0 : rc < 0;
+	}
+};
 
-// AddToMap()
+
+
+// SortNameIndexes()
 //
-// Adds a file name to the ext_map data structure.
+// Puts the indexes of names in name order; a stable sort, so of several
+// equivalent names, the first one added comes first.  With --natural,
+// the key of each name is made once, here, rather than in every
+// comparison.
 
 void
-AddToMap(CSREF name)
+SortNameIndexes(const VEC_STRING& names, vector<unsigned>& order)
 {
-	string basename, ext;
-
-	int i = ScanForExtension(name);
+	const size_t n = names.size();
 
-	if (i <= 0)
-		basename = name;	// no extension; basename is whole name
-	else
-		basename = name.substr(0, i - 1);	// name not including dot
+	order.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		order[i] = i;
 
-	if (i <= 0)
-		ext = s_empty;
-	else if (i == name.length())
-		ext = s_dot;	// '.' was last char of name; use "." as ext
-	else
-		ext = name.substr(i, name.length());
+	if (!options.natural)
+	{
+		stable_sort(order.begin(), order.end(), by_name_index(names));
+		return;
+	}
 
-	TransformName(basename);
-	TransformName(ext);
+	VEC_STRING keys(n);
+	string full;
+	for (size_t i = 0; i < n; ++i)
+		NaturalKey(FullName(names[i], full), keys[i]);
 
-	UpdateMap(basename, ext);
+	stable_sort(order.begin(), order.end(), by_natural_key(names, keys));
 }
 
 
 
-// SlurpTryName()
-//
-// This checks a file name to see if it is a directory or a file,
-// and does the right thing with it.  For a directory name, that
-// just means calling AddDir(), because lf does not have an option to
-// recursively slurp directories.
-//
-// This is always called by SlurpDir() so there is always a "path" from
-// which the files are being slurped.
+// bucket::Sort()
 //
-// FUTURE: when lf gets modified to work in a MS Windows environment,
-// the check for hidden files will need to be modified.  It will need
-// to call the Windows equivalent of stat(), to check if a file has a
-// "hidden" attribute.
+// Sorts the names in name order.  A stable sort means that of several
+// equivalent names, the first one added comes first.  Names listed from
+// a tree index may come already sorted; see ListFromIndex().
 
 void
-SlurpTryName(CSREF name, CSREF path, bool keep_path)
+bucket::Sort()
 {
-	if (options.show_all == false && name[0] == ch_dot)
-		return;	// skip files starting with dot
-
-	string pathname = MakeFullPathName(name, path);
-
-	filetype ft;
-	bool b = check_type(pathname, ft);
-	if (!b)
-	{
-		Err(name, err_str[bad_filename]);
+	if (in_order)
 		return;
-	}
 
-	if (ft == ft_dir)
+	stats_timer_guard g(st_sort);
+	trace_span span("sort");
+
+	if (options.natural)
 	{
-		if (keep_path)
-			AddDir(pathname);
-		else
-			AddDir(name);
+		vector<unsigned> order;
+		SortNameIndexes(names, order);
+
+		VEC_STRING sorted;
+		sorted.reserve(names.size());
+		for (size_t r = 0; r < order.size(); ++r)
+			sorted.push_back(move(names[order[r]]));
+		names.swap(sorted);
 	}
+	else if (options.per_ext_limit)
+		sort_heap(names.begin(), names.end(), name_order());
 	else
-	{
-		if (keep_path)
-			AddToMap(pathname);
-		else
-			AddToMap(name);
-	}
+		stable_sort(names.begin(), names.end(), name_order());
 }
 
 
 
-// SlurpDir()
+// bucket::Finish()
 //
-// Opens a directory, lists out all the files and directories in it, and
-// saves all the names.  If keep_path is true, all the files will have
-// the path saved as part of the name: files in directory foo will be
-// saved as foo/filename.
-//
-// FUTURE: when lf gets modified to work in a MS Windows environment, an
-// alternate version of this function will be needed under #ifdef.
+// Sorts the names and drops duplicates.  A stable sort means that of
+// several equivalent names, the first one added is the one kept, which
+// is what inserting them into a set would do.
 
 void
-SlurpDir(CSREF path, bool keep_path)
+bucket::Finish()
 {
-	DIR *pdir;
-
-	pdir = opendir(path.c_str());
-
-	struct dirent *pdirent;
-
-	if (pdir == NULL)
-		Err(path, err_str[bad_dir]);
+	if (finished)
+		return;
+	finished = true;
 
-	while (pdirent = readdir(pdir))
+	if (options.sort_by != key_name)
 	{
-		char *name = pdirent->d_name;
-		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-			continue;
+		stats_timer_guard g(st_sort);
+		trace_span span("sort");
 
-		SlurpTryName(name, path, keep_path);
+		FinishByKey();
+		return;
 	}
 
-	int rc = closedir(pdir);
+	Sort();
+
+	// duplicates were not left out, so they don't count as seen either
+	VEC_STRING::iterator p_end =
+			unique(names.begin(), names.end(), EquivalentNames());
+	seen -= names.end() - p_end;
+	names.erase(p_end, names.end());
 }
 
 
 
-// TryArg()
+// keyed_name
 //
-// This tries an argument value to see if it is a directory or a file,
-// and does the right thing with it.  For a directory argument, that
-// means slurping (unless options.slurp_dir_arg is false).
-//
-// Arguments are saved in args_try_list, and this function is called
-// once for each entry in the list.
-//
-// This is different from SlurpTryName() because: 0) SlurpTryName()
-// never slurps a directory; 1) SlurpTryName() skips hidden files, and
-// if the user went to the trouble to specify a file as an argument, we
-// should list it even if it would normally be skipped as a hidden file.
+// One name to sort by key: the key, the rank of the name in name order
+// (which breaks ties, so the output is always the same), and where the
+// name is in names[].  Sorting these, rather than strings, means each
+// comparison is two integer compares in a 16-byte record, with no
+// pointers to chase.
 
-inline void
-TryArg(CSREF arg, bool keep_path)
+struct keyed_name
 {
-	filetype ft;
-	bool b = check_type(arg, ft);
-	if (!b)
-	{
-		Err(arg, err_str[bad_filename]);
-		return;
-	}
+	long long key;
+	unsigned rank;
+	unsigned index;
 
-	if (ft == ft_dir)
+	bool
+	operator<(const keyed_name& other) const
 	{
-		if (options.slurp_dir_arg)
-			SlurpDir(arg, keep_path);
-		else
-			AddDir(arg);
+		if (key != other.key)
+			return key < other.key;
+		return rank < other.rank;
 	}
-	else
-		AddToMap(arg);
-}
+};
 
 
 
-// TryArgList()
+// bucket::FinishByKey()
 //
-// Processes every saved argument in args_try_list.
+// Finish() for --sort=size or --sort=mtime.  First the names are put in
+// name order, as indexes, which finds the duplicates and gives each name
+// its rank; then the (key, rank) records are sorted, and the names are
+// moved into that order.  Largest or newest is first, and ties go in
+// name order; --reverse turns the whole thing round.
 
 void
-TryArgList(bool keep_path)
+bucket::FinishByKey()
 {
-	LIST_STRING::const_iterator p;
-	for (p = args_try_list.begin(); p != args_try_list.end(); ++p)
-		TryArg(*p, keep_path);
+	const size_t n = names.size();
+
+	vector<unsigned> by_name;
+	SortNameIndexes(names, by_name);
+
+	vector<keyed_name> records;
+	records.reserve(n);
+	for (size_t r = 0; r < n; ++r)
+	{
+		unsigned i = by_name[r];
+		if (r > 0 && EquivalentNames()(names[by_name[r - 1]], names[i]))
+		{
+			--seen;	// same as for a set: the first one added is kept
+			continue;
+		}
+
+		keyed_name k;
+		k.key = options.reverse ? keys[i] : ~keys[i];	// ~ flips the order
+		k.rank = r;
+		k.index = i;
+		records.push_back(k);
+	}
+
+	sort(records.begin(), records.end());
+
+	size_t keep = records.size();
+	if (options.per_ext_limit && keep > size_t(options.per_ext_limit))
+		keep = options.per_ext_limit;
+
+	VEC_STRING sorted;
+	sorted.reserve(keep);
+	for (size_t r = 0; r < keep; ++r)
+		sorted.push_back(move(names[records[r].index]));
+
+	names.swap(sorted);
+	vector<long long>().swap(keys);
 }
 
 
 
-// NumericArg()
+// spilling runs, for --mem-limit
 //
-// Processes a numeric arg, and handles either a bad or missing arg.
+// With --mem-limit, held_bytes keeps a rough count of the memory the
+// names in the buckets take.  When it goes over the limit, SpillRun()
+// sorts every bucket and writes all the names out as one run file, in
+// listing order, and empties the buckets.  At the end, the last names
+// are spilled too, and PrintMerged() merges the runs to print the
+// listing.  If names never go over the limit, nothing is spilled, and
+// the listing is printed from memory as usual.
+//
+// The bucket counts (seen) and the ext_set stay in memory; only the
+// names go out to the runs.
+//
+// A merge reads a buffer from every run at once, so no merge takes more
+// than run_fan_in runs.  Each run has a level: a spilled run is level
+// 0, and when the newest run_fan_in runs are all of one level, they are
+// merged into one run of the next level up, which takes the place of
+// all of them.  So a name is rewritten once per level, and there are
+// only as many levels as the log (base run_fan_in) of the number of
+// spills.  Before the final merge, the newest runs are merged until
+// there are no more than run_fan_in left.
+
+const long name_overhead = sizeof(string) + 1;	// per name, roughly
+const size_t run_fan_in = 64;
+
+long held_bytes;
+vector<int> run_fds;	// oldest first
+vector<int> run_levels;	// level of each run in run_fds
+
+
+
+// SpillBucket()
+//
+// Writes the names in one bucket to a run, in order, and frees them.
+
+void
+SpillBucket(outbuf& o, lfbin_kind kind, CSREF ext, bucket& b)
+{
+	b.Sort();
+
+	string full;
+	VEC_STRING::const_iterator p;
+	for (p = b.names.begin(); p != b.names.end(); ++p)
+		PutLfbinRecord(o, kind, ext, FullName(*p, full));
+
+	VEC_STRING().swap(b.names);
+}
+
+
+
+// run_merge
+//
+// Merges runs into one stream of records in listing order: directories
+// first, then the extensions in ext_set order, then the names in name
+// order.  Records that compare equal come out in the order of the runs
+// they came from, which is the order they were added in; so the merge
+// is stable, just as bucket::Sort() is.
+
+class run_merge
+{
+	private:
+		vector<run_reader *> readers;
+		vector<size_t> heap;	// readers with a record, smallest on top
+
+		bool Later(size_t i0, size_t i1) const;
+
+		struct later
+		{
+			const run_merge *pmerge;
+
+			bool
+			operator()(size_t i0, size_t i1) const
+			{
+				return pmerge->Later(i0, i1);
+			}
+		};
+
+	public:
+		run_merge(const vector<int>& fds);
+		~run_merge();
+
+		bool Done() const { return heap.empty(); }
+		const run_reader& Top() const { return *readers[heap.front()]; }
+		void Pop();
+};
+
+
+
+run_merge::run_merge(const vector<int>& fds)
+{
+	for (size_t i = 0; i < fds.size(); ++i)
+	{
+		readers.push_back(new run_reader(fds[i]));
+		if (readers[i]->Next())
+			heap.push_back(i);
+	}
+
+	later cmp = { this };
+	make_heap(heap.begin(), heap.end(), cmp);
+}
+
+
+
+run_merge::~run_merge()
+{
+	for (size_t i = 0; i < readers.size(); ++i)
+	{
+		if (!readers[i]->good())
+			ErrExit(err_str[bad_run_file]);
+		delete readers[i];
+	}
+}
+
+
+
+// run_merge::Later()
+//
+// True if reader i0's record goes after reader i1's.
+
+bool
+run_merge::Later(size_t i0, size_t i1) const
+{
+	const run_reader& r0 = *readers[i0];
+	const run_reader& r1 = *readers[i1];
+
+	if (r0.kind != r1.kind)
+		return r0.kind != lfbin_dir;	// directories first
+
+	mycompare cmp_ext;
+	if (cmp_ext(r0.ext, r1.ext))
+		return false;
+	if (cmp_ext(r1.ext, r0.ext))
+		return true;
+
+	name_order cmp;
+	if (cmp(r0.name, r1.name))
+		return false;
+	if (cmp(r1.name, r0.name))
+		return true;
+
+	return i0 > i1;
+}
+
+
+
+// run_merge::Pop()
+//
+// Moves past the record on top.
+
+void
+run_merge::Pop()
+{
+	later cmp = { this };
+
+	pop_heap(heap.begin(), heap.end(), cmp);
+	if (readers[heap.back()]->Next())
+		push_heap(heap.begin(), heap.end(), cmp);
+	else
+		heap.pop_back();
+}
+
+
+
+// MergeRuns()
+//
+// Merges the runs from run_fds[first] on, the newest ones, into one new
+// run a level above the highest of them, which takes their place.
+
+void
+MergeRuns(size_t first)
+{
+	trace_span span("merge");
+
+	Assert(run_fds.size() - first <= run_fan_in);
+
+	int fd = RunFileCreate();
+	if (fd < 0)
+		ErrExit(err_str[bad_run_file]);
+
+	{
+		outbuf o(fd);
+		run_merge merge(vector<int>(run_fds.begin() + first, run_fds.end()));
+
+		for (; !merge.Done(); merge.Pop())
+		{
+			const run_reader& r = merge.Top();
+			PutLfbinRecord(o, r.kind, r.ext, r.name);
+		}
+
+		if (!o.flush())
+			ErrExit(err_str[bad_run_file]);
+	}
+
+	// levels only go down from the oldest run to the newest
+	const int level = run_levels[first] + 1;
+
+	for (size_t i = first; i < run_fds.size(); ++i)
+		close(run_fds[i]);
+	run_fds.resize(first);
+	run_levels.resize(first);
+	run_fds.push_back(fd);
+	run_levels.push_back(level);
+}
+
+
+
+// MergeDownToFanIn()
+//
+// Merges the newest runs until no more than run_fan_in are left, so the
+// final merge can read them all at once.
+
+void
+MergeDownToFanIn()
+{
+	while (run_fds.size() > run_fan_in)
+	{
+		size_t n = min(run_fan_in, run_fds.size() - run_fan_in + 1);
+		MergeRuns(run_fds.size() - n);
+	}
+}
+
+
+
+// SpillRun()
+//
+// Writes every name held in memory out to a new run.
+
+void
+SpillRun()
+{
+	trace_span span("spill");
+
+	RankPaths();	// the names are sorted to be spilled
+
+	int fd = RunFileCreate();
+	if (fd < 0)
+		ErrExit(err_str[bad_run_file]);
+
+	{
+		outbuf o(fd);
+
+		SpillBucket(o, lfbin_dir, s_empty, dirs_bucket);
+
+		SET_STRING::const_iterator p;
+		for (p = ext_set.begin(); p != ext_set.end(); ++p)
+			SpillBucket(o, lfbin_file, *p, *ext_map[*p]);
+
+		if (!o.flush())
+			ErrExit(err_str[bad_run_file]);
+	}
+
+	run_fds.push_back(fd);
+	run_levels.push_back(0);
+	held_bytes = 0;
+
+	while (run_fds.size() >= run_fan_in
+			&& run_levels[run_fds.size() - run_fan_in] == run_levels.back())
+		MergeRuns(run_fds.size() - run_fan_in);
+}
+
+
+
+// HoldName()
+//
+// Counts a name just added to a bucket against --mem-limit, and spills
+// a run if that puts it over.
+
+inline void
+HoldName(CSREF name)
+{
+	if (options.mem_limit == 0)
+		return;
+
+	held_bytes += name_overhead + name.length();
+	if (held_bytes > options.mem_limit)
+		SpillRun();
+}
+
+
+
+// UpdateMap()
+//
+// Given a file name and the file's extension, adds that file name to
+// ext_map.  Also makes sure the extension is in the ext_set.
+//
+// ext_map is looked up first: it compares bytes, which is cheaper than
+// collating (much cheaper with --natural), so only a new extension has
+// to be collated into ext_set.  An extension that collates the same as
+// one already there, such as "C" and "c" with --ascii-ic, shares its
+// bucket.
+
+void
+UpdateMap(CSREF basename, CSREF ext, long long key)
+{
+	MAP_STRING_BUCKET::iterator p = ext_map.find(ext);
+	if (p == ext_map.end())
+	{
+		pair<SET_STRING::iterator, bool> r = ext_set.insert(ext);
+
+		// extension never seen before, so make a new bucket of names
+		PBUCKET pbucket = r.second ? new bucket : ext_map[*r.first];
+		p = ext_map.insert(make_pair(ext, pbucket)).first;
+	}
+
+	p->second->Add(basename, key);
+	HoldName(basename);
+}
+
+
+
+// ForceToLower()
+//
+// Forces a string to lower-case, using the user's locale tolower().
+
+void
+ForceToLower(string& s)
+{
+	int len = s.length();
+	char buf[len + 1];
+
+	s.copy(buf, len);
+	buf[len] = ch_nul;
+
+	(*pdef_ctype).tolower(buf, buf + len + 1);
+
+	s = string(buf);
+}
+
+
+
+// ReplaceSpaces()
+//
+// Replaces any spaces in a string with options.s_replace_space.
+
+void
+ReplaceSpaces(string& s)
+{
+	const int space_len = 1;	// length of a space
+	const int rlen = options.s_replace_space.length();
+
+	int i = 0;
+
+	for (;;)
+	{
+		i = s.find(ch_space, i);
+		if (i < 0)
+			return;
+		s.replace(i, space_len, options.s_replace_space, 0, rlen);
+		i += rlen;
+	}
+}
+
+
+
+// TransformName()
+//
+// Applies any transformations specified by user's options to a file name.
+
+void
+TransformName(string& name)
+{
+	if (options.force_lower)
+		ForceToLower(name);
+
+	if (options.replace_spaces)
+		ReplaceSpaces(name);
+}
+
+
+
+// FindLast()
+//
+// Returns the index of the last ch in the first len chars of s, or -1.
+
+inline int
+FindLast(CSZ s, int len, char ch)
+{
+	for (int i = len - 1; i >= 0; --i)
+		if (s[i] == ch)
+			return i;
+
+	return -1;
+}
+
+
+
+// compound extensions
+//
+// With --compound, names are first matched against the rules for
+// compound extensions, such as "tar.gz" and "so.N", all at once; see
+// suffixtrie.hpp.  The rules are the built-in ones, plus the ones in
+// the file named by --compound=file, or else in ~/.lfexts if there is
+// one.  A compound extension is kept whatever its length: the rule for
+// it was asked for, so --ext-limit doesn't apply.  So that the labels
+// still line up, WidenExtColumn() makes the label column wide enough
+// for the compound extensions found, unless --ext-width was given.
+
+const CSZ builtin_compound_exts[] =
+{
+	"tar.gz", "tar.bz2", "tar.xz", "tar.zst", "tar.lz", "tar.lz4",
+	"tar.lzma", "tar.Z", "pkg.tar.zst", "pkg.tar.xz",
+	"so.N", "d.ts", "d.mts", "d.cts", "min.js", "min.css",
+	"js.map", "css.map",
+};
+
+const int builtin_compound_exts_max = sizeof(builtin_compound_exts)
+		/ sizeof(builtin_compound_exts[0]);
+
+const CSZ lfexts_filename = ".lfexts";
+
+suffix_trie compound_exts;
+
+
+
+// LoadCompoundExts()
+//
+// Builds compound_exts from the built-in rules and the rules file.
+
+void
+LoadCompoundExts()
+{
+	if (!options.compound)
+		return;
+
+	for (int i = 0; i < builtin_compound_exts_max; ++i)
+		compound_exts.Add(builtin_compound_exts[i]);
+
+	string path = options.compound_path;
+	bool must_exist = !path.empty();
+	if (path.empty())
+	{
+		CSZ home = getenv("HOME");
+		if (NonEmptySz(home))
+			path = MakeFullPathName(lfexts_filename, home);
+	}
+
+	int bad_line;
+	if (!path.empty() && !compound_exts.Load(path, bad_line))
+	{
+		if (bad_line != 0)
+		{
+			char buf[32];
+			snprintf(buf, sizeof(buf), ":%d", bad_line);
+			ErrExit(path + buf, err_str[bad_compound_rule]);
+		}
+		if (must_exist)
+			ErrExit(path, err_str[bad_compound_file]);
+	}
+
+	compound_exts.Build();
+}
+
+
+
+// ScanForExtension()
+//
+// Scans backwards through a file name, looking for an extension.
+// Applies several rules to decide whether to keep an extension it
+// finds.  If it doesn't find one, or if the extension it finds doesn't
+// qualify, returns -1; otherwise, returns the index into the string at
+// which the extension starts.  A compound extension is looked for
+// first.
+
+int
+ScanForExtension(CSZ name, int len)
+{
+	int i_compound = compound_exts.Match(name, len);
+	if (i_compound > 0)
+		return i_compound;
+
+	int i_dot = FindLast(name, len, ch_dot);	// last dot in file name
+	int i_ext = i_dot + 1;	// one past the dot should be the extension
+
+	// i_dot will be < 0 if no dot was found; a no-ext file.
+	// i_dot will be == 0 if the first char of name is a dot.
+	// Initial dot is for a hidden file, not for a filename that is all
+	// extension; so if i_dot is 0, call that a no-ext file.
+	// Even under MS Windows where an initial dot isn't special, this is
+	// the right thing to do; a null filename would not make sense.
+
+	if (i_dot <= 0)
+		return -1;
+
+	int ext_len = len - i_ext;
+	if (ext_len > options.ext_limit)
+		return -1;	// extension is too long!
+
+	// *NIX has lots of files of the form "foo-2.18".  We want to treat
+	// this as a file with no extension, not as a ".18" file with a
+	// basename of "foo-2".  The following code detects this.
+
+	// is the extension numeric?
+	if (!IsNum(name + i_ext, name + len))
+		return i_ext;	// not numeric, so it's fine; return it
+
+	int i = FindLast(name, i_dot, ch_dash);	// last '-' before the dot
+	if (i < 0)
+		return i_ext;	// no '-' found, so extension is good!
+
+	++i; 	// advance past '-'
+	if (!IsNum(name + i, name + i_dot))
+		return i_ext;	// non-numeric found after '-' so it's good
+
+	return -1;	// looks like "-2.18" so call it no ext
+}
+
+
+
+int
+ScanForExtension(CSREF name)
+{
+	return ScanForExtension(name.data(), name.length());
+}
+
+
+
+// CountName()
+//
+// With --count, this takes the place of AddDir() and AddToMap(): it
+// counts a name under its extension, and keeps nothing else.  Only the
+// extension is copied, and extensions are short enough that a string
+// holds them without allocating.
+
+void
+CountName(count_table& t, CSZ name, int len, bool is_dir, long bytes)
+{
+	if (is_dir)
+	{
+		++t.dirs.names;
+		t.dirs.bytes += bytes;
+		return;
+	}
+
+	string ext;
+	int i = ScanForExtension(name, len);
+
+	if (i == len)
+		ext = s_dot;	// '.' was last char of name; use "." as ext
+	else if (i > 0)
+		ext.assign(name + i, len - i);
+
+	TransformName(ext);
+
+	count_total& total = t.exts[ext];
+	++total.names;
+	total.bytes += bytes;
+}
+
+
+
+// CountArgName()
+//
+// CountName() for a name given as an argument.  With --sizes this needs
+// one more stat(), to get the size; there are only ever a few of these.
+
+void
+CountArgName(CSREF name, bool is_dir)
+{
+	long long bytes = 0;
+
+	if (options.sizes)
+	{
+		filetype ft;
+		StatsInc(sc_stat_calls);
+		check_type_size(name, ft, bytes);
+	}
+
+	CountName(counts, name.data(), name.length(), is_dir, bytes);
+}
+
+
+
+// AddDir()
+//
+// Adds a name to the dirs_bucket.  With --count, just counts it.  The
+// key is the size or modification time, with --sort=size or mtime.  If
+// path_index isn't -1, the name is in that directory in path_table, and
+// is stored as a path name.
+
+void
+AddDir(CSREF dir_name, long long key = 0, int path_index = -1)
+{
+	if (options.count_only)
+	{
+		CountArgName(dir_name, true);
+		return;
+	}
+
+	stats_timer_guard g(st_classify);
+	string name = dir_name;
+
+	TransformName(name);
+	if (path_index >= 0)
+		MakePathName(name, path_index);
+
+	dirs_bucket.Add(name, key);
+	HoldName(name);
+}
+
+
+
+// AddSplitName()
+//
+// The rest of AddToMap(), once it is known where the extension starts
+// in the name (i, as from ScanForExtension(); not above 0 for none).
+
+void
+AddSplitName(CSZ name, size_t len, int i, long long key, int path_index)
+{
+	string basename, ext;
+
+	// room for the path mark, so MakePathName() doesn't reallocate
+	basename.reserve(len + path_mark_len);
+	if (i <= 0)
+		basename.assign(name, len);	// no extension; basename is whole name
+	else
+		basename.assign(name, i - 1);	// name not including dot
+
+	if (i <= 0)
+		ext = s_empty;
+	else if (size_t(i) == len)
+		ext = s_dot;	// '.' was last char of name; use "." as ext
+	else
+		ext.assign(name + i, len - i);
+
+	TransformName(basename);
+	TransformName(ext);
+	if (path_index >= 0)
+		MakePathName(basename, path_index);
+
+	UpdateMap(basename, ext, key);
+}
+
+
+
+// AddToMap()
+//
+// Adds a file name to the ext_map data structure.  The key and
+// path_index are as for AddDir().
+
+void
+AddToMap(CSZ name, size_t len, long long key = 0, int path_index = -1)
+{
+	if (options.count_only)
+	{
+		CountArgName(string(name, len), false);
+		return;
+	}
+
+	stats_timer_guard g(st_classify);
+
+	// only the last component of a path name can have the extension
+	const size_t i_base = FindLast(name, len, dir_sep_char) + 1;
+	int i = ScanForExtension(name + i_base, len - i_base);
+	if (i > 0)
+		i += i_base;
+
+	AddSplitName(name, len, i, key, path_index);
+}
+
+
+
+inline void
+AddToMap(CSREF name, long long key = 0, int path_index = -1)
+{
+	AddToMap(name.data(), name.length(), key, path_index);
+}
+
+
+
+// CheckTypeKey()
+//
+// check_type() for a name relative to the open directory dir_fd.  With
+// --sort=size or --sort=mtime, this also gets the sort key with the
+// same call; otherwise key is left alone.
+
+bool
+CheckTypeKey(int dir_fd, CSREF name, filetype& ft, long long& key)
+{
+	if (options.sort_by == key_size)
+		return check_type_size(dir_fd, name.c_str(), ft, key);
+	else if (options.sort_by == key_mtime)
+		return check_type_mtime(dir_fd, name.c_str(), ft, key);
+	else
+		return check_type(dir_fd, name.c_str(), ft);
+}
+
+
+
+// SlurpTryName()
+//
+// This checks a file name to see if it is a directory or a file,
+// and does the right thing with it.  For a directory name, that
+// just means calling AddDir(), because lf does not have an option to
+// recursively slurp directories.
+//
+// This is always called by SlurpDir() so there is always a "path" from
+// which the files are being slurped.
+//
+// FUTURE: when lf gets modified to work in a MS Windows environment,
+// the check for hidden files will need to be modified.  It will need
+// to call the Windows equivalent of stat(), to check if a file has a
+// "hidden" attribute.
+
+void
+SlurpTryName(CSREF name, CSREF path, bool keep_path, int dir_fd,
+		int path_index)
+{
+	if (options.show_all == false && name[0] == ch_dot)
+		return;	// skip files starting with dot
+
+	filetype ft;
+	long long key = 0;
+	StatsInc(sc_stat_calls);
+	bool b = CheckTypeKey(dir_fd, name, ft, key);
+	if (!b)
+	{
+		Err(name, err_str[bad_filename]);
+		return;
+	}
+
+	if (keep_path && path_index < 0)
+	{
+		// path_table is full, so store the full path name
+		string pathname = MakeFullPathName(name, path);
+
+		if (ft == ft_dir)
+			AddDir(pathname, key);
+		else
+			AddToMap(pathname, key);
+	}
+	else if (ft == ft_dir)
+		AddDir(name, key, path_index);
+	else
+		AddToMap(name, key, path_index);
+}
+
+
+
+// IgnoreEntry()
+//
+// True if a directory entry is left out by --gitignore.  This is
+// checked before anything else is looked up about the name: only a rule
+// for directories alone cares about the type of the name, and the
+// directory entry usually says what it is without a stat().
+
+bool
+IgnoreEntry(const ignore_rules& ignore, int dir_fd,
+		const struct dirent *pdirent)
+{
+	CSZ name = pdirent->d_name;
+	bool if_file, if_dir;
+
+	ignore.Match(name, strlen(name), if_file, if_dir);
+
+	bool b = if_file;
+	if (if_file != if_dir)
+	{
+		if (pdirent->d_type != DT_UNKNOWN && pdirent->d_type != DT_LNK)
+			b = (pdirent->d_type == DT_DIR) ? if_dir : if_file;
+		else
+		{
+			filetype ft;
+			StatsInc(sc_stat_calls);
+			if (check_type(dir_fd, name, ft) && ft == ft_dir)
+				b = if_dir;
+		}
+	}
+
+	if (b)
+		StatsInc(sc_ignored);
+	return b;
+}
+
+
+
+// CountDirEntry()
+//
+// SlurpTryName() for --count.  This is the whole per-name cost of a
+// count, so it avoids building the path name and calling stat() when
+// the directory entry already says what type the name is.  Only a
+// symbolic link (which lf follows, like stat() does) or a filesystem
+// that doesn't fill in d_type needs a stat(), and then only one
+// relative to the open directory.  With --sizes every name needs one,
+// but it asks only for the type and size.  Names are counted by their
+// basename, with or without keep_path.
+
+void
+CountDirEntry(count_table& t, int dir_fd, const struct dirent *pdirent)
+{
+	CSZ name = pdirent->d_name;
+
+	if (options.show_all == false && name[0] == ch_dot)
+		return;	// skip files starting with dot
+
+#ifdef _DIRENT_HAVE_D_TYPE
+	if (!options.sizes && pdirent->d_type != DT_UNKNOWN &&
+			pdirent->d_type != DT_LNK)
+	{
+		CountName(t, name, strlen(name), pdirent->d_type == DT_DIR, 0);
+		return;
+	}
+#endif
+
+	filetype ft;
+	long long bytes;
+	StatsInc(sc_stat_calls);
+	if (!check_type_size(dir_fd, name, ft, bytes))
+	{
+		Err(name, err_str[bad_filename]);
+		return;
+	}
+
+	CountName(t, name, strlen(name), ft == ft_dir, bytes);
+}
+
+
+
+// CountDir()
+//
+// SlurpDir() for --count: counts every name in one directory into t.
+// Several of these can run at once, each with its own table; see
+// CountArgList().
+
+void
+CountDir(count_table& t, CSREF path)
+{
+	trace_span span("slurp", path);
+	DIR *pdir;
+
+	pdir = opendir(path.c_str());
+	if (pdir == NULL)
+	{
+		Err(path, err_str[bad_dir]);
+		return;
+	}
+
+	const int dir_fd = dirfd(pdir);
+	struct dirent *pdirent;
+
+	ignore_rules ignore;
+	if (options.gitignore)
+		ignore.Load(path);
+
+	for (;;)
+	{
+		StatsInc(sc_readdir_calls);
+		pdirent = readdir(pdir);
+		if (pdirent == NULL)
+			break;
+		StatsInc(sc_dir_entries);
+
+		char *name = pdirent->d_name;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			continue;
+
+		if (options.gitignore && IgnoreEntry(ignore, dir_fd, pdirent))
+			continue;
+
+		CountDirEntry(t, dir_fd, pdirent);
+	}
+
+	closedir(pdir);
+}
+
+
+
+// SlurpDir()
+//
+// Opens a directory, lists out all the files and directories in it, and
+// saves all the names.  If keep_path is true, all the files will have
+// the path saved as part of the name: files in directory foo will be
+// saved as foo/filename.
+//
+// FUTURE: when lf gets modified to work in a MS Windows environment, an
+// alternate version of this function will be needed under #ifdef.
+
+void
+SlurpDir(CSREF path, bool keep_path)
+{
+	if (options.count_only)
+	{
+		CountDir(counts, path);
+		return;
+	}
+
+	trace_span span("slurp", path);
+	DIR *pdir;
+
+	pdir = opendir(path.c_str());
+
+	struct dirent *pdirent;
+
+	if (pdir == NULL)
+	{
+		Err(path, err_str[bad_dir]);
+		return;
+	}
+
+	const int dir_fd = dirfd(pdir);
+
+	string path_key = path;
+	TransformName(path_key);
+	const int path_index = keep_path ? AddPath(path_key) : -1;
+
+	ignore_rules ignore;
+	if (options.gitignore)
+		ignore.Load(path);
+
+	for (;;)
+	{
+		StatsInc(sc_readdir_calls);
+		pdirent = readdir(pdir);
+		if (pdirent == NULL)
+			break;
+		StatsInc(sc_dir_entries);
+
+		char *name = pdirent->d_name;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			continue;
+
+		if (options.gitignore && IgnoreEntry(ignore, dir_fd, pdirent))
+			continue;
+
+		SlurpTryName(name, path, keep_path, dir_fd, path_index);
+	}
+
+	int rc = closedir(pdir);
+}
+
+
+
+// path_cache
+//
+// For names that aren't read from a directory (the names read by
+// --files-from, and the members of an archive), finds the index in
+// path_table of the directory in front of each name.  Names in a row
+// are often in the same directory, so the last one is remembered, and
+// only a new one is looked up.  If prefix isn't empty, it goes in front
+// of every directory.
+
+struct path_cache
+{
+	string prefix;
+	unordered_map<string, int> index;
+	string last_dir;
+	int last_index;
+	bool have_last;
+
+	path_cache() : last_index(-1), have_last(false) {}
+
+	int Lookup(CSZ dir, size_t len);
+};
+
+
+
+// path_cache::Lookup()
+//
+// Returns the index of a directory, or -1 if path_table is full.
+
+int
+path_cache::Lookup(CSZ dir, size_t len)
+{
+	if (have_last && last_dir.compare(0, string::npos, dir, len) == 0)
+		return last_index;
+
+	last_dir.assign(dir, len);
+	have_last = true;
+
+	pair<unordered_map<string, int>::iterator, bool> p =
+			index.insert(make_pair(last_dir, 0));
+	if (p.second)
+	{
+		p.first->second = AddPath(prefix.empty() ? last_dir
+				: MakeFullPathName(last_dir, prefix));
+	}
+	last_index = p.first->second;
+
+	return last_index;
+}
+
+
+
+// AddListedName()
+//
+// Adds a name read from a list or an archive, which may have a path in
+// front of it, and whose type and key are already known.  The name is
+// stored as a path name when it can be.
+
+void
+AddListedName(path_cache& paths, CSZ name, size_t len, bool is_dir,
+		long long key)
+{
+	size_t dir_len = FindLast(name, len, dir_sep_char) + 1;
+	if (dir_len == len)
+		dir_len = 0;	// "name/" is just a name
+
+	if (options.count_only)
+	{
+		// only the extension matters, and it is in the basename
+		CountName(counts, name + dir_len, len - dir_len, is_dir, key);
+		return;
+	}
+
+	if (dir_len == 0 && paths.prefix.empty())
+	{
+		if (is_dir)
+			AddDir(string(name, len), key);
+		else
+			AddToMap(name, len, key);
+		return;
+	}
+
+	const int path_index = paths.Lookup(name, dir_len);
+	if (path_index < 0)
+	{
+		// path_table is full, so store the full path name
+		string pathname(name, len);
+		if (!paths.prefix.empty())
+			pathname = MakeFullPathName(pathname, paths.prefix);
+
+		if (is_dir)
+			AddDir(pathname, key);
+		else
+			AddToMap(pathname, key);
+		return;
+	}
+
+	if (is_dir)
+		AddDir(string(name + dir_len, len - dir_len), key, path_index);
+	else
+		AddToMap(name + dir_len, len - dir_len, key, path_index);
+}
+
+
+
+// IsArchiveArg()
+//
+// True if a file given as an argument is an archive to list, with
+// --archives.  Like a directory, it is only listed as a name with -d.
+
+inline bool
+IsArchiveArg(CSREF arg)
+{
+	return options.archives && options.slurp_dir_arg && IsArchive(arg);
+}
+
+
+
+// HiddenPath()
+//
+// True if any part of a path name starts with a dot.
+
+bool
+HiddenPath(CSREF name)
+{
+	for (size_t i = 0; i < name.length(); ++i)
+	{
+		if (name[i] == ch_dot && (i == 0 || name[i - 1] == dir_sep_char))
+			return true;
+	}
+
+	return false;
+}
+
+
+
+// ListArchive()
+//
+// Lists the members of an archive (see archive.hpp) as SlurpDir() lists
+// the names in a directory, except that every member is listed, however
+// deep in the archive: a member is listed with its path in the archive,
+// and with keep_path, with the archive's path in front of that.  As in
+// a directory, hidden names are skipped, and so is everything in a
+// hidden directory.
+
+void
+ListArchive(CSREF path, bool keep_path)
+{
+	archive_reader a;
+	if (!a.Open(path))
+	{
+		Err(path, err_str[bad_archive]);
+		return;
+	}
+
+	path_cache paths;
+	if (keep_path)
+		paths.prefix = path;
+
+	while (a.Next())
+	{
+		StatsInc(sc_names_read);
+		if (options.show_all == false && HiddenPath(a.name))
+			continue;
+
+		long long key = 0;
+		if (options.sort_by == key_size || options.count_only)
+			key = a.size;
+		else if (options.sort_by == key_mtime)
+			key = a.mtime;
+
+		AddListedName(paths, a.name.data(), a.name.length(), a.is_dir,
+				key);
+	}
+
+	if (!a.good())
+		Err(path, err_str[bad_archive]);
+}
+
+
+
+// tree index
+//
+// With --build-index, lf writes a tree index (see treeindex.hpp) of a
+// whole tree instead of listing anything; with --index, a directory
+// that is in the index is listed from there instead of being read.
+// index_signature is the signature this run of lf would give an index,
+// to compare with the one the index was built with.
+
+const unsigned index_max_workers = 16;
+
+index_map tree_index;
+string index_signature;
+
+
+
+// OrderSignature()
+//
+// Describes the options that decide the order of names: the collation,
+// --natural and --reverse.  A snapshot records it too.
+
+string
+OrderSignature()
+{
+	string sig;
+
+	if (options.sort == sort_ascii)
+		sig = "ascii";
+	else if (options.sort == sort_ascii_ic)
+		sig = "ascii-ic";
+	else
+		sig = "locale=" + def_locale.name();
+
+	if (options.natural)
+		sig += " natural";
+	if (options.reverse)
+		sig += " reverse";
+
+	return sig;
+}
+
+
+
+// IndexSignature()
+//
+// Describes the options that decide how the names in a directory are
+// split and sorted.  Only an index with the same signature can be
+// trusted to have the names split and sorted as this run of lf would.
+
+string
+IndexSignature()
+{
+	string sig = OrderSignature();
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), " ext-limit=%d", options.ext_limit);
+	sig += buf;
+
+	for (size_t i = 0; options.compound && i < compound_exts.size(); ++i)
+		sig += " compound=" + compound_exts.rule(i);
+
+	return sig;
+}
+
+
+
+// AppendIndexRun()
+//
+// For OrderIndexDir(): moves the entries at indexes to the end of
+// sorted, in the order bucket::Sort() would put their basenames.
+
+void
+AppendIndexRun(vector<index_entry>& entries, const vector<unsigned>& indexes,
+		vector<index_entry>& sorted)
+{
+	VEC_STRING names(indexes.size());
+	for (size_t r = 0; r < indexes.size(); ++r)
+	{
+		const index_entry& e = entries[indexes[r]];
+
+		if (e.ext_at == 0)
+			names[r] = e.name;
+		else
+			names[r].assign(e.name, 0, e.ext_at - 1);
+	}
+
+	vector<unsigned> order;
+	SortNameIndexes(names, order);
+
+	for (size_t r = 0; r < order.size(); ++r)
+		sorted.push_back(move(entries[indexes[order[r]]]));
+}
+
+
+
+// OrderIndexDir()
+//
+// The order function for index_builder: finds the extension of each
+// file, and puts the entries of a directory in listing order, the
+// directories first and then the files of each extension.  Runs on the
+// builder's threads, several directories at once.
+
+void
+OrderIndexDir(index_dir& dir)
+{
+	typedef map<string, vector<unsigned>, mycompare> MAP_STRING_RUN;
+
+	vector<index_entry>& entries = dir.entries;
+	vector<unsigned> dirs;
+	MAP_STRING_RUN exts;
+	string ext;
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		index_entry& e = entries[i];
+		if (e.kind == ik_dir)
+		{
+			dirs.push_back(i);
+			continue;
+		}
+
+		int at = ScanForExtension(e.name);
+		e.ext_at = max(at, 0);
+
+		if (at <= 0)
+			ext = s_empty;
+		else if (size_t(at) == e.name.length())
+			ext = s_dot;
+		else
+			ext.assign(e.name, at, string::npos);
+		exts[ext].push_back(i);
+	}
+
+	vector<index_entry> sorted;
+	sorted.reserve(entries.size());
+
+	AppendIndexRun(entries, dirs, sorted);
+	MAP_STRING_RUN::const_iterator p;
+	for (p = exts.begin(); p != exts.end(); ++p)
+		AppendIndexRun(entries, p->second, sorted);
+
+	entries.swap(sorted);
+}
+
+
+
+// BuildIndex()
+//
+// For --build-index: writes a tree index of the directory argument, or
+// of the current directory, reading up to index_max_workers directories
+// at once.
+
+void
+BuildIndex()
+{
+	if (args_try_list.size() > 1)
+		ErrExit(arg_str[build_index_l], err_str[bad_index_root]);
+
+	string root = args_try_list.empty() ? GetCwd() : args_try_list.front();
+	filetype ft;
+	StatsInc(sc_stat_calls);
+	if (!check_type(root, ft) || ft != ft_dir)
+		ErrExit(root, err_str[bad_dir]);
+
+	char *real = realpath(root.c_str(), NULL);
+	if (real == NULL)
+		ErrExit(root, err_str[bad_dir]);
+	root = real;
+	free(real);
+
+	unsigned workers = thread::hardware_concurrency();
+	workers = max(1u, min(workers, index_max_workers));
+
+	trace_span span("build-index", root);
+	index_builder b;
+	if (!b.Build(options.build_index, root, IndexSignature(), OrderIndexDir,
+			workers))
+		ErrExit(options.build_index, err_str[bad_build_index]);
+
+	for (size_t i = 0; i < b.bad_dirs.size(); ++i)
+		Err(b.bad_dirs[i], err_str[bad_dir]);
+
+	if (options.verbose_level >= 1)
+	{
+		out << verbose_str[v_index_dirs] << long(b.dir_count) << '\n';
+		out << verbose_str[v_index_names] << long(b.name_count) << '\n';
+	}
+}
+
+
+
+// OpenIndex()
+//
+// For --index: maps the tree index.
+
+void
+OpenIndex()
+{
+	if (!tree_index.Open(options.index_path.c_str()))
+		ErrExit(options.index_path, err_str[bad_index]);
+
+	index_signature = IndexSignature();
+}
+
+
+
+// ListFromIndex()
+//
+// SlurpDir() from the tree index.  If the directory is in the index
+// (and, with --index-check, hasn't changed since the index was built),
+// lists the names stored for it and returns true; otherwise returns
+// false, having listed nothing, and the directory is read as usual.
+//
+// Each name comes with its type, size and time, so nothing is looked
+// up.  If the index was built with the same sort options, each name
+// also comes split into basename and extension; and for a listing of
+// just this directory in name order, the names came in the order the
+// buckets would sort them into, so the buckets are not sorted again.
+
+bool
+ListFromIndex(CSREF path, bool keep_path)
+{
+	if (!tree_index.is_open() || options.gitignore)
+		return false;
+
+	char *real = realpath(path.c_str(), NULL);
+	if (real == NULL)
+		return false;
+	bool found = tree_index.Find(real);
+	free(real);
+
+	if (!found)
+	{
+		if (!tree_index.good())
+			ErrExit(options.index_path, err_str[bad_index]);
+		return false;
+	}
+
+	if (options.index_check)
+	{
+		filetype ft;
+		long long mtime;
+		StatsInc(sc_stat_calls);
+		if (!check_type_mtime(path, ft, mtime) || mtime != tree_index.dir_mtime)
+		{
+			StatsInc(sc_index_stale);
+			return false;
+		}
+	}
+
+	trace_span span("index", path);
+	StatsInc(sc_index_dirs);
+
+	string path_key = path;
+	TransformName(path_key);
+	const int path_index = keep_path ? AddPath(path_key) : -1;
+	const bool split = (tree_index.signature == index_signature);
+	string name;
+
+	while (tree_index.Next())
+	{
+		StatsInc(sc_dir_entries);
+
+		CSZ pch = tree_index.name;
+		const size_t len = tree_index.name_len;
+		if (options.show_all == false && pch[0] == ch_dot)
+			continue;	// skip files starting with dot
+
+		name.assign(pch, len);
+		if (tree_index.kind == ik_bad)
+		{
+			Err(name, err_str[bad_filename]);
+			continue;
+		}
+
+		const bool is_dir = (tree_index.kind == ik_dir);
+		if (options.count_only)
+		{
+			CountName(counts, pch, len, is_dir,
+					options.sizes ? tree_index.entry_size : 0);
+			continue;
+		}
+
+		long long key = 0;
+		if (options.sort_by == key_size)
+			key = tree_index.entry_size;
+		else if (options.sort_by == key_mtime)
+			key = tree_index.mtime;
+
+		if (keep_path && path_index < 0)
+		{
+			// path_table is full, so store the full path name
+			string pathname = MakeFullPathName(name, path);
+
+			if (is_dir)
+				AddDir(pathname, key);
+			else
+				AddToMap(pathname, key);
+		}
+		else if (is_dir)
+			AddDir(name, key, path_index);
+		else if (split)
+		{
+			stats_timer_guard g(st_classify);
+			AddSplitName(pch, len, tree_index.ext_at, key, path_index);
+		}
+		else
+			AddToMap(pch, len, key, path_index);
+	}
+
+	if (!tree_index.good())
+		ErrExit(options.index_path, err_str[bad_index]);
+
+	if (split && !keep_path && options.sort_by == key_name
+			&& !options.per_ext_limit && !options.count_only
+			&& !options.force_lower && !options.replace_spaces)
+	{
+		dirs_bucket.in_order = true;
+
+		MAP_STRING_BUCKET::const_iterator p;
+		for (p = ext_map.begin(); p != ext_map.end(); ++p)
+			p->second->in_order = true;
+	}
+
+	return true;
+}
+
+
+
+// TryArg()
+//
+// This tries an argument value to see if it is a directory or a file,
+// and does the right thing with it.  For a directory argument, that
+// means slurping (unless options.slurp_dir_arg is false).
+//
+// Arguments are saved in args_try_list, and this function is called
+// once for each entry in the list.
+//
+// This is different from SlurpTryName() because: 0) SlurpTryName()
+// never slurps a directory; 1) SlurpTryName() skips hidden files, and
+// if the user went to the trouble to specify a file as an argument, we
+// should list it even if it would normally be skipped as a hidden file.
+
+inline void
+TryArg(CSREF arg, bool keep_path)
+{
+	filetype ft;
+	long long key = 0;
+	StatsInc(sc_stat_calls);
+	bool b = CheckTypeKey(AT_FDCWD, arg, ft, key);
+	if (!b)
+	{
+		Err(arg, err_str[bad_filename]);
+		return;
+	}
+
+	if (ft == ft_dir)
+	{
+		if (!options.slurp_dir_arg)
+			AddDir(arg, key);
+		else if (!ListFromIndex(arg, keep_path))
+			SlurpDir(arg, keep_path);
+	}
+	else if (IsArchiveArg(arg))
+		ListArchive(arg, keep_path);
+	else
+		AddToMap(arg, key);
+}
+
+
+
+// count_dirs
+//
+// With --count and several directory arguments, the directories are
+// read at the same time, by up to count_max_workers threads.  Reading a
+// directory is mostly waiting on the filesystem (and with --sizes, one
+// stat() per name), so this helps most on a network filesystem.  Each
+// directory gets its own table, and the tables are added up in the
+// order of the arguments once all the threads are done.
+
+const unsigned count_max_workers = 16;
+
+class count_dirs
+{
+	private:
+		const VEC_STRING& dirs;
+		vector<count_table> tables;
+		size_t next_dir;	// next directory for a worker to take
+		mutex mtx;
+
+		void Worker();
+
+	public:
+		count_dirs(const VEC_STRING& dirs_to_count)
+				: dirs(dirs_to_count), tables(dirs_to_count.size()),
+				next_dir(0) {}
+
+		void Run();
+};
+
+
+
+void
+count_dirs::Worker()
+{
+	TraceThreadName("counter");
+
+	for (;;)
+	{
+		size_t i;
+		{
+			lock_guard<mutex> lock(mtx);
+			if (next_dir == dirs.size())
+				return;
+			i = next_dir++;
+		}
+
+		CountDir(tables[i], dirs[i]);
+	}
+}
+
+
+
+void
+count_dirs::Run()
+{
+	unsigned workers = thread::hardware_concurrency();
+	workers = min(workers, count_max_workers);
+	workers = min(workers, unsigned(dirs.size()));
+
+	vector<thread> threads;
+	for (unsigned n = 1; n < workers; ++n)
+		threads.push_back(thread(&count_dirs::Worker, this));
+
+	Worker();	// this thread is a worker too
+
+	for (size_t n = 0; n < threads.size(); ++n)
+		threads[n].join();
+
+	for (size_t i = 0; i < tables.size(); ++i)
+		counts.Merge(tables[i]);
+}
+
+
+
+// CountArgList()
+//
+// TryArgList() for --count.  Directory arguments are put aside and
+// counted together by count_dirs, unless they can be counted from the
+// tree index; everything else is done just as TryArg() would do it, in
+// order.
+
+void
+CountArgList()
+{
+	VEC_STRING dirs;
+	LIST_STRING::const_iterator p;
+
+	for (p = args_try_list.begin(); p != args_try_list.end(); ++p)
+	{
+		filetype ft;
+		StatsInc(sc_stat_calls);
+		if (options.slurp_dir_arg && check_type(*p, ft) && ft == ft_dir)
+		{
+			if (!ListFromIndex(*p, true))
+				dirs.push_back(*p);
+		}
+		else
+			TryArg(*p, true);
+	}
+
+	count_dirs(dirs).Run();
+}
+
+
+
+// TryArgList()
+//
+// Processes every saved argument in args_try_list.
+
+void
+TryArgList(bool keep_path)
+{
+	if (options.count_only && args_try_list.size() > 1)
+	{
+		CountArgList();
+		return;
+	}
+
+	LIST_STRING::const_iterator p;
+	for (p = args_try_list.begin(); p != args_try_list.end(); ++p)
+		TryArg(*p, keep_path);
+}
+
+
+
+// LookUpName()
+//
+// For ReadNamesFrom(): finds out whether a name is a directory, and
+// gets its sort key, or its size with --sizes.  With --no-stat, a name
+// is taken to be a file without looking, unless --sizes needs a stat()
+// anyway.  Returns false, after saying so, if there is no such name.
+
+bool
+LookUpName(CSZ name, size_t len, filetype& ft, long long& key)
+{
+	ft = ft_file;
+	if (options.no_stat && !(options.count_only && options.sizes))
+		return true;
+
+	// stat() needs a NUL on the end, which the name may not have
+	thread_local string s;
+	s.assign(name, len);
+
+	StatsInc(sc_stat_calls);
+	bool b = (options.count_only && options.sizes)
+			? check_type_size(s, ft, key) : CheckTypeKey(AT_FDCWD, s, ft, key);
+	if (!b)
+		Err(s, err_str[bad_filename]);
+
+	return b;
+}
+
+
+
+// ReadNamesFrom()
+//
+// Lists the names read from a file, for --files-from.  Each one is
+// listed as a name, the way an argument is with -d: a directory is
+// listed, not read.  The names are taken in place from the file (see
+// namereader.hpp), and go straight into the buckets.
+
+void
+ReadNamesFrom(CSREF path)
+{
+	name_reader r;
+	if (!r.Open(path, options.null_names ? '\0' : '\n'))
+		ErrExit(path, err_str[bad_files_from]);
+
+	path_cache paths;
+	CSZ name;
+	size_t len;
+	while (r.Next(name, len))
+	{
+		StatsInc(sc_names_read);
+
+		filetype ft;
+		long long key = 0;
+		if (LookUpName(name, len, ft, key))
+			AddListedName(paths, name, len, ft == ft_dir, key);
+	}
+
+	if (!r.good())
+		ErrExit(path, err_str[bad_files_from]);
+}
+
+
+
+// NumericArg()
+//
+// Processes a numeric arg, and handles either a bad or missing arg.
+
+int
+NumericArg(int &i, int argc, ARGV argv, int min_val, err_strings err_msg)
+{
+	CSZ p;
+	const int i_initial = i;
+
+	// does current arg contain '=' followed by number?
+	p = index(argv[i], ch_eq);
+	if (p)
+		++p;	// point one past '='
+	else
+	{
+		// we need another arg; is there one more?
+		if (i + 1 >= argc)
+			ErrExit(argv[i], err_str[missing_arg]);
+
+		p = argv[++i];
+	}
+
+	int t;
+	bool b = ConvertAtoI(p, t);
+	if (!b)	// conversion error
+		ErrExit(argv[i_initial], err_str[err_msg]);
+
+	if (t < min_val)
+		ErrExit(argv[i_initial], err_str[err_msg]);
+
+	return t;
+}
+
+
+
+// StringArg()
+//
+// Processes a string arg, and handles a missing arg.
+
+string
+StringArg(int &i, int argc, ARGV argv)
+{
+	CSZ p;
+
+	// does current arg contain '=' followed by string?
+	p = index(argv[i], ch_eq);
+	if (p)
+		++p;	// point one past '='
+	else
+	{
+		// we need another arg; is there one more?
+		if (i + 1 >= argc)
+			ErrExit(argv[i], err_str[missing_arg]);
+
+		p = argv[++i];
+	}
+
+	return string(p);
+}
+
+
+
+// OptionalArg()
+//
+// Processes an optional string arg, which can only be given as
+// --foo=bar; returns an empty string if there isn't one.
+
+string
+OptionalArg(CSZ arg)
+{
+	CSZ p = index(arg, ch_eq);
+
+	return (p == NULL) ? string() : string(p + 1);
+}
+
+
+
+// SizeArg()
+//
+// Processes an argument that is a size in bytes, with an optional
+// suffix: K, M or G for kibibytes, mebibytes or gibibytes.
+
+long
+SizeArg(int &i, int argc, ARGV argv, err_strings err_msg)
+{
+	const int i_initial = i;
+	string s = StringArg(i, argc, argv);
+	CSZ p = s.c_str();
+	char *pend;
+
+	long n = strtol(p, &pend, 10);
+	long unit = 1;
+	if (*pend == 'k' || *pend == 'K')
+		unit = 1024L;
+	else if (*pend == 'm' || *pend == 'M')
+		unit = 1024L * 1024;
+	else if (*pend == 'g' || *pend == 'G')
+		unit = 1024L * 1024 * 1024;
+	if (unit != 1)
+		++pend;
+
+	if (pend == p || *pend != ch_nul || n < 1 || n > LONG_MAX / unit)
+		ErrExit(argv[i_initial], err_str[err_msg]);
+
+	return n * unit;
+}
+
+
+
+// FormatArg()
+//
+// Processes the argument to --format, and handles a bad format name.
+// The format names are not translated; they are meant for scripts.
+
+out_format
+FormatArg(int &i, int argc, ARGV argv)
+{
+	const int i_initial = i;
+	string s = StringArg(i, argc, argv);
+
+	if (s == "text")
+		return fmt_text;
+	else if (s == "null")
+		return fmt_null;
+	else if (s == "jsonl")
+		return fmt_jsonl;
+	else if (s == "bin")
+		return fmt_bin;
+
+	ErrExit(argv[i_initial], err_str[bad_format]);
+	return fmt_text;	// impossible to reach here
+}
+
+
+
+// SortKeyArg()
+//
+// Processes the argument to --sort.  Like the format names, the key
+// names are not translated.
+
+sort_key
+SortKeyArg(int &i, int argc, ARGV argv)
+{
+	const int i_initial = i;
+	string s = StringArg(i, argc, argv);
+
+	if (s == "name")
+		return key_name;
+	else if (s == "size")
+		return key_size;
+	else if (s == "mtime")
+		return key_mtime;
+
+	ErrExit(argv[i_initial], err_str[bad_sort_key]);
+	return key_name;	// impossible to reach here
+}
+
+
+
+// JsonArg()
+//
+// Processes the optional argument to --stats or --count, which picks
+// text or JSON.  Returns true for JSON.
+
+bool
+JsonArg(CSZ arg, err_strings err_msg)
+{
+	CSZ p = index(arg, ch_eq);
+	if (p == NULL)
+		return false;	// just --stats
+
+	if (strcmp(p + 1, "json") == 0)
+		return true;
+	else if (strcmp(p + 1, "text") == 0)
+		return false;
+
+	ErrExit(arg, err_str[err_msg]);
+	return false;	// impossible to reach here
+}
+
+
+
+// ColorArg()
+//
+// Processes the optional argument to --color: always, auto or never,
+// with the other words ls takes for them.  Just --color is always.
+
+color_when
+ColorArg(CSZ arg)
+{
+	CSZ p = index(arg, ch_eq);
+	if (p == NULL)
+		return color_always;
+	++p;
+
+	if (strcmp(p, "always") == 0 || strcmp(p, "yes") == 0
+			|| strcmp(p, "force") == 0)
+		return color_always;
+	else if (strcmp(p, "never") == 0 || strcmp(p, "no") == 0
+			|| strcmp(p, "none") == 0)
+		return color_never;
+	else if (strcmp(p, "auto") == 0 || strcmp(p, "tty") == 0
+			|| strcmp(p, "if-tty") == 0)
+		return color_auto;
+
+	ErrExit(arg, err_str[bad_color]);
+	return color_never;	// impossible to reach here
+}
+
+
+
+// option table
+//
+// Every option has a short and a long form in arg_str[], which come in
+// pairs: the short form at an even index, the long form right after it.
+// BuildOptionTable() puts all the forms for the user's language into a
+// perfect hash table, which maps each form onto the index of the short
+// form; so matching an argument against all the options costs one hash
+// lookup.  The table is only built the first time an argument that
+// looks like an option turns up; "lf" with no options never needs it.
+//
+// options_with_arg[] lists the options that take an argument, and
+// options_with_optional_arg[] the ones that may take one.  An optional
+// argument can only be given as --foo=bar.
+
+const arg_strings options_with_arg[] =
+{
+	ext_width_s, ext_limit_s, line_width_s, margin_s, name_sep_s,
+	repl_spaces_s, verbose_s, format_s, per_ext_s, head_s, trace_s,
+	sort_by_s, mem_limit_s, save_snapshot_s, diff_s, files_from_s,
+	build_index_s, index_s,
+};
+
+const int options_with_arg_max =
+		sizeof(options_with_arg) / sizeof(options_with_arg[0]);
+
+const arg_strings options_with_optional_arg[] =
+{
+	stats_s, count_s, sizes_s, color_s, compound_s,
+};
+
+const int options_with_optional_arg_max =
+		sizeof(options_with_optional_arg) / sizeof(options_with_optional_arg[0]);
+
+enum option_arg { arg_none, arg_required, arg_optional };
+
+perfect_hash option_table;
+option_arg option_takes_arg[ARG_STRINGS_MAX];
+
+const int no_option = -1;
+
+
+
+// BuildOptionTable()
+//
+// Builds the option table from arg_str[].  Must be called after
+// SetStrings().
+
+void
+BuildOptionTable()
+{
+	for (int i = 0; i < ARG_STRINGS_MAX; ++i)
+	{
+		if (NonEmptySz(arg_str[i]))
+			option_table.Add(arg_str[i], i);
+	}
+
+	bool b = option_table.Build();
+	Assert(b);	// false means two options have the same name
+
+	for (int i = 0; i < options_with_arg_max; ++i)
+	{
+		option_takes_arg[options_with_arg[i]] = arg_required;
+		option_takes_arg[options_with_arg[i] + 1] = arg_required;
+	}
+
+	for (int i = 0; i < options_with_optional_arg_max; ++i)
+	{
+		option_takes_arg[options_with_optional_arg[i]] = arg_optional;
+		option_takes_arg[options_with_optional_arg[i] + 1] = arg_optional;
+	}
+}
+
+
+
+// LookupOption()
+//
+// Checks an argument to see if it is one of the options.  Returns the
+// short form of the matching option (the even member of its pair in
+// arg_strings), or no_option.
+//
+// An option that takes an argument may be given in the long form as
+// --foo=bar; the long form without the "=" is an error.  The short form
+// is always given as -X bar.
 
 int
-NumericArg(int &i, int argc, ARGV argv, int min_val, err_strings err_msg)
+LookupOption(CSZ arg)
+{
+	if (!option_table.built())
+		BuildOptionTable();
+
+	int i = option_table.Lookup(arg);
+	if (i != no_option)
+	{
+		bool is_long = (i & 1);
+		if (is_long && option_takes_arg[i] == arg_required)
+			ErrExit(arg, err_str[bad_long_opt]);
+
+		return i & ~1;
+	}
+
+	// maybe --long-option=<whatever>
+	CSZ p = index(arg, ch_eq);
+	if (p == NULL)
+		return no_option;
+
+	i = option_table.Lookup(arg, p - arg);
+	if (i == no_option || !(i & 1) || option_takes_arg[i] == arg_none)
+		return no_option;
+
+	return i & ~1;
+}
+
+
+
+// DoSetOptions() and SetOptions()
+//
+// Loops through all command-line options.  Sets options flags
+// accordingly.  Anything that doesn't match as a flag is appended to
+// args_try_list for later.  An argument that doesn't start with a dash
+// can't be an option, so it goes straight to the list; and after an
+// argument of "--", everything goes straight to the list.
+//
+// The actual work is done by DoSetOptions(), which processes all
+// arguments it receives.  With the usual argc/argv that the main()
+// function gets, the program name will be the first option, so
+// SetOptions() skips that first option and then calls DoSetOptions().
+//
+// Call SetOptions() when you want the first arg skipped, and call
+// DoSetOptions() when you don't.
+
+void
+DoSetOptions(int argc, ARGV argv)
+{
+	bool end_of_options = false;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		CSZ arg = argv[i];
+
+		if (end_of_options || arg[0] != ch_dash)
+		{
+			// if it's not a command-line switch, try it as a file argument
+			args_try_list.push_back(arg);
+			continue;
+		}
+
+		if (arg[1] == ch_dash && arg[2] == ch_nul)
+		{
+			end_of_options = true;	// "--"
+			continue;
+		}
+
+		switch (LookupOption(arg))
+		{
+		case help_s:
+			PrintStrings(out, usage_strings, usage_strings_max, 0);
+			break;
+
+		case license_s:
+			PrintStrings(out, license_strings, license_strings_max, 0);
+			break;
+
+		case version_s:
+			PrintStrings(out, version_strings, version_strings_max, 0);
+			break;
+
+		case ascii_s:
+			options.sort = sort_ascii;
+			break;
+
+		case ascii_ic_s:
+			options.sort = sort_ascii_ic;
+			break;
+
+		case locale_s:
+			options.sort = sort_locale;
+			break;
+
+		case dir_s:
+			options.slurp_dir_arg = false;
+			break;
+
+		case ext_width_s:
+			options.ext_width = NumericArg(i, argc, argv, 1, need_ge_one);
+			options.ext_width_set = true;
+			break;
+
+		case ext_limit_s:
+			options.ext_limit = NumericArg(i, argc, argv, 1, need_ge_one);
+			break;
+
+		case force_lower_s:
+			options.force_lower = true;
+			break;
+
+		case line_width_s:
+			options.line_width = NumericArg(i, argc, argv, 1, need_ge_one);
+			break;
+
+		case margin_s:
+			options.line_margin = NumericArg(i, argc, argv, 0, need_ge_zero);
+			break;
+
+		case show_all_s:
+			options.show_all = true;
+			break;
+
+		case name_sep_s:
+			options.name_separator = StringArg(i, argc, argv);
+			break;
+
+		case repl_spaces_s:
+			options.s_replace_space = StringArg(i, argc, argv);
+			if (options.s_replace_space.compare(s_space) == 0)
+				options.replace_spaces = false;	// replacement is a space!
+			else
+				options.replace_spaces = true;
+			break;
+
+		case verbose_s:
+			options.verbose_level = NumericArg(i, argc, argv, 0, need_ge_zero);
+			break;
+
+		case format_s:
+			options.format = FormatArg(i, argc, argv);
+			break;
+
+		case sort_by_s:
+			options.sort_by = SortKeyArg(i, argc, argv);
+			break;
+
+		case reverse_s:
+			options.reverse = true;
+			break;
+
+		case natural_s:
+			options.natural = true;
+			break;
+
+		case gitignore_s:
+			options.gitignore = true;
+			break;
+
+		case mem_limit_s:
+			options.mem_limit = SizeArg(i, argc, argv, bad_mem_limit);
+			break;
+
+		case archives_s:
+			options.archives = true;
+			break;
+
+		case files_from_s:
+			options.files_from = StringArg(i, argc, argv);
+			break;
+
+		case null_names_s:
+			options.null_names = true;
+			break;
+
+		case no_stat_s:
+			options.no_stat = true;
+			break;
+
+		case build_index_s:
+			options.build_index = StringArg(i, argc, argv);
+			break;
+
+		case index_s:
+			options.index_path = StringArg(i, argc, argv);
+			break;
+
+		case index_check_s:
+			options.index_check = true;
+			break;
+
+		case compound_s:
+			options.compound = true;
+			options.compound_path = OptionalArg(argv[i]);
+			break;
+
+		case no_compound_s:
+			options.compound = false;
+			break;
+
+		case save_snapshot_s:
+			options.snapshot_path = StringArg(i, argc, argv);
+			break;
+
+		case diff_s:
+			options.diff_path = StringArg(i, argc, argv);
+			break;
+
+		case per_ext_s:
+			options.per_ext_limit = NumericArg(i, argc, argv, 0, need_ge_zero);
+			break;
+
+		case head_s:
+			options.head_limit = NumericArg(i, argc, argv, 0, need_ge_zero);
+			break;
+
+		case timing_s:
+			options.timing = true;
+			break;
+
+		case color_s:
+			options.color = ColorArg(argv[i]);
+			break;
+
+		case stats_s:
+			options.stats = true;
+			options.stats_json = JsonArg(argv[i], bad_stats);
+			break;
+
+		case count_s:
+			options.count_only = true;
+			options.count_json = JsonArg(argv[i], bad_count);
+			break;
+
+		case sizes_s:
+			options.count_only = true;
+			options.sizes = true;
+			options.count_json = JsonArg(argv[i], bad_sizes);
+			break;
+
+		case trace_s:
+			options.trace_path = StringArg(i, argc, argv);
+			break;
+
+		default:
+			// if it's not a command-line switch, try it as a file argument
+			args_try_list.push_back(arg);
+			break;
+		}
+	}
+}
+
+
+
+void
+SetOptions(int argc, ARGV argv)
+{
+	if (argc <= 0)
+		return;
+
+	options.progname = argv[0];
+
+	DoSetOptions(argc - 1, argv + 1);	// skip argv[0]
+}
+
+
+
+// ReadEnvOptions()
+//
+// Checks for an environment variable called LFOPTS; if it's found,
+// parses it for options and sets them accordingly.
+//
+// Builds an "argv" array, and passes it to DoSetOptions().  Thus the
+// argument processing is identical to the command-line argument
+// processing, as it's done by the same code.
+//
+// LFOPTS is split into words by the shellword class, which handles
+// quotes and $VAR substitution without globbing.  Build with WORDEXP=1
+// to use the C wordexp() function instead, as older versions did.
+
+void
+ReadEnvOptions()
+{
+	CSZ lfopts = getenv(LF_LFOPTS);
+
+	if (lfopts == NULL)
+		return;
+
+	options.lfopts = lfopts;
+
+#ifdef LF_USE_WORDEXP
+	wordexp w(lfopts);
+#else
+	shellword w(lfopts);
+#endif
+
+	if (w.success())
+		DoSetOptions(w.argc(), w.argv());
+	else
+		ErrExit(err_str[bad_lfopts]);
+}
+
+
+
+// PrintReportAboutOptions()
+//
+// Used when the user requests verbose output.
+
+void
+PrintReportAboutOptions()
+{
+	if (options.lfopts.length() > 0)
+		out << verbose_str[v_lfopts] << "[" << options.lfopts << "]" << '\n';
+
+	if (options.sort == sort_ascii)
+		out << verbose_str[v_sort_ascii] << '\n';
+	else if (options.sort == sort_ascii_ic)
+		out << verbose_str[v_sort_ascii_ic] << '\n';
+	else 
+	{
+		Assert(options.sort == sort_locale);
+		out << verbose_str[v_sort_locale] << def_locale.name() << '\n';
+	}
+	if (options.natural)
+		out << verbose_str[v_natural] << '\n';
+	if (options.sort_by == key_size)
+		out << verbose_str[v_sort_by] << "size" << '\n';
+	else if (options.sort_by == key_mtime)
+		out << verbose_str[v_sort_by] << "mtime" << '\n';
+	if (options.reverse)
+		out << verbose_str[v_reverse] << '\n';
+	
+	out << verbose_str[v_line_width] << options.line_width << '\n';
+	if (options.line_margin != 0)
+		out << verbose_str[v_margin] << options.line_margin << '\n';
+	out << verbose_str[v_ext_limit] << options.ext_limit << '\n';
+	if (options.compound)
+		out << verbose_str[v_compound] << long(compound_exts.size()) << '\n';
+	out << verbose_str[v_ext_width] << options.ext_width << '\n';
+	if (options.per_ext_limit)
+		out << verbose_str[v_per_ext] << options.per_ext_limit << '\n';
+	if (options.head_limit)
+		out << verbose_str[v_head] << options.head_limit << '\n';
+	if (options.mem_limit)
+		out << verbose_str[v_mem_limit] << options.mem_limit << '\n';
+
+	if (options.name_separator.compare(s_space) != 0)
+		out << verbose_str[v_name_sep] << "["
+				<< options.name_separator << "]" << '\n';
+	if (options.replace_spaces)
+		out << verbose_str[v_repl_spaces] << "["
+				<< options.s_replace_space << "]" << '\n';
+
+	if (options.force_lower)
+		out << verbose_str[v_force_lower] << '\n';
+	if (options.show_all)
+		out << verbose_str[v_show_all] << '\n';
+	if (options.gitignore)
+		out << verbose_str[v_gitignore] << '\n';
+	if (!options.files_from.empty())
+		out << verbose_str[v_files_from] << options.files_from << '\n';
+	if (options.archives)
+		out << verbose_str[v_archives] << '\n';
+	if (options.color == color_always)
+		out << verbose_str[v_color] << '\n';
+	if (!options.index_path.empty())
+		out << verbose_str[v_index] << options.index_path << '\n';
+	if (options.slurp_dir_arg == false)
+		out << verbose_str[v_dir] << '\n';
+
+	out << '\n';
+}
+
+
+
+// color
+//
+// With --color, LS_COLORS is parsed once, into colors (see
+// lscolors.hpp).  Each line of the listing then looks up its color once,
+// from its extension, and its label and names are printed in that
+// color; only a line that LineColor() says needs it looks up each name.
+
+ls_colors colors;
+
+
+
+// SetUpColor()
+//
+// Settles --color=auto (only on a terminal that can show colors), and
+// parses LS_COLORS.  Only the text listing is colored.
+
+void
+SetUpColor()
+{
+	if (options.format != fmt_text)
+		options.color = color_never;
+
+	if (options.color == color_auto)
+	{
+		CSZ term = getenv("TERM");
+		bool tty = isatty(1) && NonEmptySz(term) && strcmp(term, "dumb") != 0;
+		options.color = tty ? color_always : color_never;
+	}
+
+	if (options.color == color_always && !colors.Parse(getenv("LS_COLORS")))
+	{
+		Err("LS_COLORS", err_str[bad_ls_colors]);
+		options.color = color_never;
+	}
+}
+
+
+
+// LineColor()
+//
+// The color of a line of the listing: of the directories, or of the
+// files with the extension ext.  per_name is set if some names in the
+// line may need colors of their own, from NameColor().
+
+CSREF
+LineColor(lfbin_kind kind, CSREF ext, bool& per_name)
+{
+	per_name = false;
+	if (options.color != color_always)
+		return s_empty;
+
+	if (kind == lfbin_dir)
+		return colors.dir();
+
+	return colors.ExtColor(ext, per_name);
+}
+
+
+
+// NameColor()
+//
+// The color of one name in a line of files with the extension ext.  The
+// name is put back together from its basename and extension, and only
+// its last component is looked at.
+
+CSREF
+NameColor(CSREF basename, CSREF ext)
+{
+	thread_local string name;
+
+	const size_t i = basename.rfind(dir_sep_char);
+	name.assign(basename, (i == string::npos) ? 0 : i + 1, string::npos);
+	if (!ext.empty())
+	{
+		name += ch_dot;
+		if (ext != s_dot)
+			name += ext;
+	}
+
+	return colors.NameColor(name.data(), name.length());
+}
+
+
+
+// LenAppend()
+//
+// Appends a string to an output buffer, with an optional minimum width;
+// then returns how many characters were appended.  Like a field printed
+// with cout.width(), a short string is padded with spaces on the left.
+// If color isn't empty, the string is wrapped in it and colors.end();
+// the escape sequences take no room on the screen, so they aren't
+// counted.
+
+int
+LenAppend(string& buf, CSREF s, int min_width = 0, CSREF color = s_empty)
+{
+	int len = s.length();
+
+	if (min_width && min_width > len)
+	{
+		buf.append(min_width - len, ch_space);
+		len = min_width;
+	}
+
+	if (color.empty())
+		buf.append(s);
+	else
+	{
+		buf.append(color);
+		buf.append(s);
+		buf.append(colors.end());
+	}
+
+	return len;
+}
+
+
+
+// MoreString()
+//
+// Returns the "+12345 more" note printed when names or extension lines
+// have been left out because of a limit.
+
+string
+MoreString(long count)
 {
-	CSZ p;
-	const int i_initial = i;
+	char buf[32];
 
-	// does current arg contain '=' followed by number?
-	p = index(argv[i], ch_eq);
-	if (p)
-		++p;	// point one past '='
-	else
+	snprintf(buf, sizeof(buf), "+%ld ", count);
+
+	return string(buf) + more_str;
+}
+
+
+
+// AppendBasename()
+//
+// Lays out one basename as part of a line of basenames, starting a new
+// line first if the name would not fit.  width and need_separator carry
+// the state of the line from one call to the next.
+//
+// Tries not to break basenames across multiple lines, but for a
+// basename that is longer than the available line width, it has to.
+// A color (see LineColor()) only adds escape sequences, so the width is
+// worked out from the name alone.
+
+void
+AppendBasename(string& buf, int& width, bool& need_separator, CSREF name,
+		CSREF color = s_empty)
+{
+	const int gap_width = options.ext_width + options.ext_separator.length();
+
+	int len = name.length();
+	if (need_separator)
+		len += options.name_separator.length();
+
+	// if file name is too long for current line...
+	// ...and we would get more room with a new line...
+	// ... then start a new line.  If width == gap_width
+	// or even somehow got shorter than gap_width, no point in
+	// starting a new line.
+
+	if (width + len > options.width() && width > gap_width)
 	{
-		// we need another arg; is there one more?
-		if (i + 1 >= argc)
-			ErrExit(argv[i], err_str[missing_arg]);
+		buf += '\n';	// start new line
+		width = 0;
 
-		p = argv[++i];
+		// lay out gap to make basename lines line up
+		width += LenAppend(buf, s_empty, gap_width);
+
+		need_separator = false;	// new line; don't need a sep yet
 	}
 
-	int t;
-	bool b = ConvertAtoI(p, t);
-	if (!b)	// conversion error
-		ErrExit(argv[i_initial], err_str[err_msg]);
+	if (need_separator)
+		width += LenAppend(buf, options.name_separator);
 
-	if (t < min_val)
-		ErrExit(argv[i_initial], err_str[err_msg]);
+	width += LenAppend(buf, name, 0, color);
+	need_separator = true;
+}
 
-	return t;
+
+
+// FormatLine()
+//
+// Lays out one line of the listing (which may wrap onto several lines
+// of output): the label, right-justified to options.ext_width, then
+// the sorted basenames.  If the bucket had to leave out some names, a
+// note saying how many goes at the end.  kind says whether the line is
+// of directories, or of files with the extension label.
+
+void
+FormatLine(string& buf, lfbin_kind kind, CSREF label, bucket& b)
+{
+	int width = 0;
+	bool need_separator = false;
+	// We don't need to print a name separator until after we have printed
+	// at least one basename on any line.
+
+	trace_span span("format", label);
+
+	bool per_name;
+	CSREF color = LineColor(kind, label, per_name);
+
+	width += LenAppend(buf, label, options.ext_width, color);
+	width += LenAppend(buf, options.ext_separator);
+
+	b.Finish();
+
+	string full;
+	VEC_STRING::const_iterator p;
+	for (p = b.names.begin(); p != b.names.end(); ++p)
+	{
+		CSREF name = FullName(*p, full);
+
+		AppendBasename(buf, width, need_separator, name,
+				per_name ? NameColor(name, label) : color);
+	}
+
+	if (b.Dropped() > 0)
+		AppendBasename(buf, width, need_separator, MoreString(b.Dropped()));
+
+	buf += '\n';
 }
 
 
 
-// StringArg()
+// output pipeline
 //
-// Processes a string arg, and handles a missing arg.
+// Sorting a bucket and laying out its line don't depend on any other
+// bucket, so PrintFilenames() hands every line of the listing to a pool
+// of worker threads as an output_job.  The workers take jobs in listing
+// order; each sorts its bucket and lays the line out into the job's own
+// buffer.  Meanwhile the main thread writes the finished buffers out in
+// listing order, waiting for a job only if it isn't done yet.  So the
+// sort of one bucket overlaps with writing out the ones before it, and
+// with many extensions the time is about the time of the biggest bucket.
+//
+// For a small listing, starting threads would cost more than it saves,
+// so the jobs are simply done one after another.
 
-string
-StringArg(int &i, int argc, ARGV argv)
+const long pipeline_min_names = 20000;	// fewer names: no threads
+const unsigned pipeline_max_workers = 16;
+
+struct output_job
 {
-	CSZ p;
+	lfbin_kind kind;	// a line of directories, or of files
+	string label;	// extension, or dirs_str
+	PBUCKET pbucket;
+	string text;	// the laid-out line(s)
+	bool done;
+};
 
-	// does current arg contain '=' followed by string?
-	p = index(argv[i], ch_eq);
-	if (p)
-		++p;	// point one past '='
+typedef vector<output_job> VEC_OUTPUT_JOB;
+
+class output_pipeline
+{
+	private:
+		VEC_OUTPUT_JOB& jobs;
+		size_t next_job;	// next job for a worker to take
+		mutex mtx;
+		condition_variable cv_done;
+
+		void Worker();
+
+	public:
+		output_pipeline(VEC_OUTPUT_JOB& jobs_to_do)
+				: jobs(jobs_to_do), next_job(0) {}
+
+		void Run(unsigned workers);
+};
+
+
+
+// output_pipeline::Worker()
+//
+// Body of each worker thread: take the next job, do it, repeat.
+
+void
+output_pipeline::Worker()
+{
+	TraceThreadName("worker");
+	trace_span span("worker");
+
+	for (;;)
+	{
+		size_t i;
+		{
+			lock_guard<mutex> lock(mtx);
+			if (next_job == jobs.size())
+				return;
+			i = next_job++;
+		}
+
+		output_job& job = jobs[i];
+		FormatLine(job.text, job.kind, job.label, *job.pbucket);
+
+		{
+			lock_guard<mutex> lock(mtx);
+			job.done = true;
+		}
+		cv_done.notify_all();
+	}
+}
+
+
+
+// output_pipeline::Run()
+//
+// Starts the workers, and writes out each job's buffer as soon as it
+// and all the jobs before it are done.  With no workers, the jobs are
+// done right here.
+
+void
+output_pipeline::Run(unsigned workers)
+{
+	vector<thread> threads;
+
+	for (unsigned n = 0; n < workers; ++n)
+		threads.push_back(thread(&output_pipeline::Worker, this));
+
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		output_job& job = jobs[i];
+
+		if (workers == 0)
+			FormatLine(job.text, job.kind, job.label, *job.pbucket);
+		else
+		{
+			unique_lock<mutex> lock(mtx);
+			while (!job.done)
+				cv_done.wait(lock);
+		}
+
+		out.puts(job.text);
+		string().swap(job.text);	// free the buffer now
+	}
+
+	for (size_t n = 0; n < threads.size(); ++n)
+		threads[n].join();
+}
+
+
+
+// PrintFilenames()
+//
+// Print all filenames in the terse format.  If options.head_limit is
+// set, only that many extension lines are printed, and a last line
+// says how many were left out.
+
+void
+PrintFilenames()
+{
+	VEC_OUTPUT_JOB jobs;
+	long names = 0;
+	output_job job;
+
+	job.done = false;
+
+	if (dirs_bucket.seen > 0)	// any dirs saved in bucket?
+	{
+		// we have dirs to output, so output the DIRS line at top
+		job.kind = lfbin_dir;
+		job.label = dirs_str;
+		job.pbucket = &dirs_bucket;
+		jobs.push_back(job);
+		names += dirs_bucket.seen;
+	}
+
+	int lines = 0;
+	SET_STRING::const_iterator p;
+	for (p = ext_set.begin(); p != ext_set.end(); ++p, ++lines)
+	{
+		if (options.head_limit && lines == options.head_limit)
+			break;
+
+		job.kind = lfbin_file;
+		job.label = *p;
+		job.pbucket = ext_map[*p];
+		jobs.push_back(job);
+		names += job.pbucket->seen;
+	}
+	const long lines_left_out = ext_set.size() - lines;
+
+	unsigned workers = 0;
+	if (names >= pipeline_min_names && jobs.size() > 1)
+	{
+		workers = thread::hardware_concurrency();
+		workers = min(workers, pipeline_max_workers);
+		workers = min<unsigned>(workers, jobs.size());
+	}
+
+	output_pipeline pipeline(jobs);
+	pipeline.Run(workers);
+
+	if (lines_left_out > 0)
+	{
+		string buf;
+		LenAppend(buf, "...", options.ext_width);
+		LenAppend(buf, options.ext_separator);
+		LenAppend(buf, MoreString(lines_left_out));
+		buf += '\n';
+		out.puts(buf);
+	}
+
+	out.flush();
+}
+
+
+
+// PrintRecord()
+//
+// Prints one (kind, extension, basename) record in the format chosen
+// by options.format.
+
+void
+PrintRecord(lfbin_kind kind, CSREF ext, CSREF basename)
+{
+	CSZ kind_name = (kind == lfbin_dir) ? "dir" : "file";
+
+	if (options.format == fmt_null)
+	{
+		// three NUL-terminated fields per record
+		out.puts(kind_name);
+		out.put(ch_nul);
+		out.puts(ext);
+		out.put(ch_nul);
+		out.puts(basename);
+		out.put(ch_nul);
+	}
+	else if (options.format == fmt_jsonl)
+	{
+		out.puts("{\"kind\":\"");
+		out.puts(kind_name);
+		out.puts("\",\"ext\":");
+		PutJsonString(out, ext);
+		out.puts(",\"name\":");
+		PutJsonString(out, basename);
+		out.puts("}\n");
+	}
 	else
 	{
-		// we need another arg; is there one more?
-		if (i + 1 >= argc)
-			ErrExit(argv[i], err_str[missing_arg]);
+		Assert(options.format == fmt_bin);
+		PutLfbinRecord(out, kind, ext, basename);
+	}
+}
 
-		p = argv[++i];
+
+
+// PrintLfbinHeader()
+//
+// The header that starts a --format=bin listing.
+
+void
+PrintLfbinHeader(outbuf& o, uint64_t count)
+{
+	unsigned char header[lfbin_header_len];
+
+	memcpy(header, LFBIN_MAGIC, 4);
+	PutLE32(header + 4, lfbin_version);
+	PutLE64(header + 8, count);
+
+	o.write(header, sizeof(header));
+}
+
+
+
+// PrintRecords()
+//
+// Print all filenames as records in a machine-readable format.  This
+// works straight from the buckets, so none of the line-wrapping logic in
+// PrintBasenames() is involved.  Limits are honored, but there are no
+// records for the names left out.
+
+void
+PrintRecords()
+{
+	SET_STRING::const_iterator p;
+	VEC_STRING::const_iterator q;
+
+	// only the first options.head_limit extensions are printed
+	SET_STRING::const_iterator p_end = ext_set.begin();
+	for (int lines = 0; p_end != ext_set.end(); ++p_end, ++lines)
+		if (options.head_limit && lines == options.head_limit)
+			break;
+
+	dirs_bucket.Finish();
+	for (p = ext_set.begin(); p != p_end; ++p)
+		ext_map[*p]->Finish();
+
+	if (options.format == fmt_bin)
+	{
+		uint64_t count = dirs_bucket.names.size();
+		for (p = ext_set.begin(); p != p_end; ++p)
+			count += ext_map[*p]->names.size();
+
+		PrintLfbinHeader(out, count);
 	}
 
-	return string(p);
+	string full;
+	for (q = dirs_bucket.names.begin(); q != dirs_bucket.names.end(); ++q)
+		PrintRecord(lfbin_dir, s_empty, FullName(*q, full));
+
+	for (p = ext_set.begin(); p != p_end; ++p)
+	{
+		const PBUCKET pbucket = ext_map[*p];
+
+		for (q = pbucket->names.begin(); q != pbucket->names.end(); ++q)
+			PrintRecord(lfbin_file, *p, FullName(*q, full));
+	}
+
+	out.flush();
 }
 
 
 
-// ArgMatches()
+// MergeRunsToOutput()
 //
-// A convenience function that checks an argument to see if it matches
-// either of two values: the short and long forms of a possible
-// flag.  If takes_arg is true, this expects a follow-on argument, and
-// if the user is using the long form, we need to look for --foo=bar form.
+// Does the work of PrintMerged(): merges the runs, and prints each line
+// of the listing (or each record) as the names for it come out of the
+// merge, so that only one name at a time is in memory.  Duplicates and
+// per_ext_limit are dealt with the same way bucket::Finish() deals with
+// them: with a limit, each run has at most that many names for each
+// line, and the first ones out of the merge are the ones a bucket would
+// have kept; the bucket's count of names seen, still in memory, less
+// the names printed and their repeats from other runs, says how many
+// were left out.  If print is false, nothing is printed; this
+// just returns how many names would be.
+
+long
+MergeRunsToOutput(bool print)
+{
+	trace_span span("merge");
+	run_merge merge(run_fds);
+	const long limit = options.per_ext_limit;
+	const bool text = (options.format == fmt_text);
 
-inline bool
-NonEmptySz(CSZ csz)
+	long printed = 0;
+	int lines = 0;
+
+	while (!merge.Done())
+	{
+		const lfbin_kind kind = merge.Top().kind;
+		const string ext = merge.Top().ext;
+
+		if (kind == lfbin_file)
+		{
+			if (options.head_limit && lines == options.head_limit)
+				break;
+			++lines;
+		}
+
+		string buf;
+		int width = 0;
+		bool need_separator = false;
+		bool per_name = false;
+		CSREF color = (text && print) ? LineColor(kind, ext, per_name)
+				: s_empty;
+		if (text && print)
+		{
+			CSREF label = (kind == lfbin_dir) ? string(dirs_str) : ext;
+			width += LenAppend(buf, label, options.ext_width, color);
+			width += LenAppend(buf, options.ext_separator);
+		}
+
+		// names in this line, repeats of them from other runs, and the
+		// last one printed
+		long added = 0;
+		long repeats = 0;
+		string last;
+
+		for (; !merge.Done(); merge.Pop())
+		{
+			const run_reader& r = merge.Top();
+			if (r.kind != kind || r.ext != ext)
+				break;
+
+			if (added > 0 && EquivalentNames()(last, r.name))
+			{
+				++repeats;
+				continue;
+			}
+			if (limit && added == limit)
+				continue;
+			++added;
+			last = r.name;
+			++printed;
+
+			if (!print)
+				continue;
+			if (!text)
+			{
+				PrintRecord(kind, ext, r.name);
+				continue;
+			}
+
+			AppendBasename(buf, width, need_separator, r.name,
+					per_name ? NameColor(r.name, ext) : color);
+			if (buf.length() >= 64 * 1024)
+			{
+				out.puts(buf);
+				buf.clear();
+			}
+		}
+
+		if (text && print)
+		{
+			const bucket& b = (kind == lfbin_dir) ? dirs_bucket
+					: *ext_map[ext];
+			const long dropped = limit ? b.seen - added - repeats : 0;
+			if (dropped > 0)
+				AppendBasename(buf, width, need_separator,
+						MoreString(dropped));
+			buf += '\n';
+			out.puts(buf);
+		}
+	}
+
+	const long lines_left_out = ext_set.size() - lines;
+	if (text && print && lines_left_out > 0)
+	{
+		string buf;
+		LenAppend(buf, "...", options.ext_width);
+		LenAppend(buf, options.ext_separator);
+		LenAppend(buf, MoreString(lines_left_out));
+		buf += '\n';
+		out.puts(buf);
+	}
+
+	return printed;
+}
+
+
+
+// PrintMerged()
+//
+// Prints the listing, in any format, when some names were spilled to
+// runs because of --mem-limit.  The names still in memory are spilled
+// first, so all the names are in the runs.  The output is the same as
+// PrintFilenames() or PrintRecords() would print with no limit.
+
+void
+PrintMerged()
 {
-	// returns true if csz is a non-NULL pointer to a non-empty string
-	return csz && csz[0] != ch_nul;
+	SpillRun();
+	MergeDownToFanIn();
+
+	if (options.format == fmt_bin)
+		PrintLfbinHeader(out, MergeRunsToOutput(false));
+
+	MergeRunsToOutput(true);
+	out.flush();
 }
 
-bool
-ArgMatches(CSZ arg, arg_strings arg_string_s, arg_strings arg_string_l,
-		bool takes_arg)
+
+
+// snapshots and diffs
+//
+// --save-snapshot saves the whole listing in the --format=bin layout:
+// sorted, compact, and easy to read back with mmap().  --diff reads a
+// snapshot back and prints only the names added since it was saved, and
+// the names removed.  Both the snapshot and the finished buckets are in
+// listing order, so the diff is a merge: one pass over each, comparing
+// neighbours, with no hash of every name.  That only works if the
+// snapshot was saved with the same sort options, so the snapshot starts
+// with a record of them (see lfbin.hpp), and lf checks it before it
+// prints anything.
+
+
+
+// FinishAllBuckets()
+
+void
+FinishAllBuckets()
+{
+	dirs_bucket.Finish();
+
+	SET_STRING::const_iterator p;
+	for (p = ext_set.begin(); p != ext_set.end(); ++p)
+		ext_map[*p]->Finish();
+}
+
+
+
+// SnapshotOrder()
+//
+// The order of the records in a snapshot, as its lfbin_order record
+// gives it.  Only --sort=name can be saved, but the key is written out
+// all the same, so the record says everything the order depends on.
+
+string
+SnapshotOrder()
+{
+	return "sort=name " + OrderSignature();
+}
+
+
+
+// SaveSnapshot()
+//
+// Writes the snapshot to a new file, and renames it over the old one
+// only once it has all been written; so a job that is stopped halfway
+// never leaves a half-written snapshot for the next run to diff with.
+
+void
+SaveSnapshot(CSREF path)
 {
-	CSZ arg_s = arg_str[arg_string_s];
-	CSZ arg_l = arg_str[arg_string_l];
+	const string tmp_path = path + ".tmp";
+	SET_STRING::const_iterator p;
+	VEC_STRING::const_iterator q;
+
+	FinishAllBuckets();
 
-	if (NonEmptySz(arg_s) && strcmp(arg, arg_s) == 0)
-		return true;	// -X where X is short option
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		ErrExit(path, err_str[bad_save]);
 
-	if (takes_arg)
+	bool ok;
 	{
-		if (NonEmptySz(arg_l) && InitialMatch(arg_l, arg))
+		outbuf o(fd);
+
+		uint64_t count = 1 + dirs_bucket.names.size();
+		for (p = ext_set.begin(); p != ext_set.end(); ++p)
+			count += ext_map[*p]->names.size();
+		PrintLfbinHeader(o, count);
+		PutLfbinRecord(o, lfbin_order, s_empty, SnapshotOrder());
+
+		string full;
+		for (q = dirs_bucket.names.begin(); q != dirs_bucket.names.end(); ++q)
+			PutLfbinRecord(o, lfbin_dir, s_empty, FullName(*q, full));
+
+		for (p = ext_set.begin(); p != ext_set.end(); ++p)
 		{
-			int len = strlen(arg_l);
-			if (arg[len] == ch_eq)
-				return true;	// --long-option=<whatever>
-			else
-				ErrExit(arg, err_str[bad_long_opt]);
+			const PBUCKET pbucket = ext_map[*p];
+
+			for (q = pbucket->names.begin(); q != pbucket->names.end(); ++q)
+				PutLfbinRecord(o, lfbin_file, *p, FullName(*q, full));
 		}
-	}
-	else
-		if (NonEmptySz(arg_l) && strcmp(arg, arg_l) == 0)
-			return true;	// --X where X is long option
 
+		ok = o.flush();
+	}
 
-	return false;
+	ok = (close(fd) == 0) && ok;
+	if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+	{
+		unlink(tmp_path.c_str());
+		ErrExit(path, err_str[bad_save]);
+	}
 }
 
 
 
-// DoSetOptions() and SetOptions()
-//
-// Loops through all command-line options.  Sets options flags
-// accordingly.  Anything that doesn't match as a flag is appended to
-// args_try_list for later.
-//
-// The actual work is done by DoSetOptions(), which processes all
-// arguments it receives.  With the usual argc/argv that the main()
-// function gets, the program name will be the first option, so
-// SetOptions() skips that first option and then calls DoSetOptions().
+// CompareLines()
+// CompareNames()
 //
-// Call SetOptions() when you want the first arg skipped, and call
-// DoSetOptions() when you don't.
+// Three-way comparisons in listing order: of the lines (directories
+// first, then the extensions), and of the names within a line.
 
-void
-DoSetOptions(int argc, ARGV argv)
+int
+CompareLines(lfbin_kind kind0, CSREF ext0, lfbin_kind kind1, CSREF ext1)
 {
-	for (int i = 0; i < argc; ++i)
-	{
-		CSZ arg = argv[i];
+	if (kind0 != kind1)
+		return (kind0 == lfbin_dir) ? -1 : 1;
 
-		if (ArgMatches(arg, help_s, help_l, false))
-			PrintStrings(cout, usage_strings, usage_strings_max, 0);
+	mycompare cmp;
+	if (cmp(ext0, ext1))
+		return -1;
+	if (cmp(ext1, ext0))
+		return 1;
+	return 0;
+}
 
-		else if (ArgMatches(arg, license_s, license_l, false))
-			PrintStrings(cout, license_strings, license_strings_max, 0);
 
-		else if (ArgMatches(arg, version_s, version_l, false))
-			PrintStrings(cout, version_strings, version_strings_max, 0);
 
-		else if (ArgMatches(arg, ascii_s, ascii_l, false))
-			options.sort = sort_ascii;
+int
+CompareNames(CSREF name0, CSREF name1)
+{
+	name_order cmp;
 
-		else if (ArgMatches(arg, ascii_ic_s, ascii_ic_l, false))
-			options.sort = sort_ascii_ic;
+	if (cmp(name0, name1))
+		return -1;
+	if (cmp(name1, name0))
+		return 1;
+	return 0;
+}
 
-		else if (ArgMatches(arg, locale_s, locale_l, false))
-			options.sort = sort_locale;
 
-		else if (ArgMatches(arg, dir_s, dir_l, false))
-			options.slurp_dir_arg = false;
 
-		else if (ArgMatches(arg, ext_width_s, ext_width_l, true))
-			options.ext_width = NumericArg(i, argc, argv, 1, need_ge_one);
+// snapshot_reader
+//
+// Reads the records of a snapshot.  Open() checks that the snapshot was
+// saved with the sort options in use now, so a diff never stops halfway
+// for that; Next() still checks that each record is in order after the
+// one before, as a damaged snapshot might not be.
 
-		else if (ArgMatches(arg, ext_limit_s, ext_limit_l, true))
-			options.ext_limit = NumericArg(i, argc, argv, 1, need_ge_one);
+class snapshot_reader
+{
+	private:
+		lfbin_map m;
+		string path;
+		bool have;	// is there a current record?
 
-		else if (ArgMatches(arg, force_lower_s, force_lower_l, false))
-			options.force_lower = true;
+		lfbin_kind prev_kind;
+		string prev_ext;
+		string prev_name;
 
-		else if (ArgMatches(arg, line_width_s, line_width_l, true))
-			options.line_width = NumericArg(i, argc, argv, 1, need_ge_one);
+		// not copyable
+		snapshot_reader(const snapshot_reader& rhs);
+		snapshot_reader& operator=(const snapshot_reader& rhs);
 
-		else if (ArgMatches(arg, margin_s, margin_l, true))
-			options.line_margin = NumericArg(i, argc, argv, 0, need_ge_zero);
+	public:
+		snapshot_reader() { have = false; }
 
-		else if (ArgMatches(arg, show_all_s, show_all_l, false))
-			options.show_all = true;
+		// opens the snapshot and reads its first record; exits with an
+		// error if it can't
+		void Open(CSREF snapshot_path);
 
-		else if (ArgMatches(arg, name_sep_s, name_sep_l, true))
-			options.name_separator = StringArg(i, argc, argv);
+		bool Have() const { return have; }
+		lfbin_kind Kind() const { return m.kind; }
+		CSREF Ext() const { return m.ext; }
+		CSREF Name() const { return m.name; }
 
-		else if (ArgMatches(arg, repl_spaces_s, repl_spaces_l, true))
-		{
-			options.s_replace_space = StringArg(i, argc, argv);
-			if (options.s_replace_space.compare(s_space) == 0)
-				options.replace_spaces = false;	// replacement is a space!
-			else
-				options.replace_spaces = true;
-		}
+		void Next();
+};
 
-		else if (ArgMatches(arg, name_sep_s, name_sep_l, true))
-			options.name_separator = StringArg(i, argc, argv);
 
-		else if (ArgMatches(arg, verbose_s, verbose_l, true))
-			options.verbose_level = NumericArg(i, argc, argv, 0, need_ge_zero);
 
-		else
-			// if it's not a command-line switch, try it as a file argument
-			args_try_list.push_back(arg);
-	}
+void
+snapshot_reader::Open(CSREF snapshot_path)
+{
+	path = snapshot_path;
+	if (!m.Open(path.c_str()))
+		ErrExit(path, (errno != 0) ? strerror(errno) : err_str[bad_snapshot]);
+
+	if (!m.Next())
+		ErrExit(path, err_str[bad_snapshot]);
+	if (m.kind != lfbin_order || m.name != SnapshotOrder())
+		ErrExit(path, err_str[bad_snapshot_order]);
+
+	have = m.Next();
+	if (!have && !m.good())
+		ErrExit(path, err_str[bad_snapshot]);
 }
 
 
 
 void
-SetOptions(int argc, ARGV argv)
+snapshot_reader::Next()
 {
-	if (argc <= 0)
-		return;
+	prev_kind = m.kind;
+	prev_ext.swap(m.ext);
+	prev_name.swap(m.name);
 
-	options.progname = argv[0];
+	have = m.Next();
+	if (!have)
+	{
+		if (!m.good())
+			ErrExit(path, err_str[bad_snapshot]);
+		return;
+	}
 
-	DoSetOptions(argc - 1, argv + 1);	// skip argv[0]
+	int c = (m.kind == lfbin_order) ? 1
+			: CompareLines(prev_kind, prev_ext, m.kind, m.ext);
+	if (c > 0 || (c == 0 && CompareNames(prev_name, m.name) > 0))
+		ErrExit(path, err_str[bad_snapshot]);
 }
 
 
 
-// ReadEnvOptions()
-//
-// Checks for an environment variable called LFOPTS; if it's found,
-// parses it for options and sets them accordingly.
+snapshot_reader diff_snapshot;	// for --diff
+
+
+
+// diff_line
 //
-// Builds an "argv" array, and passes it to DoSetOptions().  Thus the
-// argument processing is identical to the command-line argument
-// processing, as it's done by the same code.
+// Prints the changes in one line of the listing as they are found.  In
+// text, a line is only printed if something changed in it, and has the
+// usual layout, with "+" before each name added and "-" before each one
+// removed.  The record formats get a record for each change, with the
+// change as the first field.
 
-void
-ReadEnvOptions()
+class diff_line
 {
-	CSZ lfopts = getenv(LF_LFOPTS);
+	private:
+		lfbin_kind kind;
+		string label;	// ext, or dirs_str
+		string buf;
+		int width;
+		bool need_separator;
 
-	if (lfopts == NULL)
-		return;
+	public:
+		diff_line(lfbin_kind line_kind, CSREF ext);
 
-	options.lfopts = lfopts;
+		void Add(bool added, CSREF name);
+		void End();
+};
 
-	wordexp w(lfopts);
 
-	if (w.success())
-		DoSetOptions(w.argc(), w.argv());
-	else
-		ErrExit(err_str[bad_lfopts]);
-}
 
+diff_line::diff_line(lfbin_kind line_kind, CSREF ext)
+{
+	kind = line_kind;
+	label = (kind == lfbin_dir) ? string(dirs_str) : ext;
+	width = 0;
+	need_separator = false;
+}
 
 
-// PrintReportAboutOptions()
-//
-// Used when the user requests verbose output.
 
 void
-PrintReportAboutOptions()
+diff_line::Add(bool added, CSREF name)
 {
-	if (options.lfopts.length() > 0)
-		cout << verbose_str[v_lfopts] << "[" << options.lfopts << "]" << endl;
+	CSZ const change = added ? "added" : "removed";
+	CSZ const kind_name = (kind == lfbin_dir) ? "dir" : "file";
+	CSREF ext = (kind == lfbin_dir) ? s_empty : label;
 
-	if (options.sort == sort_ascii)
-		cout << verbose_str[v_sort_ascii] << endl;
-	else if (options.sort == sort_ascii_ic)
-		cout << verbose_str[v_sort_ascii_ic] << endl;
-	else 
+	if (options.format == fmt_null)
 	{
-		Assert(options.sort == sort_locale);
-		cout << verbose_str[v_sort_locale] << def_locale.name() << endl;
+		out << change << ch_nul << kind_name << ch_nul << ext << ch_nul
+				<< name << ch_nul;
 	}
-	
-	cout << verbose_str[v_line_width] << options.line_width << endl;
-	if (options.line_margin != 0)
-		cout << verbose_str[v_margin] << options.line_margin << endl;
-	cout << verbose_str[v_ext_limit] << options.ext_limit << endl;
-	cout << verbose_str[v_ext_width] << options.ext_width << endl;
+	else if (options.format == fmt_jsonl)
+	{
+		out << "{\"change\":\"" << change << "\",\"kind\":\""
+				<< kind_name << "\",\"ext\":";
+		PutJsonString(out, ext);
+		out << ",\"name\":";
+		PutJsonString(out, name);
+		out << "}\n";
+	}
+	else
+	{
+		if (width == 0)
+		{
+			width += LenAppend(buf, label, options.ext_width);
+			width += LenAppend(buf, options.ext_separator);
+		}
+		AppendBasename(buf, width, need_separator,
+				(added ? "+" : "-") + name);
+		if (buf.length() >= 64 * 1024)
+		{
+			out.puts(buf);
+			buf.clear();
+		}
+	}
+}
 
-	if (options.name_separator.compare(s_space) != 0)
-		cout << verbose_str[v_name_sep] << "["
-				<< options.name_separator << "]" << endl;
-	if (options.replace_spaces)
-		cout << verbose_str[v_repl_spaces] << "["
-				<< options.s_replace_space << "]" << endl;
 
-	if (options.force_lower)
-		cout << verbose_str[v_force_lower] << endl;
-	if (options.show_all)
-		cout << verbose_str[v_show_all] << endl;
-	if (options.slurp_dir_arg == false)
-		cout << verbose_str[v_dir] << endl;
 
-	cout << endl;
+void
+diff_line::End()
+{
+	if (width > 0)
+	{
+		buf += '\n';
+		out.puts(buf);
+	}
 }
 
 
 
-// LenPrint()
+// PrintDiff()
 //
-// Prints a string, with an optional minimum width; then returns how
-// many characters were printed.
+// Merges the snapshot, opened before anything was listed, with the
+// finished buckets, a line at a time, and within each line a name at a
+// time.
 
-int
-LenPrint(CSZ s, int min_width = 0)
+void
+PrintDiff(snapshot_reader& snap)
 {
-	int len = strlen(s);
+	trace_span span("diff");
 
-	if (min_width && min_width > len)
-	{
-		cout.width(min_width);
-		len = min_width;
-	}
+	FinishAllBuckets();
 
-	cout << s;
+	// the lines of the listing now, in order
+	vector<pair<lfbin_kind, string> > lines;
+	if (!dirs_bucket.names.empty())
+		lines.push_back(make_pair(lfbin_dir, s_empty));
+	SET_STRING::const_iterator p;
+	for (p = ext_set.begin(); p != ext_set.end(); ++p)
+		lines.push_back(make_pair(lfbin_file, *p));
 
-	return len;
-}
+	const VEC_STRING no_names;
+	size_t l = 0;
 
+	while (l < lines.size() || snap.Have())
+	{
+		// c < 0: the line is only in the listing now; c > 0: only in
+		// the snapshot; c == 0: in both
+		int c;
+		if (!snap.Have())
+			c = -1;
+		else if (l == lines.size())
+			c = 1;
+		else
+			c = CompareLines(lines[l].first, lines[l].second,
+					snap.Kind(), snap.Ext());
 
+		const lfbin_kind kind = (c <= 0) ? lines[l].first : snap.Kind();
+		const string ext = (c <= 0) ? lines[l].second : snap.Ext();
+		const VEC_STRING& names = (c > 0) ? no_names
+				: (kind == lfbin_dir) ? dirs_bucket.names : ext_map[ext]->names;
 
-int
-LenPrint(CSREF s, int min_width = 0)
-{
-	int len = s.length();
+		diff_line line(kind, ext);
+		size_t i = 0;
+		string full;
 
-	if (min_width && min_width > len)
-	{
-		cout.width(min_width);
-		len = min_width;
+		for (;;)
+		{
+			bool in_snap = c >= 0 && snap.Have()
+					&& CompareLines(kind, ext, snap.Kind(), snap.Ext()) == 0;
+			bool in_names = i < names.size();
+
+			if (!in_snap && !in_names)
+				break;
+
+			int d = !in_snap ? -1 : !in_names ? 1
+					: CompareNames(FullName(names[i], full), snap.Name());
+			if (d < 0)
+				line.Add(true, FullName(names[i++], full));
+			else if (d > 0)
+			{
+				line.Add(false, snap.Name());
+				snap.Next();
+			}
+			else
+			{
+				++i;
+				snap.Next();
+			}
+		}
+
+		line.End();
+		if (c <= 0)
+			++l;
 	}
 
-	cout << s;
+	out.flush();
+}
 
-	return len;
+
+
+// PrintCountTotal()
+//
+// The end of one --count line: the count, and with --sizes the bytes.
+
+void
+PrintCountTotal(const count_total& total)
+{
+	out << total.names;
+	if (options.sizes)
+		out << ", " << total.bytes << ' ' << bytes_str;
+	out << '\n';
 }
 
 
 
-// PrintBasenames()
+// PrintCounts()
 //
-// Prints basenames on a line.  The width argument is passed in so it
-// knows how much of the current line was already printed (to print the
-// extension).
+// Prints the --count report: a line for the directories and one for
+// each extension, in the same order and layout as a listing, with a
+// count in place of the names; or all the counts as one JSON object.
+// With --sizes, each line also has the total size; for DIRS that is
+// the size of the directories themselves, not of what is in them.
 //
-// Tries not to break basenames across multiple lines, but for a
-// basename that is longer than the available line width, it has to.
+// The counts are kept by extension byte for byte, but extensions that
+// collate the same ("c" and "C" with --ascii-ic) share a line, just as
+// they share a bucket in a listing; so their counts are added together
+// under one spelling, the first of them byte for byte.
+
+typedef map<string, count_total, mycompare> MAP_SORTED_TOTAL;
 
 void
-PrintBasenames(int width, const PSET_STRING pset_basenames)
+PrintCounts()
 {
-	const int gap_width = options.ext_width + options.ext_separator.length();
+	MAP_SORTED_TOTAL exts;	// sorted the same way as ext_set
+	MAP_SORTED_TOTAL::const_iterator q;
 
-	bool need_separator = false;
-	// We don't need to print a name separator until after we have printed
-	// at least one basename on any line.
+	VEC_STRING spellings;
+	MAP_EXT_TOTAL::const_iterator p;
+	for (p = counts.exts.begin(); p != counts.exts.end(); ++p)
+		spellings.push_back(p->first);
+	sort(spellings.begin(), spellings.end());
 
-	SET_STRING::const_iterator p;
-	for (p = pset_basenames->begin(); p != pset_basenames->end(); ++p)
+	count_total files;
+	for (size_t i = 0; i < spellings.size(); ++i)
 	{
-		int len = p->length();
-		if (need_separator)
-			len += options.name_separator.length();
+		const count_total& from = counts.exts[spellings[i]];
+		count_total& total = exts[spellings[i]];	// or its equivalent
+		total.names += from.names;
+		total.bytes += from.bytes;
+		files.names += from.names;
+		files.bytes += from.bytes;
+	}
+
+#ifdef DEBUG
+	long names_check = 0;
+	for (q = exts.begin(); q != exts.end(); ++q)
+		names_check += q->second.names;
+	Assert(names_check == files.names);
+#endif // DEBUG
 
-		// if file name is too long for current line...
-		// ...and we would get more room with a new line...
-		// ... then start a new line.  If width == gap_width
-		// or even somehow got shorter than gap_width, no point in
-		// starting a new line.
+	if (options.count_json)
+	{
 
-		if (width + len > options.width() && width > gap_width)
+		out << "{\"dirs\":" << counts.dirs.names << ",\"files\":"
+				<< files.names;
+		if (options.sizes)
+			out << ",\"dir_bytes\":" << counts.dirs.bytes << ",\"bytes\":"
+					<< files.bytes;
+		out << ",\"ext\":{";
+		for (q = exts.begin(); q != exts.end(); ++q)
+		{
+			out << (q == exts.begin() ? "" : ",");
+			PutJsonString(out, q->first);
+			out << ':' << q->second.names;
+		}
+		out << '}';
+		if (options.sizes)
 		{
-			cout << endl;	// start new line
-			width = 0;
+			out << ",\"ext_bytes\":{";
+			for (q = exts.begin(); q != exts.end(); ++q)
+			{
+				out << (q == exts.begin() ? "" : ",");
+				PutJsonString(out, q->first);
+				out << ':' << q->second.bytes;
+			}
+			out << '}';
+		}
+		out << "}\n";
+		out.flush();
+		return;
+	}
 
-			// print gap to make basename lines line up
-			width += LenPrint("", gap_width);
+	string buf;
+	if (counts.dirs.names > 0)
+	{
+		LenAppend(buf, dirs_str, options.ext_width);
+		LenAppend(buf, options.ext_separator);
+		out << buf;
+		PrintCountTotal(counts.dirs);
+	}
 
-			need_separator = false;	// new line; don't need a sep yet
+	int lines = 0;
+	for (q = exts.begin(); q != exts.end(); ++q, ++lines)
+	{
+		if (options.head_limit && lines == options.head_limit)
+		{
+			buf.clear();
+			LenAppend(buf, "...", options.ext_width);
+			LenAppend(buf, options.ext_separator);
+			LenAppend(buf, MoreString(exts.size() - lines));
+			out << buf << '\n';
+			break;
 		}
 
-		if (need_separator)
-			width += LenPrint(options.name_separator);
+		buf.clear();
+		LenAppend(buf, q->first, options.ext_width);
+		LenAppend(buf, options.ext_separator);
+		out << buf;
+		PrintCountTotal(q->second);
+	}
+
+	out.flush();
+}
+
+
+
+// PrintTiming()
+//
+// Reports how long each phase of the run took, on standard error.
+
+void
+PrintTiming()
+{
+	char buf[80];
+	double total = 0;
 
-		width += LenPrint(*p);
-		need_separator = true;
+	for (int i = 0; i < STATS_PHASES_MAX; ++i)
+	{
+		stats_phase ph = stats_phase(i);
+
+		snprintf(buf, sizeof(buf), "timing: %-10s %9.3f ms\n",
+				stats_phase_name[ph], StatsPhaseWallMs(ph));
+		errout << buf;
+		total += StatsPhaseWallMs(ph);
 	}
 
-	cout << endl;
+	snprintf(buf, sizeof(buf), "timing: %-10s %9.3f ms\n", "total", total);
+	errout << buf;
+	errout.flush();
 }
 
 
 
-// PrintFilenames()
+// PrintStats()
 //
-// Print all filenames in the terse format.
+// Reports the phase times, timers and counters on standard error, as
+// text or as a JSON object.  Timers are wall-clock time summed over all
+// threads, inside the phases (classify inside list, sort inside print).
 
 void
-PrintFilenames()
+PrintStats()
 {
+	char buf[120];
 	SET_STRING::const_iterator p;
-	int width;
 
-	if (dirs_set.size() > 0)	// any dirs saved in set?
+	if (!options.stats_json)
 	{
-		// we have dirs to output, so output the DIRS line at top
-		width = 0;
-		width += LenPrint(dirs_str, options.ext_width);
-		width += LenPrint(options.ext_separator);
+		snprintf(buf, sizeof(buf), "stats: %-14s %10s %10s\n",
+				"phase", "wall ms", "cpu ms");
+		errout << buf;
+		for (int i = 0; i < STATS_PHASES_MAX; ++i)
+		{
+			stats_phase ph = stats_phase(i);
+			snprintf(buf, sizeof(buf), "stats: %-14s %10.3f %10.3f\n",
+					stats_phase_name[ph], StatsPhaseWallMs(ph),
+					StatsPhaseCpuMs(ph));
+			errout << buf;
+		}
+		for (int i = 0; i < STATS_TIMERS_MAX; ++i)
+		{
+			stats_timer st = stats_timer(i);
+			snprintf(buf, sizeof(buf), "stats:   %-12s %10.3f\n",
+					stats_timer_name[st], StatsTimerMs(st));
+			errout << buf;
+		}
+		for (int i = 0; i < STATS_COUNTERS_MAX; ++i)
+		{
+			stats_counter sc = stats_counter(i);
+			errout << "stats: " << stats_counter_name[sc] << ' '
+					<< StatsCounter(sc) << '\n';
+		}
+		errout << "stats: peak_rss_kb " << StatsPeakRssKb() << '\n';
 
-		PrintBasenames(width, &dirs_set);
+		errout << "stats: names " << dirs_str << ' '
+				<< dirs_bucket.seen << '\n';
+		for (p = ext_set.begin(); p != ext_set.end(); ++p)
+			errout << "stats: names ." << *p << ' '
+					<< ext_map[*p]->seen << '\n';
+
+		errout.flush();
+		return;
+	}
+
+	errout << "{\"phases\":{";
+	for (int i = 0; i < STATS_PHASES_MAX; ++i)
+	{
+		stats_phase ph = stats_phase(i);
+		snprintf(buf, sizeof(buf),
+				"%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+				i ? "," : "", stats_phase_name[ph],
+				StatsPhaseWallMs(ph), StatsPhaseCpuMs(ph));
+		errout << buf;
+	}
+	errout << "},\"timers\":{";
+	for (int i = 0; i < STATS_TIMERS_MAX; ++i)
+	{
+		stats_timer st = stats_timer(i);
+		snprintf(buf, sizeof(buf), "%s\"%s_ms\":%.3f",
+				i ? "," : "", stats_timer_name[st], StatsTimerMs(st));
+		errout << buf;
+	}
+	errout << "},\"counters\":{";
+	for (int i = 0; i < STATS_COUNTERS_MAX; ++i)
+	{
+		stats_counter sc = stats_counter(i);
+		errout << (i ? "," : "") << '"' << stats_counter_name[sc] << "\":"
+				<< StatsCounter(sc);
+	}
+	errout << ",\"peak_rss_kb\":" << StatsPeakRssKb();
+	errout << "},\"names\":{\"dirs\":" << dirs_bucket.seen
+			<< ",\"ext\":{";
+	for (p = ext_set.begin(); p != ext_set.end(); ++p)
+	{
+		errout << (p == ext_set.begin() ? "" : ",");
+		PutJsonString(errout, *p);
+		errout << ':' << ext_map[*p]->seen;
 	}
+	errout << "}}}\n";
+	errout.flush();
+}
+
+
+
+// WidenExtColumn()
+//
+// With --compound, makes the label column as wide as the longest
+// compound extension in the listing, so that every line still lines
+// up; a plain extension has no dot in it, so the ones with a dot are
+// the compound ones.  An --ext-width given by the user is kept as it is.
+
+void
+WidenExtColumn()
+{
+	if (!options.compound || options.ext_width_set)
+		return;
+
+	size_t width = options.ext_width;
 
+	SET_STRING::const_iterator p;
 	for (p = ext_set.begin(); p != ext_set.end(); ++p)
 	{
-		width = 0;
-		width += LenPrint(*p, options.ext_width);
-		width += LenPrint(options.ext_separator);
+		if (p->length() > width && p->find(ch_dot) != string::npos)
+			width = p->length();
+	}
 
-		PrintBasenames(width, ext_map[*p]);
+	MAP_EXT_TOTAL::const_iterator q;
+	for (q = counts.exts.begin(); q != counts.exts.end(); ++q)
+	{
+		if (q->first.length() > width && q->first.find(ch_dot) != string::npos)
+			width = q->first.length();
 	}
+
+	options.ext_width = width;
+}
+
+
+
+#ifndef LF_BENCH_MICRO
+// EndRun()
+//
+// The end of every run of lf, whether it listed names or built an
+// index: stops the stats and prints the reports asked for.
+
+void
+EndRun()
+{
+	StatsEnd();
+
+	if (options.timing)
+		PrintTiming();
+	if (options.stats)
+		PrintStats();
+	if (!options.trace_path.empty() && !TraceWrite())
+		Err(options.trace_path, err_str[bad_trace]);
+#ifdef LF_ALLOC_PROFILE
+	StatsAllocReport(errout, 20);
+	errout.flush();
+#endif
 }
 
 
@@ -1170,28 +5201,100 @@ PrintFilenames()
 int
 main(int argc, ARGV argv)
 {
+	StatsPhase(sp_strings);
 	SetStrings();
 #ifdef DEBUG
 	CheckStrings();
 #endif // DEBUG
 
+	StatsPhase(sp_lfopts);
 	ReadEnvOptions();
+	StatsPhase(sp_options);
 	SetOptions(argc, argv);
+	LoadCompoundExts();
+	SetUpColor();
+
+	if (options.mem_limit && options.sort_by != key_name)
+		ErrExit(arg_str[mem_limit_l], err_str[need_sort_name]);
+	if (options.no_stat && options.sort_by != key_name)
+		ErrExit(arg_str[no_stat_l], err_str[need_sort_name]);
+	if (!options.snapshot_path.empty() || !options.diff_path.empty())
+	{
+		CSZ opt = options.diff_path.empty() ? arg_str[save_snapshot_l]
+				: arg_str[diff_l];
+
+		if (options.sort_by != key_name)
+			ErrExit(opt, err_str[need_sort_name]);
+		if (options.count_only || options.mem_limit || options.per_ext_limit)
+			ErrExit(opt, err_str[bad_snapshot_with]);
+		if (!options.diff_path.empty() && options.format == fmt_bin)
+			ErrExit(opt, err_str[bad_diff_format]);
+	}
+
+#ifndef LF_NO_STATS
+	stats_enabled = options.stats;
+#endif
+#ifdef LF_ALLOC_PROFILE
+	stats_enabled = true;	// the profile needs the count of entries
+#endif
+	if (!options.trace_path.empty())
+	{
+		if (!TraceStart(options.trace_path.c_str()))
+			ErrExit(options.trace_path, err_str[bad_trace]);
+		TraceThreadName("main");
+	}
 
 	// Call InitLocale() *after* argument processing; see the comments
 	// at the declaration of InitLocale() for an explanation why.
+	StatsPhase(sp_locale);
 	InitLocale();	
 
+	// the snapshot is checked against the sort options now, so that a
+	// bad one stops lf before anything is printed
+	if (!options.diff_path.empty())
+		diff_snapshot.Open(options.diff_path);
+
+	StatsPhase(sp_list);
+
+	// The machine-readable formats must not have anything but records
+	// on standard output, so verbose headers only go with text output.
+	if (options.format != fmt_text || options.count_json)
+		options.verbose_level = 0;
+
 	if (options.verbose_level >= 2)
 		PrintReportAboutOptions();
 
+	if (!options.build_index.empty())
+	{
+		BuildIndex();
+		EndRun();
+		return 0;
+	}
+	if (!options.index_path.empty())
+		OpenIndex();
+
+	names_may_repeat = args_try_list.size() > 1
+			|| !options.files_from.empty() || options.archives
+			|| options.sort == sort_ascii_ic
+			|| (options.sort == sort_locale && def_locale != locale::classic());
+
 	string cwd = GetCwd();
-	if (args_try_list.size() == 0)
+	if (!options.files_from.empty())
+	{
+		// Names from a file, along with any arguments.  There may be
+		// any number of them, so they are all listed with paths.
+
+		if (options.verbose_level >= 1)
+			out << verbose_str[v_list_in_dir] << cwd << '\n';
+		TryArgList(true);
+		ReadNamesFrom(options.files_from);
+	}
+	else if (args_try_list.size() == 0)
 	{
 		// default: list current directory
 
 		if (options.slurp_dir_arg && options.verbose_level >= 1)
-			cout << verbose_str[v_list_in_dir] << cwd << endl;
+			out << verbose_str[v_list_in_dir] << cwd << '\n';
 		TryArg(cwd, false);
 	}
 	else if (args_try_list.size() == 1)
@@ -1201,13 +5304,15 @@ main(int argc, ARGV argv)
 		// If it's a relative path, print the cwd at the top.
 		CSREF arg = *(args_try_list.begin());
 		filetype ft;
+		StatsInc(sc_stat_calls);
 		bool b = check_type(arg, ft);
 		if (options.verbose_level >= 1)
 		{
-			if (b && ft == ft_dir && options.slurp_dir_arg)
-				cout << verbose_str[v_list_in_dir] << arg << endl;
+			if (b && ((ft == ft_dir && options.slurp_dir_arg)
+					|| (ft != ft_dir && IsArchiveArg(arg))))
+				out << verbose_str[v_list_in_dir] << arg << '\n';
 			else if (!IsAbsolutePath(arg))
-				cout << verbose_str[v_list_in_dir] << cwd << endl;
+				out << verbose_str[v_list_in_dir] << cwd << '\n';
 		}
 
 		// List it.  If it is a directory it will be slurped without path.
@@ -1219,11 +5324,28 @@ main(int argc, ARGV argv)
 		// with paths included.
 
 		if (options.verbose_level >= 1)
-			cout << verbose_str[v_list_in_dir] << cwd << endl;
+			out << verbose_str[v_list_in_dir] << cwd << '\n';
 		TryArgList(true);
 	}
 
-	PrintFilenames();
+	RankPaths();
+	WidenExtColumn();
+
+	StatsPhase(sp_print);
+	if (options.count_only)
+		PrintCounts();
+	else if (!options.diff_path.empty())
+		PrintDiff(diff_snapshot);
+	else if (!run_fds.empty())
+		PrintMerged();
+	else if (options.format == fmt_text)
+		PrintFilenames();
+	else
+		PrintRecords();
+	if (!options.snapshot_path.empty())
+		SaveSnapshot(options.snapshot_path);
 
+	EndRun();
 	return 0;
 }
+#endif // LF_BENCH_MICRO
@@ -48,6 +48,31 @@ enum arg_strings
 	name_sep_s, name_sep_l,
 	repl_spaces_s, repl_spaces_l,
 	verbose_s, verbose_l,
+	format_s, format_l,
+	per_ext_s, per_ext_l,
+	head_s, head_l,
+	timing_s, timing_l,
+	stats_s, stats_l,
+	trace_s, trace_l,
+	count_s, count_l,
+	sizes_s, sizes_l,
+	sort_by_s, sort_by_l,
+	reverse_s, reverse_l,
+	mem_limit_s, mem_limit_l,
+	save_snapshot_s, save_snapshot_l,
+	diff_s, diff_l,
+	gitignore_s, gitignore_l,
+	natural_s, natural_l,
+	compound_s, compound_l,
+	no_compound_s, no_compound_l,
+	files_from_s, files_from_l,
+	null_names_s, null_names_l,
+	no_stat_s, no_stat_l,
+	archives_s, archives_l,
+	build_index_s, build_index_l,
+	index_s, index_l,
+	index_check_s, index_check_l,
+	color_s, color_l,
 	ARG_STRINGS_MAX,
 };
 
@@ -71,6 +96,20 @@ enum verbose_strings
 	v_dir,
 	v_ext_limit,
 	v_ext_width,
+	v_per_ext,
+	v_head,
+	v_sort_by,
+	v_reverse,
+	v_mem_limit,
+	v_gitignore,
+	v_natural,
+	v_compound,
+	v_files_from,
+	v_archives,
+	v_index,
+	v_index_dirs,
+	v_index_names,
+	v_color,
 	VERBOSE_STRINGS_MAX,
 };
 
@@ -88,6 +127,29 @@ enum err_strings
 	bad_filename,
 	bad_locale,
 	bad_lfopts,
+	bad_format,
+	bad_stats,
+	bad_trace,
+	bad_count,
+	bad_sizes,
+	bad_sort_key,
+	bad_mem_limit,
+	need_sort_name,
+	bad_run_file,
+	bad_save,
+	bad_snapshot,
+	bad_snapshot_order,
+	bad_snapshot_with,
+	bad_diff_format,
+	bad_compound_file,
+	bad_compound_rule,
+	bad_files_from,
+	bad_archive,
+	bad_index,
+	bad_build_index,
+	bad_index_root,
+	bad_color,
+	bad_ls_colors,
 	ERR_STRINGS_MAX,
 };
 
@@ -105,6 +167,8 @@ CSZ const* license_strings;
 int license_strings_max = 0;
 
 CSZ dirs_str = "////";
+CSZ more_str = "////";
+CSZ bytes_str = "////";
 
 
 
@@ -0,0 +1,143 @@
+// lfbin.hpp
+//
+// Describes the compact binary listing format written by "lf --format=bin".
+// Programs that want to read lf listings without parsing text can include
+// this header.
+//
+// The format is designed to be read with mmap(): every field is at a
+// fixed offset within its record, and every record starts on an 8-byte
+// boundary.  All integers are little-endian, whatever the host is.
+//
+// A file is a header followed by records:
+//
+// header (16 bytes)
+//		magic		4 bytes, "LFB1"
+//		version		uint32, currently 1
+//		count		uint64, how many records follow
+//
+// record (8 bytes, then variable)
+//		kind		uint8, one of the lfbin_kind values
+//		reserved	uint8, always 0
+//		ext_len		uint16, length of the extension in bytes
+//		name_len	uint32, length of the basename in bytes
+//		ext			ext_len bytes, not NUL-terminated
+//		name		name_len bytes, not NUL-terminated
+//		padding		0 to 7 bytes of zeros, to the next 8-byte boundary
+//
+// Records are in the same order lf would print them: directories first,
+// then each extension in sorted order, with the names sorted within each
+// extension.
+//
+// A snapshot saved by "lf --save-snapshot" starts with one more record,
+// of kind lfbin_order, which is not part of the listing: its name says
+// how the records are sorted (the sort options lf was run with), so that
+// "lf --diff" can tell before it starts whether they are in the order it
+// expects.  Its ext is empty, and the count includes it.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#ifndef LFBIN_HPP
+
+#define LFBIN_HPP
+
+
+
+#include <stdint.h>
+
+
+
+#define LFBIN_MAGIC "LFB1"
+const uint32_t lfbin_version = 1;
+
+const int lfbin_header_len = 16;
+const int lfbin_record_len = 8;	// fixed part of a record
+const int lfbin_align = 8;
+
+enum lfbin_kind
+{
+	lfbin_file = 0,
+	lfbin_dir = 1,
+	lfbin_order = 2,	// first in a snapshot; see above
+};
+
+
+
+// LfbinPadding()
+//
+// Returns how many padding bytes follow a record with the given string
+// lengths.
+
+inline int
+LfbinPadding(uint32_t ext_len, uint32_t name_len)
+{
+	uint32_t n = lfbin_record_len + ext_len + name_len;
+
+	return (lfbin_align - n % lfbin_align) % lfbin_align;
+}
+
+
+
+// PutLE16(), PutLE32(), PutLE64()
+//
+// Store an integer into a buffer in little-endian byte order.
+
+inline void
+PutLE16(unsigned char *p, uint16_t u)
+{
+	p[0] = u & 0xff;
+	p[1] = (u >> 8) & 0xff;
+}
+
+inline void
+PutLE32(unsigned char *p, uint32_t u)
+{
+	for (int i = 0; i < 4; ++i)
+		p[i] = (u >> (8 * i)) & 0xff;
+}
+
+inline void
+PutLE64(unsigned char *p, uint64_t u)
+{
+	for (int i = 0; i < 8; ++i)
+		p[i] = (u >> (8 * i)) & 0xff;
+}
+
+
+
+// GetLE16(), GetLE32(), GetLE64()
+//
+// Fetch a little-endian integer from a buffer.
+
+inline uint16_t
+GetLE16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+inline uint32_t
+GetLE32(const unsigned char *p)
+{
+	uint32_t u = 0;
+
+	for (int i = 3; i >= 0; --i)
+		u = (u << 8) | p[i];
+
+	return u;
+}
+
+inline uint64_t
+GetLE64(const unsigned char *p)
+{
+	uint64_t u = 0;
+
+	for (int i = 7; i >= 0; --i)
+		u = (u << 8) | p[i];
+
+	return u;
+}
+
+
+
+#endif // LFBIN_HPP
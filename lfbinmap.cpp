@@ -0,0 +1,137 @@
+// lfbinmap.cpp
+//
+// Reads an lfbin listing through mmap().
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cerrno>
+#include <cstring>
+
+// for open(), fstat(), mmap()
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#include "lfbinmap.hpp"
+
+using namespace std;
+
+
+
+// constructor and destructor
+
+lfbin_map::lfbin_map()
+{
+	base = NULL;
+	size = 0;
+	pos = 0;
+	left = 0;
+	failed = false;
+}
+
+
+
+lfbin_map::~lfbin_map()
+{
+	Close();
+}
+
+
+
+bool
+lfbin_map::Open(CSZ path)
+{
+	Close();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	if (!S_ISREG(sb.st_mode) || sb.st_size < lfbin_header_len)
+	{
+		close(fd);
+		errno = S_ISDIR(sb.st_mode) ? EISDIR : 0;
+		return false;
+	}
+
+	void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping stays
+	if (p == MAP_FAILED)
+		return false;
+
+	base = (const unsigned char *)p;
+	size = sb.st_size;
+	madvise(p, size, MADV_SEQUENTIAL);
+
+	if (memcmp(base, LFBIN_MAGIC, 4) != 0
+			|| GetLE32(base + 4) != lfbin_version)
+	{
+		Close();
+		errno = 0;
+		return false;
+	}
+
+	left = GetLE64(base + 8);
+	pos = lfbin_header_len;
+	failed = false;
+	return true;
+}
+
+
+
+void
+lfbin_map::Close()
+{
+	if (base != NULL)
+		munmap((void *)base, size);
+	base = NULL;
+	size = 0;
+	left = 0;
+}
+
+
+
+bool
+lfbin_map::Next()
+{
+	if (left == 0 || failed)
+		return false;
+
+	if (size - pos < size_t(lfbin_record_len))
+	{
+		failed = true;
+		return false;
+	}
+
+	const unsigned char *rec = base + pos;
+	uint32_t ext_len = GetLE16(rec + 2);
+	uint32_t name_len = GetLE32(rec + 4);
+	size_t rec_len = lfbin_record_len + size_t(ext_len) + name_len
+			+ LfbinPadding(ext_len, name_len);
+
+	if (size - pos < rec_len)
+	{
+		failed = true;
+		return false;
+	}
+
+	kind = lfbin_kind(rec[0]);
+	ext.assign((CSZ)rec + lfbin_record_len, ext_len);
+	name.assign((CSZ)rec + lfbin_record_len + ext_len, name_len);
+
+	pos += rec_len;
+	--left;
+	return true;
+}
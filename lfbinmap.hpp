@@ -0,0 +1,78 @@
+// lfbinmap.hpp
+//
+// Reads a listing written by "lf --format=bin" (or --save-snapshot)
+// through mmap(), one record at a time.  See lfbin.hpp for the format.
+//
+// The whole file is mapped, so reading it costs no copies and no read()
+// calls; the kernel pages it in as the records are walked through.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// lfbin_map m;
+// if (!m.Open("snapshot.lfb"))
+//	error...
+// while (m.Next())
+//	do something with m.kind, m.ext and m.name...
+// if (!m.good())
+//	error: the file ended inside a record...
+
+
+
+#ifndef LFBINMAP_HPP
+
+#define LFBINMAP_HPP
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "lfbin.hpp"
+#include "util.hpp"
+
+
+
+class lfbin_map
+{
+	private:
+		const unsigned char *base;	// the mapped file, or NULL
+		size_t size;
+		size_t pos;	// offset of the next record
+		uint64_t left;	// records not read yet
+		bool failed;
+
+		// not copyable
+		lfbin_map(const lfbin_map& rhs);
+		lfbin_map& operator=(const lfbin_map& rhs);
+
+	public:
+		lfbin_map();
+		~lfbin_map();
+
+		// maps the file and checks its header; returns false if it
+		// can't be read (errno says why) or isn't an lfbin file of a
+		// known version (errno is 0)
+		bool Open(CSZ path);
+		void Close();
+
+		// reads the next record; returns false at the end or on error
+		bool Next();
+
+		// true if the file is not shorter than its header says
+		bool good() const { return !failed; }
+
+		// the record Next() read
+		lfbin_kind kind;
+		std::string ext;
+		std::string name;
+};
+
+
+
+#endif // LFBINMAP_HPP
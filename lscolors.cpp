@@ -0,0 +1,346 @@
+// lscolors.cpp
+//
+// Colors from LS_COLORS, for lf --color.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cstring>
+
+#include <unordered_map>
+
+
+#include "lscolors.hpp"
+
+using namespace std;
+
+
+
+const char ch_colon = ':';
+const char ch_dot = '.';
+const char ch_star = '*';
+
+// what ls uses when the escape sequence parts aren't in LS_COLORS
+static const string s_default_lc("\033[");
+static const string s_default_rc("m");
+static const string s_default_rs("0");
+static const string s_default_di("01;34");
+
+
+
+// LowerAscii()
+//
+// Forces the ASCII letters in s to lower case.  Suffixes are matched
+// ignoring case, byte by byte, whatever the locale.
+
+inline void
+LowerAscii(string& s)
+{
+	for (size_t i = 0; i < s.length(); ++i)
+	{
+		if (s[i] >= 'A' && s[i] <= 'Z')
+			s[i] += 'a' - 'A';
+	}
+}
+
+
+
+// HexDigit()
+//
+// The value of a hex digit, or -1.
+
+inline int
+HexDigit(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+
+
+// Unescape()
+//
+// Turns a value from LS_COLORS into the bytes it stands for, as ls
+// does: backslash escapes (\e, \n, \033, \x1b and so on) and caret
+// notation (^[ for escape).  Returns false for a value that ends in the
+// middle of one.
+
+bool
+Unescape(CSREF s, string& value)
+{
+	value.clear();
+
+	for (size_t i = 0; i < s.length(); ++i)
+	{
+		char ch = s[i];
+
+		if (ch == '^')
+		{
+			if (++i == s.length())
+				return false;
+			ch = s[i];
+			if (ch == '?')
+				value += '\177';
+			else if (ch >= '@' && ch <= '~')
+				value += char(ch & 0x1f);
+			else
+				return false;
+			continue;
+		}
+
+		if (ch != '\\')
+		{
+			value += ch;
+			continue;
+		}
+
+		if (++i == s.length())
+			return false;
+		ch = s[i];
+
+		if (ch >= '0' && ch <= '7')
+		{
+			int n = 0;
+			for (int digits = 0; digits < 3 && i < s.length()
+					&& s[i] >= '0' && s[i] <= '7'; ++digits, ++i)
+				n = n * 8 + (s[i] - '0');
+			value += char(n);
+			--i;
+			continue;
+		}
+
+		if (ch == 'x' || ch == 'X')
+		{
+			int n = 0;
+			int digits = 0;
+			for (; digits < 2 && i + 1 < s.length()
+					&& HexDigit(s[i + 1]) >= 0; ++digits, ++i)
+				n = n * 16 + HexDigit(s[i + 1]);
+			if (digits == 0)
+				return false;
+			value += char(n);
+			continue;
+		}
+
+		switch (ch)
+		{
+		case 'a': ch = '\a'; break;
+		case 'b': ch = '\b'; break;
+		case 'e': ch = '\033'; break;
+		case 'f': ch = '\f'; break;
+		case 'n': ch = '\n'; break;
+		case 'r': ch = '\r'; break;
+		case 't': ch = '\t'; break;
+		case 'v': ch = '\v'; break;
+		case '?': ch = '\177'; break;
+		case '_': ch = ' '; break;
+		default: break;	// the character itself, as for "\\"
+		}
+		value += ch;
+	}
+
+	return true;
+}
+
+
+
+// constructor
+
+ls_colors::ls_colors()
+{
+}
+
+
+
+bool
+ls_colors::Parse(CSZ spec)
+{
+	string lc = s_default_lc;
+	string rc = s_default_rc;
+	string rs = s_default_rs;
+	string ec;
+	string di = s_default_di;
+	string fi;
+
+	// the suffixes, each once: a later entry for the same suffix
+	// replaces the earlier one, and takes its place in the order
+	vector<rule> rules;
+	unordered_map<string, size_t> seen;
+
+	const string s = (spec == NULL) ? string() : string(spec);
+	size_t order = 0;
+	for (size_t i = 0; i < s.length(); ++order)
+	{
+		size_t j = s.find(ch_colon, i);
+		if (j == string::npos)
+			j = s.length();
+
+		const string entry = s.substr(i, j - i);
+		i = j + 1;
+		if (entry.empty())
+			continue;
+
+		size_t eq = entry.find('=');
+		string value;
+		if (eq == string::npos || !Unescape(entry.substr(eq + 1), value))
+			return false;
+		const string key = entry.substr(0, eq);
+
+		if (key.length() > 1 && key[0] == ch_star)
+		{
+			rule r;
+			r.suffix = key.substr(1);
+			LowerAscii(r.suffix);
+			r.seq = value;	// the code, for now
+			r.order = order;
+
+			unordered_map<string, size_t>::iterator p = seen.find(r.suffix);
+			if (p == seen.end())
+			{
+				seen[r.suffix] = rules.size();
+				rules.push_back(r);
+			}
+			else
+				rules[p->second] = r;
+		}
+		else if (key == "di")
+			di = value;
+		else if (key == "fi")
+			fi = value;
+		else if (key == "lc")
+			lc = value;
+		else if (key == "rc")
+			rc = value;
+		else if (key == "ec")
+			ec = value;
+		else if (key == "rs")
+			rs = value;
+		// any other kind of name needs a stat(), so lf leaves it out
+	}
+
+	dir_seq = di.empty() ? di : lc + di + rc;
+	file_seq = fi.empty() ? fi : lc + fi + rc;
+	end_seq = ec.empty() ? lc + rs + rc : ec;
+
+	for (size_t n = 0; n < rules.size(); ++n)
+	{
+		rule& r = rules[n];
+		if (!r.seq.empty())
+			r.seq = lc + r.seq + rc;
+
+		// "*.ext" is an extension, unless it's only the dot
+		if (r.suffix.length() < 2 || r.suffix[0] != ch_dot)
+		{
+			other_rules.push_back(r);
+			continue;
+		}
+
+		r.suffix.erase(0, 1);
+		ext_table.Add(r.suffix, ext_rules.size());
+		ext_rules.push_back(r);
+
+		for (size_t k = r.suffix.find(ch_dot); k != string::npos;
+				k = r.suffix.find(ch_dot, k + 1))
+			ext_tails.insert(r.suffix.substr(k + 1));
+	}
+	ext_table.Build();
+
+	return true;
+}
+
+
+
+// ls_colors::FindExt()
+//
+// The rule for an extension, already in lower case, or NULL.
+
+inline const ls_colors::rule *
+ls_colors::FindExt(CSZ ext, size_t len) const
+{
+	int i = ext_table.Lookup(ext, len);
+
+	return (i < 0) ? NULL : &ext_rules[i];
+}
+
+
+
+// ls_colors::Later()
+//
+// Of two matching rules, keeps the one later in LS_COLORS.
+
+inline void
+ls_colors::Later(const rule *& best, const rule *r) const
+{
+	if (r != NULL && (best == NULL || r->order > best->order))
+		best = r;
+}
+
+
+
+// ls_colors::ExtColor()
+//
+// Every name in the line ends with ".ext", so it matches the rule for
+// the extension, and the rule for each shorter end of it ("gz" of
+// "tar.gz").
+
+CSREF
+ls_colors::ExtColor(CSREF ext, bool& per_name) const
+{
+	thread_local string key;
+	key = ext;
+	LowerAscii(key);
+
+	per_name = ext.empty() || !other_rules.empty()
+			|| ext_tails.count(key) != 0;
+
+	const rule *best = NULL;
+	for (size_t i = 0; ; ++i)
+	{
+		Later(best, FindExt(key.data() + i, key.length() - i));
+
+		i = key.find(ch_dot, i);
+		if (i == string::npos)
+			break;
+	}
+
+	return (best == NULL) ? file_seq : best->seq;
+}
+
+
+
+// ls_colors::NameColor()
+//
+// Looks up what follows each dot in the name as an extension, and
+// checks every other suffix.
+
+CSREF
+ls_colors::NameColor(CSZ name, size_t len) const
+{
+	thread_local string lower;
+	lower.assign(name, len);
+	LowerAscii(lower);
+
+	const rule *best = NULL;
+	for (size_t i = lower.find(ch_dot); i != string::npos;
+			i = lower.find(ch_dot, i + 1))
+		Later(best, FindExt(lower.data() + i + 1, len - i - 1));
+
+	for (size_t n = 0; n < other_rules.size(); ++n)
+	{
+		const rule& r = other_rules[n];
+		if (r.suffix.length() <= len
+				&& lower.compare(len - r.suffix.length(), string::npos,
+				r.suffix) == 0)
+			Later(best, &r);
+	}
+
+	return (best == NULL) ? file_seq : best->seq;
+}
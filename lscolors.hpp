@@ -0,0 +1,106 @@
+// lscolors.hpp
+//
+// Colors for lf --color, taken from the LS_COLORS environment variable
+// that ls uses (as set up by dircolors), so lf colors names the same
+// way.
+//
+// LS_COLORS is a list of key=value entries separated by colons.  A key
+// of two letters is a kind of name ("di" for directories, "fi" for
+// files) or part of the escape sequence ("lc", "rc", "ec", "rs"); a key
+// "*suffix" colors every name that ends with the suffix, ignoring case.
+// If suffixes overlap, the entry that comes later in LS_COLORS wins, as
+// in ls.
+//
+// Nearly every suffix is an extension, "*.ext".  Those go in a perfect
+// hash table keyed by the lower-case extension, so the color of a
+// whole line of the listing is one lookup.  The few other suffixes
+// ("*~", "*#" and such) are kept in a short list of their own.  Only a
+// line whose names might not all get the color of its extension (the
+// line of names with no extension, a line whose extension is the end of
+// a longer one such as "gz" of "tar.gz", or any line when there are
+// other suffixes) needs to look names up one at a time.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// ls_colors c;
+// if (!c.Parse(getenv("LS_COLORS")))
+//	error...
+// bool per_name;
+// CSREF line = c.ExtColor("c", per_name);
+// CSREF name = per_name ? c.NameColor("foo.c", 5) : line;
+// if (!name.empty())
+//	print name, then "foo.c", then c.end()...
+
+
+
+#ifndef LSCOLORS_HPP
+
+#define LSCOLORS_HPP
+
+
+
+#include <stddef.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "phash.hpp"
+#include "util.hpp"
+
+
+
+class ls_colors
+{
+	private:
+		// a suffix and its color; order is where the entry was in
+		// LS_COLORS, so the later of two matches can win
+		struct rule
+		{
+			std::string suffix;	// lower case, without the "*"
+			std::string seq;	// the whole escape sequence
+			size_t order;
+		};
+
+		std::vector<rule> ext_rules;	// "*.ext", found by ext_table
+		perfect_hash ext_table;	// extension -> index in ext_rules
+		std::vector<rule> other_rules;	// all other suffixes
+
+		// the ends of extensions with more than one part ("gz" of
+		// "tar.gz"); a line with one of these needs NameColor()
+		std::unordered_set<std::string> ext_tails;
+
+		std::string dir_seq;
+		std::string file_seq;
+		std::string end_seq;
+
+		const rule *FindExt(CSZ ext, size_t len) const;
+		void Later(const rule *& best, const rule *r) const;
+
+	public:
+		ls_colors();
+
+		// parses LS_COLORS; NULL or empty means the defaults of ls;
+		// returns false, and leaves the colors off, if it can't be
+		// parsed
+		bool Parse(CSZ spec);
+
+		// the color of a line of names with this extension, or of
+		// files if no suffix matches; per_name is set if the names may
+		// need colors of their own, from NameColor()
+		CSREF ExtColor(CSREF ext, bool& per_name) const;
+
+		// the color of one file name
+		CSREF NameColor(CSZ name, size_t len) const;
+
+		CSREF dir() const { return dir_seq; }
+		CSREF end() const { return end_seq; }
+};
+
+
+
+#endif // LSCOLORS_HPP
@@ -0,0 +1,191 @@
+// namereader.cpp
+//
+// Reads a list of names, for lf --files-from.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cerrno>
+#include <cstring>
+
+// for open(), read(), fstat(), mmap()
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#include "namereader.hpp"
+
+using namespace std;
+
+
+
+const size_t read_chunk = 1 << 20;	// bytes asked for by each read()
+
+static const string s_stdin("-");
+
+
+
+// constructor and destructor
+
+name_reader::name_reader()
+{
+	fd = -1;
+	close_fd = false;
+	delim = '\n';
+	map_base = NULL;
+	map_size = 0;
+	pos = NULL;
+	end = NULL;
+	failed = false;
+}
+
+
+
+name_reader::~name_reader()
+{
+	Close();
+}
+
+
+
+bool
+name_reader::Open(CSREF path, char delim_char)
+{
+	Close();
+	delim = delim_char;
+	failed = false;
+
+	if (path == s_stdin)
+	{
+		fd = 0;
+		close_fd = false;
+	}
+	else
+	{
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		close_fd = true;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0)
+	{
+		void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			map_base = (const char *)p;
+			map_size = sb.st_size;
+			madvise(p, map_size, MADV_SEQUENTIAL);
+
+			pos = map_base;
+			end = map_base + map_size;
+			if (close_fd)
+				close(fd);	// the mapping stays
+			fd = -1;
+			return true;
+		}
+	}
+
+	// not a regular file, or it couldn't be mapped, so read it
+	buf.resize(read_chunk);
+	pos = end = &buf[0];
+	return true;
+}
+
+
+
+void
+name_reader::Close()
+{
+	if (fd >= 0 && close_fd)
+		close(fd);
+	fd = -1;
+
+	if (map_base != NULL)
+		munmap((void *)map_base, map_size);
+	map_base = NULL;
+	map_size = 0;
+
+	pos = end = NULL;
+}
+
+
+
+// name_reader::Fill()
+//
+// Moves the start of a name left at the end of buf to the front, and
+// reads more after it, making buf bigger if the name fills it.  At the
+// end of the input, fd is closed and set to -1.  Returns false if a read
+// fails.
+
+bool
+name_reader::Fill()
+{
+	size_t left = end - pos;
+	if (left > 0 && pos != &buf[0])
+		memmove(&buf[0], pos, left);
+	if (left == buf.size())
+		buf.resize(buf.size() * 2);
+
+	pos = &buf[0];
+	end = pos + left;
+
+	ssize_t rc;
+	do
+		rc = read(fd, &buf[left], buf.size() - left);
+	while (rc < 0 && errno == EINTR);
+
+	if (rc > 0)
+	{
+		end += rc;
+		return true;
+	}
+
+	if (close_fd)
+		close(fd);
+	fd = -1;
+
+	failed = (rc < 0);
+	return !failed;
+}
+
+
+
+bool
+name_reader::Next(CSZ& name, size_t& len)
+{
+	for (;;)
+	{
+		const char *p = (const char *)memchr(pos, delim, end - pos);
+		if (p != NULL)
+		{
+			name = pos;
+			len = p - pos;
+			pos = p + 1;
+			if (len > 0)
+				return true;
+			continue;	// skip an empty name
+		}
+
+		if (fd < 0)
+		{
+			// all read; a last name may have no delimiter after it
+			if (pos == end)
+				return false;
+
+			name = pos;
+			len = end - pos;
+			pos = end;
+			return true;
+		}
+
+		if (!Fill())
+			return false;
+	}
+}
@@ -0,0 +1,84 @@
+// namereader.hpp
+//
+// Reads a list of names, one per line or separated by NUL bytes (as
+// from "find -print0"), for lf --files-from.
+//
+// A regular file is mapped with mmap(), and the names are handed out
+// as pointers into the mapping.  Standard input, or a pipe, is read a
+// large chunk at a time into one buffer, and the names are pointers into
+// that.  Either way nothing is copied or allocated per name, so a list
+// of millions of names is read at about the speed of memory.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// name_reader r;
+// if (!r.Open("-", '\0'))
+//	error...
+// CSZ name;
+// size_t len;
+// while (r.Next(name, len))
+//	do something with the len bytes at name (not NUL-terminated)...
+// if (!r.good())
+//	error: a read failed...
+
+
+
+#ifndef NAMEREADER_HPP
+
+#define NAMEREADER_HPP
+
+
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "util.hpp"
+
+
+
+class name_reader
+{
+	private:
+		int fd;	// -1 once the input is all read
+		bool close_fd;	// false for standard input
+		char delim;
+
+		const char *map_base;	// the mapped file, or NULL
+		size_t map_size;
+
+		std::vector<char> buf;	// when reading, not mapping
+		const char *pos;	// the next name starts here
+		const char *end;	// the data read so far ends here
+		bool failed;
+
+		bool Fill();
+
+		// not copyable
+		name_reader(const name_reader& rhs);
+		name_reader& operator=(const name_reader& rhs);
+
+	public:
+		name_reader();
+		~name_reader();
+
+		// opens a file, or standard input for "-"; the names are
+		// separated by delim, '\n' or '\0'
+		bool Open(CSREF path, char delim);
+		void Close();
+
+		// the next name, skipping empty ones; name is valid only until
+		// the next call; returns false at the end or on error
+		bool Next(CSZ& name, size_t& len);
+
+		// true if no read failed
+		bool good() const { return !failed; }
+};
+
+
+
+#endif // NAMEREADER_HPP
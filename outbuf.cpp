@@ -0,0 +1,213 @@
+// outbuf.cpp
+//
+// Class for buffered output to a file descriptor.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cstring>
+
+// for write()
+#include <errno.h>
+#include <unistd.h>
+
+
+#include "outbuf.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+
+
+// constructor and destructor
+
+outbuf::outbuf(int fd_out, size_t cap_buf)
+{
+	fd = fd_out;
+#ifdef LF_OUTBUF_STDIO
+	if (fd == 1)
+		fp = stdout;
+	else if (fd == 2)
+		fp = stderr;
+	else
+		fp = fdopen(fd, "w");
+#endif
+	cap = cap_buf;
+	len = 0;
+	failed = false;
+
+	if (cap < 1)
+		cap = 1;
+	buf = new char[cap];
+}
+
+
+
+outbuf::~outbuf()
+{
+	flush();
+
+	delete[] buf;
+}
+
+
+
+// write_fd()
+//
+// Hands a block of bytes to the operating system.  write(2) is allowed
+// to write less than it was asked to, and can be interrupted by a
+// signal, so keep going until it's all written or a real error happens.
+
+void
+outbuf::write_fd(const char *p, size_t n)
+{
+	trace_span span("write");
+
+#ifdef LF_OUTBUF_STDIO
+	if (failed)
+		return;
+	if (fp == NULL || fwrite(p, 1, n, fp) != n || fflush(fp) != 0)
+		failed = true;
+	return;
+#endif
+
+	while (n > 0 && !failed)
+	{
+		ssize_t rc = ::write(fd, p, n);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			failed = true;
+			return;
+		}
+
+		p += rc;
+		n -= rc;
+	}
+}
+
+
+
+// write()
+//
+// Appends a block of bytes.  A block too big to fit in the buffer goes
+// straight to the file descriptor rather than being copied in pieces.
+
+void
+outbuf::write(const void *p, size_t n)
+{
+	const char *pch = static_cast<const char *>(p);
+
+	if (n > cap - len)
+	{
+		flush();
+
+		if (n >= cap)
+		{
+			write_fd(pch, n);
+			return;
+		}
+	}
+
+	memcpy(buf + len, pch, n);
+	len += n;
+}
+
+
+
+void
+outbuf::puts(CSZ csz)
+{
+	write(csz, strlen(csz));
+}
+
+
+
+void
+outbuf::puts(CSREF s)
+{
+	write(s.data(), s.length());
+}
+
+
+
+// putnum()
+//
+// Appends a number in decimal.
+
+void
+outbuf::putnum(long n)
+{
+	char buf[24];
+	char *p = buf + sizeof(buf);
+	unsigned long u = (n < 0) ? -static_cast<unsigned long>(n) : n;
+
+	do
+	{
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+
+	if (n < 0)
+		*--p = '-';
+
+	write(p, buf + sizeof(buf) - p);
+}
+
+
+
+// flush()
+//
+// Writes out whatever is in the buffer.
+
+bool
+outbuf::flush()
+{
+	if (len > 0)
+	{
+		write_fd(buf, len);
+		len = 0;
+	}
+
+	return !failed;
+}
+
+
+
+// PutJsonString()
+//
+// File names are just bytes, not necessarily valid UTF-8; the bytes are
+// passed through unchanged except for the characters JSON requires to
+// be escaped.
+
+void
+PutJsonString(outbuf& o, CSZ s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	o.put('"');
+	for (CSZ p = s; p < s + len; ++p)
+	{
+		unsigned char ch = *p;
+
+		if (ch == '"' || ch == '\\')
+		{
+			o.put('\\');
+			o.put(ch);
+		}
+		else if (ch < 0x20)
+		{
+			o.puts("\\u00");
+			o.put(hex[ch >> 4]);
+			o.put(hex[ch & 0xf]);
+		}
+		else
+			o.put(ch);
+	}
+	o.put('"');
+}
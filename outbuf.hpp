@@ -0,0 +1,163 @@
+// outbuf.hpp
+//
+// Class for buffered output to a file descriptor.  Collects output in a
+// large buffer, and hands it to the operating system in big chunks with
+// write(2).  This is much cheaper than going through an iostream one
+// small piece at a time, which matters when the output is a listing
+// with millions of names in it; and a program that doesn't use iostreams
+// at all doesn't pay for their initialization at startup.
+//
+// If built with LF_OUTBUF_STDIO defined, the chunks are handed to stdio
+// with fwrite() instead of going straight to write(2).  That is slower,
+// but works anywhere there is a C library.
+//
+// An outbuf flushes itself when it is destroyed, but if you care about
+// errors (or about the ordering of output relative to some other
+// stream) you should call flush() yourself.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// outbuf out(1);	// buffer output to standard output
+//
+// out.puts("hello");
+// out.put('\n');
+// out << "count: " << count << '\n';
+// out.flush();
+
+
+
+#ifndef OUTBUF_HPP
+
+#define OUTBUF_HPP
+
+
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "util.hpp"
+
+
+
+class outbuf
+{
+	private:
+		int fd;	// file descriptor to write to
+#ifdef LF_OUTBUF_STDIO
+		FILE *fp;	// stdio stream for fd
+#endif
+		char *buf;	// the buffer
+		size_t cap;	// size of the buffer
+		size_t len;	// how much of the buffer is in use
+		bool failed;	// true if any write(2) has failed
+
+		// not copyable
+		outbuf(const outbuf& rhs);
+		outbuf& operator=(const outbuf& rhs);
+
+		void write_fd(const char *p, size_t n);
+
+	public:
+		outbuf(int fd, size_t cap = 64 * 1024);
+		~outbuf();
+
+		void write(const void *p, size_t n);
+		void put(char ch);
+		void puts(CSZ csz);
+		void puts(CSREF s);
+		void putnum(long n);
+
+		// writes out anything in the buffer; returns false on error
+		bool flush();
+
+		// true if no write has failed so far
+		bool good() const { return !failed; }
+};
+
+
+
+// operator<<()
+//
+// So an outbuf can be used in place of cout for simple messages:
+// out << "width: " << width << '\n';
+
+inline outbuf&
+operator<<(outbuf& o, CSZ csz)
+{
+	o.puts(csz);
+	return o;
+}
+
+inline outbuf&
+operator<<(outbuf& o, CSREF s)
+{
+	o.puts(s);
+	return o;
+}
+
+inline outbuf&
+operator<<(outbuf& o, char ch)
+{
+	o.put(ch);
+	return o;
+}
+
+inline outbuf&
+operator<<(outbuf& o, long n)
+{
+	o.putnum(n);
+	return o;
+}
+
+inline outbuf&
+operator<<(outbuf& o, int n)
+{
+	o.putnum(n);
+	return o;
+}
+
+
+
+// PutJsonString()
+//
+// Writes a string as a quoted JSON string.  Shared by the JSON Lines
+// output and the trace file.
+
+void PutJsonString(outbuf& o, CSZ s, size_t len);
+
+inline void
+PutJsonString(outbuf& o, CSZ csz)
+{
+	PutJsonString(o, csz, strlen(csz));
+}
+
+inline void
+PutJsonString(outbuf& o, CSREF s)
+{
+	PutJsonString(o, s.data(), s.length());
+}
+
+
+
+// put()
+//
+// Appends one character.  Inline, because it's called once per
+// character in some of the output paths.
+
+inline void
+outbuf::put(char ch)
+{
+	if (len == cap)
+		flush();
+
+	buf[len++] = ch;
+}
+
+
+
+#endif // OUTBUF_HPP
@@ -0,0 +1,113 @@
+// phash.cpp
+//
+// Class for a perfect hash table.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cstring>
+
+
+#include "phash.hpp"
+
+using namespace std;
+
+
+
+// How many seeds to try for one table size before doubling the size.
+// With the table at least twice as big as the number of keys, a good
+// seed usually turns up within a few dozen tries.
+
+const uint32_t seeds_per_size = 256;
+
+
+
+perfect_hash::perfect_hash()
+{
+	seed = 0;
+	mask = 0;
+}
+
+
+
+void
+perfect_hash::Add(CSREF key, int value)
+{
+	entry e;
+
+	e.key = key;
+	e.value = value;
+	entries.push_back(e);
+
+	slots.clear();	// must Build() again
+}
+
+
+
+// TryBuild()
+//
+// Fills in the slots using one seed and table size.  Returns false if
+// two keys land in the same slot.
+
+bool
+perfect_hash::TryBuild(uint32_t seed_try, uint32_t mask_try)
+{
+	seed = seed_try;
+	mask = mask_try;
+	slots.assign(mask + 1, -1);
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		CSREF key = entries[i].key;
+		int& slot = slots[Hash(key.data(), key.length()) & mask];
+
+		if (slot >= 0)
+			return false;
+
+		slot = i;
+	}
+
+	return true;
+}
+
+
+
+// Build()
+//
+// Searches for a seed and a table size that give every key a slot of
+// its own.  Since the keys are all different, a big enough table always
+// works eventually.
+
+bool
+perfect_hash::Build()
+{
+	// reject duplicate keys, or the search below would never end
+	for (size_t i = 0; i < entries.size(); ++i)
+		for (size_t j = i + 1; j < entries.size(); ++j)
+			if (entries[i].key == entries[j].key)
+				return false;
+
+	uint32_t size = 4;
+	while (size < 2 * entries.size())
+		size *= 2;
+
+	for (;;)
+	{
+		for (uint32_t s = 0; s < seeds_per_size; ++s)
+			if (TryBuild(s * 0x9e3779b9u, size - 1))
+				return true;
+
+		size *= 2;
+	}
+}
+
+
+
+int
+perfect_hash::Lookup(CSZ csz) const
+{
+	return Lookup(csz, strlen(csz));
+}
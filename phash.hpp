@@ -0,0 +1,122 @@
+// phash.hpp
+//
+// Class for a perfect hash table: a static table for a set of string
+// keys that are all known before the first lookup.  Build() searches for
+// a hash seed that sends every key to a slot of its own, so a lookup
+// costs one hash of the key and at most one string compare, no matter
+// how many keys there are.
+//
+// This is meant for small, fixed sets of keys such as the option names
+// of a language, where the table is built once and used many times.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// perfect_hash ph;
+//
+// ph.Add("--help", 1);
+// ph.Add("--version", 2);
+// ph.Build();
+//
+// int v = ph.Lookup(arg);	// -1 if arg is not a key
+
+
+
+#ifndef PHASH_HPP
+
+#define PHASH_HPP
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+
+
+class perfect_hash
+{
+	private:
+		struct entry
+		{
+			std::string key;
+			int value;
+		};
+
+		std::vector<entry> entries;	// keys, in the order added
+		std::vector<int> slots;	// index into entries, or -1 if empty
+		uint32_t seed;
+		uint32_t mask;	// table size - 1; the size is a power of 2
+
+		uint32_t Hash(CSZ p, size_t len) const;
+		bool TryBuild(uint32_t seed_try, uint32_t mask_try);
+
+	public:
+		perfect_hash();
+
+		// Add() keys, then Build() once before any Lookup()
+		void Add(CSREF key, int value);
+		bool Build();	// returns false if the same key was added twice
+
+		// returns the value for a key, or -1 if it is not a key
+		int Lookup(CSZ p, size_t len) const;
+		int Lookup(CSZ csz) const;
+
+		bool built() const { return !slots.empty(); }
+		size_t size() const { return entries.size(); }
+};
+
+
+
+// Hash()
+//
+// FNV-1a, with the seed mixed into the starting value, and a final
+// shift so the high bits have some say in the low bits used as the slot.
+
+inline uint32_t
+perfect_hash::Hash(CSZ p, size_t len) const
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= static_cast<unsigned char>(p[i]);
+		h *= 16777619u;
+	}
+
+	return h ^ (h >> 15);
+}
+
+
+
+// Lookup()
+//
+// Inline, because it is called in loops over arguments and names.
+
+inline int
+perfect_hash::Lookup(CSZ p, size_t len) const
+{
+	if (slots.empty())
+		return -1;
+
+	int i = slots[Hash(p, len) & mask];
+	if (i < 0)
+		return -1;
+
+	const entry& e = entries[i];
+	if (e.key.length() != len || e.key.compare(0, len, p, len) != 0)
+		return -1;
+
+	return e.value;
+}
+
+
+
+#endif // PHASH_HPP
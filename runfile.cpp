@@ -0,0 +1,161 @@
+// runfile.cpp
+//
+// Run files: temporary files of sorted records, for lf --mem-limit.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cstring>
+
+// for mkstemp(), unlink(), read(), lseek()
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+#include "runfile.hpp"
+
+using namespace std;
+
+
+
+int
+RunFileCreate()
+{
+	CSZ dir = getenv("TMPDIR");
+	if (dir == NULL || *dir == '\0')
+		dir = "/tmp";
+
+	string path = MakeFullPathName("lf-run.XXXXXX", dir);
+	int fd = mkstemp(&path[0]);
+	if (fd < 0)
+		return -1;
+
+	// the name isn't needed; the file goes away when fd is closed
+	unlink(path.c_str());
+	return fd;
+}
+
+
+
+void
+PutLfbinRecord(outbuf& o, lfbin_kind kind, CSREF ext, CSREF name)
+{
+	static const char zeros[lfbin_align] = { 0 };
+	unsigned char rec[lfbin_record_len];
+
+	rec[0] = kind;
+	rec[1] = 0;
+	PutLE16(rec + 2, ext.length());
+	PutLE32(rec + 4, name.length());
+
+	o.write(rec, sizeof(rec));
+	o.puts(ext);
+	o.puts(name);
+	o.write(zeros, LfbinPadding(ext.length(), name.length()));
+}
+
+
+
+// constructor and destructor
+
+run_reader::run_reader(int fd_in, size_t cap_buf)
+{
+	fd = fd_in;
+	cap = cap_buf;
+	pos = 0;
+	len = 0;
+	failed = (lseek(fd, 0, SEEK_SET) != 0);
+
+	if (cap < lfbin_record_len)
+		cap = lfbin_record_len;
+	buf = new char[cap];
+}
+
+
+
+run_reader::~run_reader()
+{
+	delete[] buf;
+}
+
+
+
+// Fill()
+//
+// Makes sure there are at least n bytes in the buffer from pos on,
+// reading more of the file if needed, and growing the buffer for a
+// record bigger than it.  Returns false if the file ends first.
+
+bool
+run_reader::Fill(size_t n)
+{
+	if (len - pos >= n)
+		return true;
+
+	// move what's left to the front, to make room
+	memmove(buf, buf + pos, len - pos);
+	len -= pos;
+	pos = 0;
+
+	if (n > cap)
+	{
+		char *p = new char[n];
+		memcpy(p, buf, len);
+		delete[] buf;
+		buf = p;
+		cap = n;
+	}
+
+	while (len < n && !failed)
+	{
+		ssize_t rc = read(fd, buf + len, cap - len);
+		if (rc < 0)
+		{
+			if (errno != EINTR)
+				failed = true;
+		}
+		else if (rc == 0)
+			break;
+		else
+			len += rc;
+	}
+
+	return len >= n;
+}
+
+
+
+bool
+run_reader::Next()
+{
+	if (!Fill(lfbin_record_len))
+	{
+		if (len != pos)
+			failed = true;	// the file ends inside a record
+		return false;
+	}
+
+	const unsigned char *rec = (const unsigned char *)buf + pos;
+	uint32_t ext_len = GetLE16(rec + 2);
+	uint32_t name_len = GetLE32(rec + 4);
+	size_t rec_len = lfbin_record_len + ext_len + name_len
+			+ LfbinPadding(ext_len, name_len);
+
+	if (!Fill(rec_len))
+	{
+		failed = true;
+		return false;
+	}
+
+	rec = (const unsigned char *)buf + pos;	// Fill() may have moved it
+	kind = lfbin_kind(rec[0]);
+	ext.assign(buf + pos + lfbin_record_len, ext_len);
+	name.assign(buf + pos + lfbin_record_len + ext_len, name_len);
+
+	pos += rec_len;
+	return true;
+}
@@ -0,0 +1,98 @@
+// runfile.hpp
+//
+// Run files: temporary files of sorted (kind, extension, name) records,
+// for lf --mem-limit.  When the names read so far would take more memory
+// than allowed, lf sorts them and writes them out as a run, and at the
+// end it merges all the runs together to print the listing.
+//
+// A run file holds records in the layout of lf --format=bin (see
+// lfbin.hpp), without the header.  Run files are removed from their
+// directory as soon as they are created, so the space they take is given
+// back when lf exits, however it exits: even if it is killed by a signal,
+// nothing is left behind.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// int fd = RunFileCreate();
+// if (fd < 0)
+//	error...
+// {
+//	outbuf o(fd);
+//	PutLfbinRecord(o, lfbin_file, "c", "main");
+//	o.flush();
+// }
+//
+// run_reader r(fd);
+// while (r.Next())
+//	do something with r.kind, r.ext and r.name...
+
+
+
+#ifndef RUNFILE_HPP
+
+#define RUNFILE_HPP
+
+
+
+#include <string>
+
+#include "lfbin.hpp"
+#include "outbuf.hpp"
+#include "util.hpp"
+
+
+
+// Makes a new, empty run file in $TMPDIR (or /tmp) and returns a file
+// descriptor open for reading and writing, or -1 on error.
+int RunFileCreate();
+
+// Writes one record in the lfbin layout.
+void PutLfbinRecord(outbuf& o, lfbin_kind kind, CSREF ext, CSREF name);
+
+
+
+// run_reader
+//
+// Reads the records of a run file back, from the start, in big chunks.
+// The file descriptor still belongs to the caller; the same run can be
+// read again with another run_reader.
+
+class run_reader
+{
+	private:
+		int fd;
+		char *buf;	// the buffer
+		size_t cap;	// size of the buffer
+		size_t pos;	// start of the next record in the buffer
+		size_t len;	// how much of the buffer is filled
+		bool failed;
+
+		// not copyable
+		run_reader(const run_reader& rhs);
+		run_reader& operator=(const run_reader& rhs);
+
+		bool Fill(size_t n);
+
+	public:
+		run_reader(int fd, size_t cap = 64 * 1024);
+		~run_reader();
+
+		// reads the next record; returns false at the end or on error
+		bool Next();
+
+		// true if a read has failed, or the file ends inside a record
+		bool good() const { return !failed; }
+
+		// the record Next() read
+		lfbin_kind kind;
+		std::string ext;
+		std::string name;
+};
+
+
+
+#endif // RUNFILE_HPP
@@ -0,0 +1,349 @@
+// shellword.cpp
+//
+// Class to split a string into words the way a shell would.
+//
+// See the header file for example code of how to call this, and for
+// what parts of shell syntax are supported.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+
+#include "shellword.hpp"
+
+using namespace std;
+
+
+
+namespace	// begin unnamed namespace
+{
+
+
+inline bool
+IsBlank(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\n';
+}
+
+
+
+inline bool
+IsNameChar(char ch)
+{
+	return isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+}
+
+
+
+// word_writer
+//
+// Collects the characters of the words.  With a null argv it just
+// counts words and bytes, which is how Scan() finds out how big a block
+// to allocate; with an argv it stores the words too.
+
+class word_writer
+{
+	private:
+		char **argv;
+		char *p;
+		bool in_word;
+
+	public:
+		int words;
+		size_t bytes;
+
+		word_writer(char **argv_out, char *words_out)
+		{
+			argv = argv_out;
+			p = words_out;
+			in_word = false;
+			words = 0;
+			bytes = 0;
+		}
+
+		// BeginWord() starts a word even if no characters follow, as
+		// for an empty quoted string ""
+		void BeginWord()
+		{
+			if (in_word)
+				return;
+
+			if (argv)
+				argv[words] = p;
+			++words;
+			in_word = true;
+		}
+
+		void Put(char ch)
+		{
+			BeginWord();
+			if (argv)
+				*p++ = ch;
+			++bytes;
+		}
+
+		void EndWord()
+		{
+			if (!in_word)
+				return;
+
+			if (argv)
+				*p++ = '\0';
+			++bytes;
+			in_word = false;
+		}
+};
+
+
+
+// Expand()
+//
+// Handles a '$' at p: copies the value of the variable to the word
+// writer, and advances p past the variable reference.  An unquoted
+// value is split into words at whitespace.  A '$' that doesn't start a
+// variable reference is just a '$'.
+
+SHW
+Expand(CSZ& p, word_writer& w, bool quoted)
+{
+	Assert(*p == '$');
+	++p;
+
+	if (*p == '(')
+		return shw_cmdsub;
+
+	CSZ name_b;
+	CSZ name_e;
+
+	if (*p == '{')
+	{
+		name_b = ++p;
+		while (*p != '}')
+		{
+			if (*p == '\0')
+				return shw_syntax;
+			++p;
+		}
+		name_e = p++;	// skip '}'
+	}
+	else
+	{
+		name_b = p;
+		while (IsNameChar(*p))
+			++p;
+		name_e = p;
+	}
+
+	if (name_b == name_e)
+	{
+		w.Put('$');
+		return shw_success;
+	}
+
+	// copy the name to NUL-terminate it; no variable has a huge name
+	char name[256];
+	size_t len = name_e - name_b;
+	if (len >= sizeof(name))
+		return shw_success;
+	memcpy(name, name_b, len);
+	name[len] = '\0';
+
+	CSZ value = getenv(name);
+	if (value == NULL)
+		return shw_success;
+
+	for (CSZ q = value; *q != '\0'; ++q)
+	{
+		if (!quoted && IsBlank(*q))
+			w.EndWord();
+		else
+			w.Put(*q);
+	}
+
+	return shw_success;
+}
+
+
+} // end unnamed namespace
+
+
+
+// constructors and destructor
+
+shellword::shellword()
+{
+	block = 0;
+	word_count = 0;
+	shw_status = shw_syntax;
+}
+
+
+
+shellword::shellword(CSZ csz)
+{
+	block = 0;
+	shellword::parse(csz);
+}
+
+
+
+shellword::shellword(CSREF s)
+{
+	block = 0;
+	shellword::parse(s);
+}
+
+
+
+shellword::~shellword()
+{
+	delete[] block;
+}
+
+
+
+// Scan()
+//
+// Does the actual work of splitting the last string parsed into words.
+// If argv_out is null, only counts the words and the bytes they need.
+
+SHW
+shellword::Scan(char **argv_out, char *words_out, int& words,
+		size_t& bytes) const
+{
+	word_writer w(argv_out, words_out);
+	CSZ p = s.c_str();
+	SHW rc = shw_success;
+
+	while (*p != '\0' && rc == shw_success)
+	{
+		char ch = *p;
+
+		if (IsBlank(ch))
+		{
+			w.EndWord();
+			++p;
+		}
+		else if (ch == '\\')
+		{
+			if (p[1] == '\0')
+				return shw_syntax;
+			w.Put(p[1]);
+			p += 2;
+		}
+		else if (ch == '\'')
+		{
+			// everything up to the next single quote is literal
+			w.BeginWord();
+			for (++p; *p != '\'' ; ++p)
+			{
+				if (*p == '\0')
+					return shw_syntax;
+				w.Put(*p);
+			}
+			++p;
+		}
+		else if (ch == '"')
+		{
+			// variables are expanded, and a backslash only escapes the
+			// characters that are special inside double quotes
+			w.BeginWord();
+			for (++p; *p != '"' && rc == shw_success; )
+			{
+				if (*p == '\0')
+					return shw_syntax;
+				else if (*p == '`')
+					return shw_cmdsub;
+				else if (*p == '$')
+					rc = Expand(p, w, true);
+				else if (*p == '\\' && p[1] != '\0'
+						&& strchr("$`\"\\\n", p[1]) != NULL)
+				{
+					w.Put(p[1]);
+					p += 2;
+				}
+				else
+					w.Put(*p++);
+			}
+			++p;
+		}
+		else if (ch == '`')
+			return shw_cmdsub;
+		else if (ch == '$')
+			rc = Expand(p, w, false);
+		else
+		{
+			w.Put(ch);
+			++p;
+		}
+	}
+
+	w.EndWord();
+
+	words = w.words;
+	bytes = w.bytes;
+	return rc;
+}
+
+
+
+// parse()
+//
+// Splits a string into words.  The first pass counts, then the argv
+// array and all the words are stored in a single block by the second.
+
+void
+shellword::parse(CSREF s_parse)
+{
+	s = s_parse;
+
+	delete[] block;
+	block = 0;
+	word_count = 0;
+
+	int words;
+	size_t bytes;
+
+	shw_status = Scan(0, 0, words, bytes);
+	if (shw_status != shw_success)
+		return;
+
+	// argv array (with a null pointer at the end), then the words
+	size_t argv_bytes = (words + 1) * sizeof(char *);
+	block = new char[argv_bytes + bytes];
+
+	char **argv_out = reinterpret_cast<char **>(block);
+	Scan(argv_out, block + argv_bytes, words, bytes);
+	argv_out[words] = 0;
+
+	word_count = words;
+}
+
+
+
+void
+shellword::parse(CSZ csz)
+{
+	if (csz == NULL)
+		shellword::parse(string());
+	else
+		shellword::parse(string(csz));
+}
+
+
+
+// argv()
+//
+// Returns the words found by the last parse, or a null pointer if the
+// last parse failed.
+
+ARGV
+shellword::argv() const
+{
+	return reinterpret_cast<ARGV>(block);
+}
@@ -0,0 +1,94 @@
+// shellword.hpp
+//
+// Class to split a string into words the way a shell would, without
+// asking a shell (or the C wordexp() function) to do it.  Handles single
+// and double quotes, backslash escapes, and $VAR or ${VAR} environment
+// variable substitution; like the shell, an unquoted substitution is
+// split into words at whitespace.  It never does filename globbing (a
+// '*' is just a '*'), and never runs a command: a backquote or "$(" is
+// a syntax error.
+//
+// The interface matches the wordexp class, so either one can be used to
+// parse LFOPTS.  The difference is cost: this never touches the file
+// system or starts a process, and all the results live in one block of
+// memory, allocated once per parse.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// shellword w(s_cmd_line);	// create object and parse cmd line
+//
+//	if (w.success())
+//		// ...do something with w.argc() and w.argv()
+//  else
+//      // ...handle error from bad cmd line string
+
+
+
+#ifndef SHELLWORD_HPP
+
+#define SHELLWORD_HPP
+
+
+
+#include <cstddef>
+
+#include "util.hpp"
+
+
+
+// SHW: shellword result code enum
+
+enum SHW
+{
+	shw_success = 0,
+	shw_syntax,	// unbalanced quote, or backslash at the very end
+	shw_cmdsub,	// command substitution is not supported
+};
+
+
+
+class shellword
+{
+	private:
+		char *block;	// argv array, then the words themselves
+		int word_count;
+		SHW shw_status;
+		std::string s;	// last string parsed
+
+		// not copyable
+		shellword(const shellword& rhs);
+		shellword& operator=(const shellword& rhs);
+
+		SHW Scan(char **argv_out, char *words_out, int& words,
+				size_t& bytes) const;
+
+	public:
+		shellword();
+		shellword(CSZ csz);
+		shellword(CSREF s);
+		~shellword();
+
+		// you can explicitly call parse() to parse a different string.
+		void parse(CSZ csz="");
+		void parse(CSREF s);
+
+		// status() returns a SHW code with the status of the last parse
+		SHW status() const { return shw_status; }
+		// success() is true if status() is shw_success, false otherwise
+		bool success() const { return shw_status == shw_success; }
+
+		// str() returns the last string parsed
+		CSREF str() const { return s; }
+		// argc() returns how many arguments were found by the parse
+		int argc() const { return word_count; }
+		// argv[] is an array of pointers to the arguments found.
+		ARGV argv() const;
+};
+
+
+
+#endif // SHELLWORD_HPP
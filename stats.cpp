@@ -0,0 +1,671 @@
+// stats.cpp
+//
+// Instrumentation: phase times and event counters.
+//
+// See the header file for how the pieces fit together.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#ifdef LF_ALLOC_PROFILE
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// for backtrace(), dladdr() and demangling call sites
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#endif
+
+// for the CLOCK_ ids and getrusage()
+#include <sys/resource.h>
+#include <time.h>
+
+
+#include "outbuf.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+
+
+#ifndef LF_NO_STATS
+bool stats_enabled = false;
+#endif
+
+
+
+CSZ const stats_phase_name[STATS_PHASES_MAX] =
+{
+	"strings",
+	"lfopts",
+	"options",
+	"locale",
+	"list",
+	"print",
+};
+
+CSZ const stats_timer_name[STATS_TIMERS_MAX] =
+{
+	"classify",
+	"sort",
+};
+
+CSZ const stats_counter_name[STATS_COUNTERS_MAX] =
+{
+	"dir_entries",
+	"readdir_calls",
+	"stat_calls",
+	"ignored",
+	"names_read",
+	"index_dirs",
+	"index_stale",
+	"compares",
+	"allocs",
+	"alloc_bytes",
+};
+
+
+
+namespace	// begin unnamed namespace
+{
+
+
+// Phases are only ever switched by the main thread, so they need no
+// locking.
+
+int phase_current = -1;	// -1: no phase running
+long phase_wall0;	// when the current phase started
+long phase_cpu0;
+long phase_wall_ns[STATS_PHASES_MAX];
+long phase_cpu_ns[STATS_PHASES_MAX];
+
+
+
+// Counters and timers are kept per thread, so threads never fight over
+// a cache line.  When a thread exits, it adds its totals into the
+// global totals; the report adds in the main thread's own totals.
+
+mutex totals_mutex;
+long total_counters[STATS_COUNTERS_MAX];
+long total_timers_ns[STATS_TIMERS_MAX];
+
+struct thread_totals
+{
+	long counters[STATS_COUNTERS_MAX];
+	long timers_ns[STATS_TIMERS_MAX];
+
+	thread_totals()
+	{
+		for (int i = 0; i < STATS_COUNTERS_MAX; ++i)
+			counters[i] = 0;
+		for (int i = 0; i < STATS_TIMERS_MAX; ++i)
+			timers_ns[i] = 0;
+	}
+
+	~thread_totals()
+	{
+		lock_guard<mutex> lock(totals_mutex);
+
+		for (int i = 0; i < STATS_COUNTERS_MAX; ++i)
+			total_counters[i] += counters[i];
+		for (int i = 0; i < STATS_TIMERS_MAX; ++i)
+			total_timers_ns[i] += timers_ns[i];
+	}
+};
+
+thread_local thread_totals this_thread_totals;
+
+
+#ifdef LF_ALLOC_PROFILE
+// Allocation profile
+//
+// Every allocation is charged to the phase running at the time, and to
+// its call site: the first return address on the stack that is in lf
+// itself and not in the C++ library or in a library template.  Taking
+// a backtrace is slow, which is why this is a build option and not
+// something --stats does.
+
+const int phase_other = STATS_PHASES_MAX;	// before or after all phases
+
+long phase_allocs[STATS_PHASES_MAX + 1];
+long phase_bytes[STATS_PHASES_MAX + 1];
+long phase_frees[STATS_PHASES_MAX + 1];
+
+struct alloc_site
+{
+	void *pc;	// 0 means the slot is free
+	int phase;
+	long allocs;
+	long bytes;
+};
+
+// open addressing; sites that don't fit are only counted per phase
+const size_t alloc_sites_max = 4096;
+alloc_site alloc_sites[alloc_sites_max];
+
+mutex alloc_mutex;
+const void *exe_base;	// where lf itself is loaded
+
+// set while inside the hook or the report, so that anything they
+// allocate themselves is not counted
+thread_local bool in_alloc_hook;
+
+
+
+// IsLibrarySymbol()
+//
+// True for a mangled name in namespace std or __gnu_cxx: the string and
+// container code that does an allocation for some function of lf's.
+
+bool
+IsLibrarySymbol(CSZ sname)
+{
+	static CSZ const prefixes[] =
+	{
+		"_ZNSt", "_ZNKSt", "_ZSt", "_ZN9__gnu_cxx", "_ZNK9__gnu_cxx",
+	};
+
+	for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i)
+		if (strncmp(sname, prefixes[i], strlen(prefixes[i])) == 0)
+			return true;
+
+	return false;
+}
+
+
+
+bool
+IsOperatorNew(CSZ sname)
+{
+	return strncmp(sname, "_Znw", 4) == 0 || strncmp(sname, "_Zna", 4) == 0;
+}
+
+
+
+// frame_cache
+//
+// What each return address seen in a backtrace turned out to be.
+// dladdr() is far too slow to call for every frame of every allocation,
+// but a run only has a few hundred distinct return addresses.
+
+enum frame_kind { fk_unknown, fk_new, fk_other, fk_lf };
+
+struct frame_cache_entry
+{
+	void *pc;
+	frame_kind kind;
+};
+
+const size_t frame_cache_max = 16384;
+frame_cache_entry frame_cache[frame_cache_max];
+
+
+
+frame_kind
+ClassifyFrame(void *pc)
+{
+	Dl_info info;
+
+	if (dladdr(pc, &info) == 0)
+		return fk_other;
+	if (info.dli_sname != NULL && IsOperatorNew(info.dli_sname))
+		return fk_new;
+	if (info.dli_fbase != exe_base)
+		return fk_other;
+	if (info.dli_sname != NULL && IsLibrarySymbol(info.dli_sname))
+		return fk_other;
+
+	return fk_lf;
+}
+
+
+
+// FrameKind()
+//
+// ClassifyFrame(), through the cache.  Call with alloc_mutex held.
+
+frame_kind
+FrameKind(void *pc)
+{
+	size_t h = (reinterpret_cast<size_t>(pc) >> 2) * 2654435761u;
+
+	for (size_t probe = 0; probe < frame_cache_max; ++probe)
+	{
+		frame_cache_entry& e = frame_cache[(h + probe) % frame_cache_max];
+
+		if (e.pc == pc)
+			return e.kind;
+		if (e.pc == 0)
+		{
+			e.pc = pc;
+			e.kind = ClassifyFrame(pc);
+			return e.kind;
+		}
+	}
+
+	return ClassifyFrame(pc);	// cache is full
+}
+
+
+
+// AllocCallSite()
+//
+// Finds the call site to charge an allocation to, or 0 if there is
+// none (an allocation made by the C++ library on its own behalf).
+// Call with alloc_mutex held.
+
+void *
+AllocCallSite(void *frames[], int n)
+{
+	Dl_info info;
+
+	if (exe_base == 0 && dladdr((void *)&IsOperatorNew, &info) != 0)
+		exe_base = info.dli_fbase;
+
+	// skip the hook, and operator new itself (perhaps called from
+	// another form of operator new)
+	int i = 0;
+	while (i < n && FrameKind(frames[i]) != fk_new)
+		++i;
+	while (i < n && FrameKind(frames[i]) == fk_new)
+		++i;
+
+	for (; i < n; ++i)
+		if (FrameKind(frames[i]) == fk_lf)
+			return frames[i];
+
+	return 0;
+}
+
+
+
+void
+AllocProfileNew(size_t n)
+{
+	if (in_alloc_hook)
+		return;
+	in_alloc_hook = true;
+
+	void *frames[16];
+	int frames_n = backtrace(frames, 16);
+	int ph = (phase_current < 0) ? phase_other : phase_current;
+
+	lock_guard<mutex> lock(alloc_mutex);
+
+	void *pc = AllocCallSite(frames, frames_n);
+
+	++phase_allocs[ph];
+	phase_bytes[ph] += n;
+
+	size_t h = (reinterpret_cast<size_t>(pc) >> 2) * 2654435761u + ph;
+	for (size_t probe = 0; pc != 0 && probe < alloc_sites_max; ++probe)
+	{
+		alloc_site& site = alloc_sites[(h + probe) % alloc_sites_max];
+
+		if (site.pc == 0)
+		{
+			site.pc = pc;
+			site.phase = ph;
+		}
+		if (site.pc == pc && site.phase == ph)
+		{
+			++site.allocs;
+			site.bytes += n;
+			break;
+		}
+	}
+
+	in_alloc_hook = false;
+}
+
+
+
+void
+AllocProfileDelete()
+{
+	if (in_alloc_hook)
+		return;
+
+	int ph = (phase_current < 0) ? phase_other : phase_current;
+
+	lock_guard<mutex> lock(alloc_mutex);
+	++phase_frees[ph];
+}
+
+
+
+CSZ
+PhaseName(int ph)
+{
+	return (ph == phase_other) ? "other" : stats_phase_name[ph];
+}
+
+
+
+bool
+MoreAllocs(const alloc_site *p0, const alloc_site *p1)
+{
+	return p0->allocs > p1->allocs;
+}
+
+
+
+// AllocReport()
+//
+// Does the work of StatsAllocReport().  Anything this allocates is not
+// counted, and must be freed before the caller turns counting back on.
+
+void
+AllocReport(outbuf& o, int sites_max)
+{
+	char buf[256];
+
+	lock_guard<mutex> lock(alloc_mutex);
+
+	snprintf(buf, sizeof(buf), "allocs: %-10s %10s %12s %10s\n",
+			"phase", "allocs", "bytes", "frees");
+	o << buf;
+	for (int ph = 0; ph <= phase_other; ++ph)
+	{
+		snprintf(buf, sizeof(buf), "allocs: %-10s %10ld %12ld %10ld\n",
+				PhaseName(ph), phase_allocs[ph], phase_bytes[ph],
+				phase_frees[ph]);
+		o << buf;
+	}
+
+	long entries = total_counters[sc_dir_entries]
+			+ this_thread_totals.counters[sc_dir_entries];
+	if (entries > 0)
+	{
+		const int per_entry[] = { sp_list, sp_print };
+
+		for (int i = 0; i < 2; ++i)
+		{
+			int ph = per_entry[i];
+			snprintf(buf, sizeof(buf), "allocs: %-10s %10.3f allocations,"
+					" %.1f bytes per directory entry\n", PhaseName(ph),
+					double(phase_allocs[ph]) / entries,
+					double(phase_bytes[ph]) / entries);
+			o << buf;
+		}
+	}
+
+	vector<const alloc_site *> sites;
+	for (size_t i = 0; i < alloc_sites_max; ++i)
+		if (alloc_sites[i].pc != 0)
+			sites.push_back(&alloc_sites[i]);
+	sort(sites.begin(), sites.end(), MoreAllocs);
+
+	o << "allocs: top call sites:\n";
+	for (size_t i = 0; i < sites.size() && int(i) < sites_max; ++i)
+	{
+		const alloc_site& site = *sites[i];
+		Dl_info info;
+		CSZ name = "?";
+		char *demangled = 0;
+		long offset = 0;
+
+		if (dladdr(site.pc, &info) != 0 && info.dli_sname != NULL)
+		{
+			int status;
+			demangled = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+			name = demangled ? demangled : info.dli_sname;
+
+			// the argument types make the lines far too long
+			if (demangled != 0 && strchr(demangled, '(') != NULL)
+				*strchr(demangled, '(') = '\0';
+			offset = (char *)site.pc - (char *)info.dli_saddr;
+		}
+
+		// the address relative to lf's load address is what addr2line
+		// wants, for an unstripped build
+		snprintf(buf, sizeof(buf), "allocs: %10ld %12ld %-8s 0x%lx ",
+				site.allocs, site.bytes, PhaseName(site.phase),
+				long((char *)site.pc - (char *)exe_base));
+		o << buf << name;
+		if (offset != 0)
+		{
+			snprintf(buf, sizeof(buf), "+0x%lx", offset);
+			o << buf;
+		}
+		o << '\n';
+
+		free(demangled);
+	}
+}
+#endif // LF_ALLOC_PROFILE
+
+
+} // end unnamed namespace
+
+
+
+long
+StatsNowNs()
+{
+	return ClockNs(CLOCK_MONOTONIC);
+}
+
+
+
+// StatsPhase()
+//
+// Ends the current phase, if any, and starts another one.
+
+void
+StatsPhase(stats_phase ph)
+{
+	StatsEnd();
+
+	phase_current = ph;
+	phase_wall0 = ClockNs(CLOCK_MONOTONIC);
+	phase_cpu0 = ClockNs(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+
+
+// StatsEnd()
+//
+// Ends the current phase.  If tracing is on, the phase goes into the
+// trace as a span.
+
+void
+StatsEnd()
+{
+	if (phase_current < 0)
+		return;
+
+	long wall1 = ClockNs(CLOCK_MONOTONIC);
+	if (trace_enabled)
+		TraceAdd(stats_phase_name[phase_current], NULL, phase_wall0, wall1);
+
+	phase_wall_ns[phase_current] += wall1 - phase_wall0;
+	phase_cpu_ns[phase_current] +=
+			ClockNs(CLOCK_PROCESS_CPUTIME_ID) - phase_cpu0;
+
+	phase_current = -1;
+}
+
+
+
+void
+StatsAdd(stats_counter c, long n)
+{
+	this_thread_totals.counters[c] += n;
+}
+
+
+
+void
+StatsAddTimer(stats_timer t, long ns)
+{
+	this_thread_totals.timers_ns[t] += ns;
+}
+
+
+
+double
+StatsPhaseWallMs(stats_phase ph)
+{
+	return phase_wall_ns[ph] / 1e6;
+}
+
+
+
+double
+StatsPhaseCpuMs(stats_phase ph)
+{
+	return phase_cpu_ns[ph] / 1e6;
+}
+
+
+
+double
+StatsTimerMs(stats_timer t)
+{
+	lock_guard<mutex> lock(totals_mutex);
+
+	return (total_timers_ns[t] + this_thread_totals.timers_ns[t]) / 1e6;
+}
+
+
+
+long
+StatsCounter(stats_counter c)
+{
+	lock_guard<mutex> lock(totals_mutex);
+
+	return total_counters[c] + this_thread_totals.counters[c];
+}
+
+
+
+// StatsPeakRssKb()
+//
+// Returns the most memory the process has had resident at once.
+
+long
+StatsPeakRssKb()
+{
+	rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+
+	return ru.ru_maxrss;	// already in kilobytes on Linux
+}
+
+
+
+#ifndef LF_NO_STATS
+// operator new and operator delete
+//
+// Replacements for the global allocation functions, so allocations can
+// be counted.  The array and sized forms of new and delete are replaced
+// too, and all end up in the plain ones; the library's own versions
+// might not, and then some frees would go unseen by the profile.
+
+void *
+operator new(size_t n)
+{
+#ifdef LF_ALLOC_PROFILE
+	AllocProfileNew(n);
+#endif
+	if (stats_enabled)
+	{
+		StatsAdd(sc_allocs, 1);
+		StatsAdd(sc_alloc_bytes, n);
+	}
+
+	void *p = malloc(n ? n : 1);
+	if (p == 0)
+		throw bad_alloc();
+
+	return p;
+}
+
+
+
+void *
+operator new(size_t n, const nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(n);
+	}
+	catch (...)
+	{
+		return 0;
+	}
+}
+
+
+
+void
+operator delete(void *p) noexcept
+{
+#ifdef LF_ALLOC_PROFILE
+	if (p != 0)
+		AllocProfileDelete();
+#endif
+	free(p);
+}
+
+
+
+void *
+operator new[](size_t n)
+{
+	return operator new(n);
+}
+
+
+
+void
+operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+
+
+void
+operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+
+
+
+void
+operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+#endif // LF_NO_STATS
+
+
+
+#ifdef LF_ALLOC_PROFILE
+// StatsAllocReport()
+//
+// Prints the allocation profile: totals for each phase, allocations
+// per directory entry, and the call sites that allocate the most.
+
+void
+StatsAllocReport(outbuf& o, int sites_max)
+{
+	in_alloc_hook = true;
+	AllocReport(o, sites_max);
+	in_alloc_hook = false;
+}
+#endif // LF_ALLOC_PROFILE
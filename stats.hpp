@@ -0,0 +1,158 @@
+// stats.hpp
+//
+// Instrumentation: how long lf spends in each phase of its work, and
+// counters of the expensive things it does (reading directory entries,
+// calling stat(), comparing names, allocating memory).
+//
+// There are three kinds of measurement:
+//
+// phases
+//		The top-level steps of a run, in order.  The main thread calls
+//		StatsPhase() when each one starts, and StatsEnd() at the end.
+//		Each phase gets wall-clock and CPU time.  Switching phases is a
+//		couple of clock reads, so it is always done.
+//
+// timers
+//		Wall-clock time spent in some piece of work that happens over
+//		and over inside a phase, such as classifying one name.  Timed
+//		with a stats_timer_guard; time from several threads adds up.
+//
+// counters
+//		Counts of events, kept per thread and added up at the end.
+//
+// Timers and counters are only kept if stats_enabled is true, so when
+// nobody asked for a report they cost one well-predicted branch.  If
+// built with LF_NO_STATS defined, stats_enabled is the constant false,
+// and the compiler throws the instrumentation away entirely.
+//
+// If built with LF_ALLOC_PROFILE defined, every allocation is also
+// charged to the current phase and to its call site, and
+// StatsAllocReport() prints the profile.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#ifndef STATS_HPP
+
+#define STATS_HPP
+
+
+
+#include "util.hpp"
+
+
+
+enum stats_phase
+{
+	sp_strings,
+	sp_lfopts,
+	sp_options,
+	sp_locale,
+	sp_list,
+	sp_print,
+	STATS_PHASES_MAX,
+};
+
+enum stats_timer
+{
+	st_classify,
+	st_sort,
+	STATS_TIMERS_MAX,
+};
+
+enum stats_counter
+{
+	sc_dir_entries,
+	sc_readdir_calls,
+	sc_stat_calls,
+	sc_ignored,
+	sc_names_read,
+	sc_index_dirs,
+	sc_index_stale,
+	sc_compares,
+	sc_allocs,
+	sc_alloc_bytes,
+	STATS_COUNTERS_MAX,
+};
+
+
+
+#ifdef LF_NO_STATS
+const bool stats_enabled = false;
+#else
+extern bool stats_enabled;
+#endif
+
+
+
+// names for reports; not translated, since they are identifiers
+extern CSZ const stats_phase_name[STATS_PHASES_MAX];
+extern CSZ const stats_timer_name[STATS_TIMERS_MAX];
+extern CSZ const stats_counter_name[STATS_COUNTERS_MAX];
+
+
+
+void StatsPhase(stats_phase ph);
+void StatsEnd();
+
+void StatsAdd(stats_counter c, long n);
+void StatsAddTimer(stats_timer t, long ns);
+long StatsNowNs();
+
+// results, for the report
+double StatsPhaseWallMs(stats_phase ph);
+double StatsPhaseCpuMs(stats_phase ph);
+double StatsTimerMs(stats_timer t);
+long StatsCounter(stats_counter c);
+long StatsPeakRssKb();
+
+#ifdef LF_ALLOC_PROFILE
+class outbuf;
+void StatsAllocReport(outbuf& o, int sites_max);
+#endif
+
+
+
+// StatsInc()
+//
+// Counts one event.  This is the call to put in hot paths.
+
+inline void
+StatsInc(stats_counter c)
+{
+	if (stats_enabled)
+		StatsAdd(c, 1);
+}
+
+
+
+// stats_timer_guard
+//
+// Times the rest of the enclosing block, and adds the time to a timer.
+//
+// stats_timer_guard g(st_sort);
+
+class stats_timer_guard
+{
+	private:
+		stats_timer t;
+		long ns0;
+
+	public:
+		explicit stats_timer_guard(stats_timer timer)
+		{
+			t = timer;
+			ns0 = stats_enabled ? StatsNowNs() : 0;
+		}
+
+		~stats_timer_guard()
+		{
+			if (stats_enabled)
+				StatsAddTimer(t, StatsNowNs() - ns0);
+		}
+};
+
+
+
+#endif // STATS_HPP
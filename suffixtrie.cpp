@@ -0,0 +1,332 @@
+// suffixtrie.cpp
+//
+// Compound extensions, matched with a trie of the rules spelled
+// backwards.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cstring>
+
+// for open(), read()
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#include "suffixtrie.hpp"
+
+using namespace std;
+
+
+
+const char ch_dot = '.';
+const char ch_hash = '#';
+
+static const string s_number("N");	// a part that matches a number
+static const string s_blanks(" \t\r");
+
+
+
+inline bool
+IsDigit(char ch)
+{
+	return ch >= '0' && ch <= '9';
+}
+
+
+
+// SkipNumber()
+//
+// Given that the byte before i in name is a digit, steps back over the
+// whole number ending there, including any dots between its digits, and
+// returns where it starts.
+
+inline int
+SkipNumber(CSZ name, int i)
+{
+	while (i > 0 && IsDigit(name[i - 1]))
+		--i;
+
+	while (i > 1 && name[i - 1] == ch_dot && IsDigit(name[i - 2]))
+	{
+		--i;
+		while (i > 0 && IsDigit(name[i - 1]))
+			--i;
+	}
+
+	return i;
+}
+
+
+
+// constructor
+
+suffix_trie::suffix_trie()
+{
+	memset(byte_class, 0, sizeof(byte_class));
+	classes = 0;
+}
+
+
+
+// suffix_trie::Add()
+//
+// Checks a rule and keeps it for Build().
+
+bool
+suffix_trie::Add(CSREF rule)
+{
+	const size_t start = (!rule.empty() && rule[0] == ch_dot) ? 1 : 0;
+	bool literal = false;
+
+	for (size_t i = start; ; )
+	{
+		size_t j = rule.find(ch_dot, i);
+		if (j == string::npos)
+			j = rule.length();
+		if (j == i)
+			return false;	// empty part
+
+		if (rule.compare(i, j - i, s_number) != 0)
+			literal = true;
+
+		if (j == rule.length())
+			break;
+		i = j + 1;
+	}
+
+	if (!literal || rule.find('\0') != string::npos)
+		return false;
+
+	rules.push_back(rule.substr(start));
+	return true;
+}
+
+
+
+// suffix_trie::NewNode()
+//
+// Adds a node with no edges, and returns its number.
+
+uint32_t
+suffix_trie::NewNode()
+{
+	next.resize(next.size() + classes, 0);
+	number_next.push_back(0);
+	accept.push_back(false);
+
+	return number_next.size() - 1;
+}
+
+
+
+// suffix_trie::Insert()
+//
+// Adds one rule to the trie, from its last byte back to the dot before
+// its first part.
+
+void
+suffix_trie::Insert(CSREF rule)
+{
+	uint32_t node = 0;
+	size_t end = rule.length();
+
+	for (;;)
+	{
+		size_t i = rule.rfind(ch_dot, end - 1);
+		i = (i == string::npos) ? 0 : i + 1;
+
+		if (rule.compare(i, end - i, s_number) == 0)
+		{
+			if (number_next[node] == 0)
+			{
+				uint32_t n = NewNode();
+				number_next[node] = n;
+			}
+			node = number_next[node];
+		}
+		else
+		{
+			for (size_t j = end; j > i; --j)
+			{
+				size_t k = node * classes
+						+ byte_class[(unsigned char)rule[j - 1]];
+				if (next[k] == 0)
+				{
+					uint32_t n = NewNode();
+					next[k] = n;
+				}
+				node = next[k];
+			}
+		}
+
+		// the dot before the part
+		size_t k = node * classes + byte_class[(unsigned char)ch_dot];
+		if (next[k] == 0)
+		{
+			uint32_t n = NewNode();
+			next[k] = n;
+		}
+		node = next[k];
+
+		if (i == 0)
+			break;
+		end = i - 1;
+	}
+
+	accept[node] = true;
+}
+
+
+
+// suffix_trie::Build()
+//
+// Gives each byte used in the rules a class, with the two cases of a
+// letter sharing one, and then builds the trie.  Class 0 is for the
+// bytes in no rule, and never has an edge.
+
+void
+suffix_trie::Build()
+{
+	next.clear();
+	number_next.clear();
+	accept.clear();
+	memset(byte_class, 0, sizeof(byte_class));
+	classes = 1;
+
+	if (rules.empty())
+		return;
+
+	byte_class[(unsigned char)ch_dot] = classes++;
+	for (size_t i = 0; i < rules.size(); ++i)
+	{
+		for (size_t j = 0; j < rules[i].length(); ++j)
+		{
+			unsigned char ch = tolower((unsigned char)rules[i][j]);
+			if (byte_class[ch] != 0)
+				continue;
+
+			byte_class[ch] = classes;
+			byte_class[toupper(ch)] = classes;
+			++classes;
+		}
+	}
+
+	NewNode();	// the root
+	for (size_t i = 0; i < rules.size(); ++i)
+		Insert(rules[i]);
+}
+
+
+
+// suffix_trie::Load()
+//
+// Adds the rules in a file.  Blank lines and lines starting with "#"
+// are skipped; blanks around a rule don't matter.
+
+bool
+suffix_trie::Load(CSREF path, int& bad_line)
+{
+	bad_line = 0;
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	string text;
+	char buf[4096];
+	for (;;)
+	{
+		ssize_t rc = read(fd, buf, sizeof(buf));
+		if (rc < 0)
+		{
+			close(fd);
+			return false;
+		}
+		if (rc == 0)
+			break;
+		text.append(buf, rc);
+	}
+	close(fd);
+
+	int line_number = 0;
+	size_t i = 0;
+	while (i < text.length())
+	{
+		size_t j = text.find('\n', i);
+		if (j == string::npos)
+			j = text.length();
+		++line_number;
+
+		size_t b = text.find_first_not_of(s_blanks, i);
+		if (b < j && text[b] != ch_hash)
+		{
+			size_t e = text.find_last_not_of(s_blanks, j - 1) + 1;
+			if (!Add(text.substr(b, e - b)))
+			{
+				bad_line = line_number;
+				return false;
+			}
+		}
+
+		i = j + 1;
+	}
+
+	return true;
+}
+
+
+
+// suffix_trie::Walk()
+//
+// Walks back through name from i, starting at node, and sets best to
+// the dot that starts the longest match found.  A node with a number
+// edge may have a digit edge too (for "bz2" as well as "so.N"), so the
+// number edge is followed by a recursive call; rules have few "N"
+// parts, so this branches only a few times.
+
+void
+suffix_trie::Walk(uint32_t node, CSZ name, int i, int& best) const
+{
+	for (;;)
+	{
+		if (accept[node] && i > 0 && (best < 0 || i < best))
+			best = i;
+
+		if (number_next[node] != 0 && i > 0 && IsDigit(name[i - 1]))
+			Walk(number_next[node], name, SkipNumber(name, i), best);
+
+		if (i == 0)
+			return;
+
+		uint32_t n = next[node * classes
+				+ byte_class[(unsigned char)name[i - 1]]];
+		if (n == 0)
+			return;
+
+		node = n;
+		--i;
+	}
+}
+
+
+
+// suffix_trie::Match()
+//
+// Returns where the extension starts in name (one past its first dot),
+// or -1.
+
+int
+suffix_trie::Match(CSZ name, int len) const
+{
+	if (empty())
+		return -1;
+
+	int best = -1;
+	Walk(0, name, len, best);
+
+	return (best < 0) ? -1 : best + 1;
+}
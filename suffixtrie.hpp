@@ -0,0 +1,93 @@
+// suffixtrie.hpp
+//
+// Compound extensions, such as ".tar.gz" or ".so.1.2": a set of rules
+// compiled into a trie of the rules spelled backwards, so that a name is
+// matched against all of them in one walk back from its end.
+//
+// A rule is a list of parts separated by dots, such as "tar.gz" (a dot
+// at the start may be given or left out).  A part "N" matches a number,
+// which may itself have dots in it: "so.N" matches ".so.1" and
+// ".so.1.2.3".  Letters match in either case.  Where several rules
+// match a name, the longest match wins, so with "tar.zst" and
+// "pkg.tar.zst" both, "x.pkg.tar.zst" has the extension "pkg.tar.zst".
+//
+// The bytes that appear in rules are sorted into classes, and each node
+// of the trie has one table entry per class, so each byte of a name is
+// one table lookup however many rules there are.  The walk stops at the
+// first byte no rule has at that point, so it costs about as much as
+// the longest extension, not the length of the name.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// suffix_trie trie;
+// trie.Add("tar.gz");
+// trie.Add("so.N");
+// trie.Build();
+//
+// int i = trie.Match("libfoo.so.1.2", 13);
+// if (i > 0)
+//	extension starts at i (here "so.1.2")...
+
+
+
+#ifndef SUFFIXTRIE_HPP
+
+#define SUFFIXTRIE_HPP
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+
+
+class suffix_trie
+{
+	private:
+		std::vector<std::string> rules;	// as given to Add()
+
+		unsigned char byte_class[256];	// 0: in no rule
+		size_t classes;
+		std::vector<uint32_t> next;	// [node][class]: next node, or 0
+		std::vector<uint32_t> number_next;	// [node]: after an "N"
+		std::vector<bool> accept;	// [node]: a rule ends here
+
+		uint32_t NewNode();
+		void Insert(CSREF rule);
+		void Walk(uint32_t node, CSZ name, int i, int& best) const;
+
+	public:
+		suffix_trie();
+
+		// Add() rules, then Build() once; Add() returns false for
+		// something that isn't a rule (an empty part, or no part but
+		// "N"), and leaves it out
+		bool Add(CSREF rule);
+		void Build();
+
+		// reads rules from a file, one per line, with "#" comments;
+		// returns false if the file can't be read (bad_line is 0) or
+		// has a line that isn't a rule (bad_line is its number)
+		bool Load(CSREF path, int& bad_line);
+
+		// returns where the extension starts in name, or -1 if no rule
+		// matches; a match at the start of the name doesn't count
+		int Match(CSZ name, int len) const;
+
+		size_t size() const { return rules.size(); }
+		CSREF rule(size_t i) const { return rules[i]; }
+		bool empty() const { return accept.empty(); }
+};
+
+
+
+#endif // SUFFIXTRIE_HPP
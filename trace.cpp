@@ -0,0 +1,242 @@
+// trace.cpp
+//
+// Tracing: per-thread ring buffers of spans, written out as Chrome
+// trace-event JSON.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// for open(), getpid(), CLOCK_MONOTONIC
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#include "outbuf.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+
+
+long
+TraceNowNs()
+{
+	return ClockNs(CLOCK_MONOTONIC);
+}
+
+
+
+#ifndef LF_NO_STATS
+bool trace_enabled = false;
+#endif
+
+
+
+namespace	// begin unnamed namespace
+{
+
+
+const size_t ring_events = 16384;	// spans kept per thread
+const size_t detail_max = 40;	// longer details are cut short
+
+struct trace_event
+{
+	CSZ name;
+	long ns_begin;
+	long ns_end;
+	char detail[detail_max];
+};
+
+// trace_ring
+//
+// One thread's spans.  Only the owning thread writes to a ring, so it
+// needs no locks; TraceWrite() reads them after the threads are done.
+// Rings are never freed, since the trace is written after the worker
+// threads that filled them have exited.
+
+struct trace_ring
+{
+	int tid;	// small number for the trace, not the kernel's id
+	CSZ thread_name;
+	size_t count;	// spans ever recorded; the ring holds the last ones
+	trace_event events[ring_events];
+};
+
+mutex rings_mutex;
+vector<trace_ring *> rings;
+
+thread_local trace_ring *this_ring;
+
+int fd_trace = -1;
+long ns_start = TraceNowNs();	// time zero: when the program started
+
+
+
+trace_ring *
+ThisRing()
+{
+	if (this_ring == 0)
+	{
+		trace_ring *p = new trace_ring;
+
+		p->thread_name = NULL;
+		p->count = 0;
+
+		lock_guard<mutex> lock(rings_mutex);
+		p->tid = rings.size() + 1;
+		rings.push_back(p);
+		this_ring = p;
+	}
+
+	return this_ring;
+}
+
+
+
+// PutMicroseconds()
+//
+// Trace-event times are in microseconds; keep the nanoseconds as three
+// decimal places.
+
+void
+PutMicroseconds(outbuf& o, long ns)
+{
+	char buf[8];
+
+	o.putnum(ns / 1000);
+	sprintf(buf, ".%03ld", ns % 1000);
+	o.puts(buf);
+}
+
+
+} // end unnamed namespace
+
+
+
+bool
+TraceStart(CSZ path)
+{
+	fd_trace = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd_trace < 0)
+		return false;
+
+#ifndef LF_NO_STATS
+	trace_enabled = true;
+#endif
+	return true;
+}
+
+
+
+void
+TraceThreadName(CSZ name)
+{
+	if (trace_enabled)
+		ThisRing()->thread_name = name;
+}
+
+
+
+void
+TraceAdd(CSZ name, CSZ detail, long ns_begin, long ns_end)
+{
+	trace_ring *p = ThisRing();
+	trace_event& e = p->events[p->count++ % ring_events];
+
+	e.name = name;
+	e.ns_begin = ns_begin;
+	e.ns_end = ns_end;
+	if (detail == NULL)
+		e.detail[0] = '\0';
+	else
+	{
+		strncpy(e.detail, detail, detail_max - 1);
+		e.detail[detail_max - 1] = '\0';
+	}
+}
+
+
+
+// TraceWrite()
+//
+// Writes the file: a thread_name record for each thread, then its
+// spans as complete ("X") events.
+
+bool
+TraceWrite()
+{
+	if (fd_trace < 0)
+		return false;
+
+#ifndef LF_NO_STATS
+	trace_enabled = false;
+#endif
+
+	lock_guard<mutex> lock(rings_mutex);
+	bool ok;
+	{
+		outbuf o(fd_trace);
+		const long pid = getpid();
+		long lost = 0;
+		CSZ sep = "\n";
+
+		o << "{\"traceEvents\":[";
+		for (size_t r = 0; r < rings.size(); ++r)
+		{
+			const trace_ring& ring = *rings[r];
+
+			if (ring.thread_name != NULL)
+			{
+				o << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"
+						<< pid << ",\"tid\":" << ring.tid
+						<< ",\"args\":{\"name\":";
+				PutJsonString(o, ring.thread_name);
+				o << "}}";
+				sep = ",\n";
+			}
+
+			size_t first = 0;
+			if (ring.count > ring_events)
+			{
+				first = ring.count - ring_events;
+				lost += first;
+			}
+
+			for (size_t i = first; i < ring.count; ++i)
+			{
+				const trace_event& e = ring.events[i % ring_events];
+
+				o << sep << "{\"name\":\"" << e.name
+						<< "\",\"cat\":\"lf\",\"ph\":\"X\",\"pid\":" << pid
+						<< ",\"tid\":" << ring.tid << ",\"ts\":";
+				PutMicroseconds(o, e.ns_begin - ns_start);
+				o << ",\"dur\":";
+				PutMicroseconds(o, e.ns_end - e.ns_begin);
+				if (e.detail[0] != '\0')
+				{
+					o << ",\"args\":{\"detail\":";
+					PutJsonString(o, e.detail);
+					o << '}';
+				}
+				o << '}';
+				sep = ",\n";
+			}
+		}
+		o << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"lost_spans\":"
+				<< lost << "}}\n";
+
+		ok = o.flush();
+	}
+
+	ok = (close(fd_trace) == 0) && ok;
+	fd_trace = -1;
+	return ok;
+}
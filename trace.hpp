@@ -0,0 +1,110 @@
+// trace.hpp
+//
+// Tracing: records spans of time (reading one directory, sorting one
+// bucket, one worker thread's whole run) and writes them out as a
+// Chrome trace-event JSON file, which can be opened in Perfetto or in
+// chrome://tracing to see what every thread was doing when.
+//
+// Each thread records into its own ring buffer, so recording a span
+// takes no locks; only a thread's first span takes a lock, to register
+// its buffer.  If a thread records more spans than its buffer holds,
+// the oldest ones are overwritten, and the file says how many were lost.
+//
+// Spans are only recorded if trace_enabled is true, so with tracing off
+// a span costs one well-predicted branch.  Like the stats counters,
+// tracing is compiled out entirely if LF_NO_STATS is defined.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// if (!TraceStart("lf.trace.json"))
+//	error...
+// TraceThreadName("main");
+//
+// {
+//	trace_span span("slurp", dir_name);
+//	// ...work...
+// }
+//
+// TraceWrite();
+
+
+
+#ifndef TRACE_HPP
+
+#define TRACE_HPP
+
+
+
+#include "util.hpp"
+
+
+
+#ifdef LF_NO_STATS
+const bool trace_enabled = false;
+#else
+extern bool trace_enabled;
+#endif
+
+
+
+// Opens the trace file and turns tracing on; returns false if the file
+// can't be opened.
+bool TraceStart(CSZ path);
+
+// Writes out every span recorded and closes the file.  All the threads
+// that recorded spans must have finished (or be idle) by now.
+bool TraceWrite();
+
+// Names the calling thread in the trace.
+void TraceThreadName(CSZ name);
+
+// Records a finished span; name must be a string constant.  detail may
+// be NULL, and is cut short if it is long.
+void TraceAdd(CSZ name, CSZ detail, long ns_begin, long ns_end);
+
+long TraceNowNs();
+
+
+
+// trace_span
+//
+// Records a span from its construction to the end of the enclosing
+// block.  The detail is copied only when the span ends, so it must
+// last that long.
+
+class trace_span
+{
+	private:
+		CSZ name;
+		CSZ detail;
+		long ns0;
+
+	public:
+		trace_span(CSZ span_name, CSZ span_detail = NULL)
+		{
+			name = span_name;
+			detail = span_detail;
+			ns0 = trace_enabled ? TraceNowNs() : 0;
+		}
+
+		trace_span(CSZ span_name, CSREF span_detail)
+		{
+			name = span_name;
+			detail = span_detail.c_str();
+			ns0 = trace_enabled ? TraceNowNs() : 0;
+		}
+
+		~trace_span()
+		{
+			if (trace_enabled)
+				TraceAdd(name, detail, ns0, TraceNowNs());
+		}
+};
+
+
+
+#endif // TRACE_HPP
@@ -0,0 +1,546 @@
+// treeindex.cpp
+//
+// Builds and reads the tree index.
+//
+// See the header file for example code of how to call this.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+#include <cerrno>
+#include <cstring>
+
+// for opendir(), fstatat(), open(), pwrite(), mmap()
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+
+#include "lfbin.hpp"
+#include "treeindex.hpp"
+
+using namespace std;
+
+
+
+const int treeindex_align = 8;
+
+static const char zeros[treeindex_align] = { 0 };
+
+
+
+// Padding()
+//
+// Returns how many zeros follow len bytes to reach an 8-byte boundary.
+
+inline size_t
+Padding(size_t len)
+{
+	return (treeindex_align - len % treeindex_align) % treeindex_align;
+}
+
+
+
+// MtimeNs()
+//
+// The modification time from a stat() call, in nanoseconds.
+
+inline long long
+MtimeNs(const struct stat& sb)
+{
+	return sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+}
+
+
+
+// IsRealDir()
+//
+// True if a directory entry, already known to lead to a directory, is
+// the directory itself and not a symbolic link to one.  The index
+// doesn't follow links into directories, so a link can't make it loop.
+
+bool
+IsRealDir(int dir_fd, const struct dirent *pdirent)
+{
+#ifdef _DIRENT_HAVE_D_TYPE
+	if (pdirent->d_type == DT_DIR)
+		return true;
+	if (pdirent->d_type != DT_UNKNOWN)
+		return false;
+#endif
+
+	struct stat sb;
+	return fstatat(dir_fd, pdirent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+			&& S_ISDIR(sb.st_mode);
+}
+
+
+
+// constructor
+
+index_builder::index_builder()
+{
+	order = NULL;
+	busy = 0;
+	fd = -1;
+	end = 0;
+	failed = false;
+	dir_count = 0;
+	name_count = 0;
+}
+
+
+
+// index_builder::ReadDir()
+//
+// Reads the names in one directory, and stat()s each one, following
+// symbolic links as lf does.  The directories under it go in subdirs.
+// Returns false if the directory can't be read.
+
+bool
+index_builder::ReadDir(index_dir& dir, vector<string>& subdirs)
+{
+	DIR *pdir = opendir(dir.path.c_str());
+	if (pdir == NULL)
+		return false;
+
+	const int dir_fd = dirfd(pdir);
+	struct stat sb;
+
+	dir.mtime = (fstat(dir_fd, &sb) == 0) ? MtimeNs(sb) : 0;
+	dir.entries.clear();
+
+	struct dirent *pdirent;
+	while ((pdirent = readdir(pdir)) != NULL)
+	{
+		CSZ name = pdirent->d_name;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			continue;
+
+		dir.entries.push_back(index_entry());
+		index_entry& e = dir.entries.back();
+		e.name = name;
+		e.ext_at = 0;
+		e.size = 0;
+		e.mtime = 0;
+
+		if (fstatat(dir_fd, name, &sb, 0) != 0)
+		{
+			e.kind = ik_bad;
+			continue;
+		}
+
+		e.kind = S_ISDIR(sb.st_mode) ? ik_dir : ik_file;
+		e.size = sb.st_size;
+		e.mtime = MtimeNs(sb);
+
+		if (e.kind == ik_dir && IsRealDir(dir_fd, pdirent))
+		{
+			if (dir.path.length() == 1)
+				subdirs.push_back(dir.path + e.name);	// under "/"
+			else
+				subdirs.push_back(dir.path + '/' + e.name);
+		}
+	}
+
+	closedir(pdir);
+	return true;
+}
+
+
+
+// index_builder::WriteDir()
+//
+// Puts the path of a directory and its block of entries into buf, each
+// padded to an 8-byte boundary.
+
+void
+index_builder::WriteDir(const index_dir& dir, string& buf)
+{
+	unsigned char rec[treeindex_entry_len];
+
+	buf.assign(dir.path);
+	buf.append(zeros, Padding(dir.path.length()));
+
+	for (size_t i = 0; i < dir.entries.size(); ++i)
+	{
+		const index_entry& e = dir.entries[i];
+
+		memset(rec, 0, sizeof(rec));
+		rec[0] = e.kind;
+		PutLE32(rec + 4, e.name.length());
+		PutLE32(rec + 8, e.ext_at);
+		PutLE64(rec + 16, e.size);
+		PutLE64(rec + 24, e.mtime);
+		buf.append((CSZ)rec, treeindex_entry_len);
+
+		buf.append(e.name);
+		buf.append(zeros, Padding(e.name.length()));
+	}
+}
+
+
+
+// index_builder::WriteAt()
+//
+// pwrite() all of a buffer.
+
+bool
+index_builder::WriteAt(uint64_t off, const void *p, size_t len)
+{
+	const char *pch = (const char *)p;
+
+	while (len > 0)
+	{
+		ssize_t rc = pwrite(fd, pch, len, off);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return false;
+
+		pch += rc;
+		off += rc;
+		len -= rc;
+	}
+
+	return true;
+}
+
+
+
+// index_builder::Worker()
+//
+// Takes a directory from the queue, reads it, orders its names, and
+// appends its block to the index, until the queue is empty and no other
+// worker is reading a directory that could add to it.  Only the queue
+// and the write are done with the lock held.
+
+void
+index_builder::Worker()
+{
+	index_dir dir;
+	vector<string> subdirs;
+	string buf;
+
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(mtx);
+			while (queue.empty() && busy > 0 && !failed)
+				cv.wait(lock);
+			if (queue.empty() || failed)
+			{
+				cv.notify_all();
+				return;
+			}
+
+			dir.path.swap(queue.back());
+			queue.pop_back();
+			++busy;
+		}
+
+		subdirs.clear();
+		bool ok = ReadDir(dir, subdirs);
+		if (ok)
+		{
+			order(dir);
+			WriteDir(dir, buf);
+		}
+
+		{
+			lock_guard<mutex> lock(mtx);
+
+			if (!ok)
+				bad_dirs.push_back(dir.path);
+			else if (!WriteAt(end, buf.data(), buf.length()))
+				failed = true;
+			else
+			{
+				dir_record r;
+				r.path = dir.path;
+				r.path_off = end;
+				r.count = dir.entries.size();
+				r.block_off = end + dir.path.length()
+						+ Padding(dir.path.length());
+				r.mtime = dir.mtime;
+				dirs.push_back(r);
+
+				end += buf.length();
+				name_count += dir.entries.size();
+			}
+
+			for (size_t i = 0; i < subdirs.size(); ++i)
+				queue.push_back(subdirs[i]);
+			--busy;
+		}
+		cv.notify_all();
+	}
+}
+
+
+
+// index_builder::Finish()
+//
+// Writes the directory table, sorted by path, the signature, and last
+// of all the header.
+
+bool
+index_builder::Finish(CSREF signature)
+{
+	sort(dirs.begin(), dirs.end());
+	dir_count = dirs.size();
+
+	string buf;
+	unsigned char rec[treeindex_header_len];
+
+	const uint64_t dirs_off = end;
+	for (size_t i = 0; i < dirs.size(); ++i)
+	{
+		const dir_record& r = dirs[i];
+
+		PutLE64(rec, r.path_off);
+		PutLE32(rec + 8, r.path.length());
+		PutLE32(rec + 12, r.count);
+		PutLE64(rec + 16, r.block_off);
+		PutLE64(rec + 24, r.mtime);
+		buf.append((CSZ)rec, treeindex_dir_len);
+	}
+
+	const uint64_t sig_off = dirs_off + buf.length();
+	buf.append(signature);
+
+	memset(rec, 0, sizeof(rec));
+	memcpy(rec, TREEINDEX_MAGIC, 4);
+	PutLE32(rec + 4, treeindex_version);
+	PutLE64(rec + 8, dir_count);
+	PutLE64(rec + 16, dirs_off);
+	PutLE64(rec + 24, sig_off);
+	PutLE32(rec + 32, signature.length());
+
+	return WriteAt(dirs_off, buf.data(), buf.length())
+			&& WriteAt(0, rec, treeindex_header_len);
+}
+
+
+
+bool
+index_builder::Build(CSREF db_path, CSREF root, CSREF signature,
+		index_order_fn order_fn, unsigned threads)
+{
+	const string tmp_path = db_path + ".tmp";
+
+	fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+	order = order_fn;
+	end = treeindex_header_len;
+	failed = false;
+	busy = 0;
+	queue.assign(1, root);
+	dirs.clear();
+	bad_dirs.clear();
+	name_count = 0;
+
+	vector<thread> pool;
+	for (unsigned n = 1; n < threads; ++n)
+		pool.push_back(thread(&index_builder::Worker, this));
+
+	Worker();	// this thread is a worker too
+
+	for (size_t n = 0; n < pool.size(); ++n)
+		pool[n].join();
+
+	bool ok = !failed && Finish(signature);
+	if (close(fd) != 0)
+		ok = false;
+	fd = -1;
+
+	if (ok && rename(tmp_path.c_str(), db_path.c_str()) == 0)
+		return true;
+
+	unlink(tmp_path.c_str());
+	return false;
+}
+
+
+
+// constructor and destructor
+
+index_map::index_map()
+{
+	base = NULL;
+	size = 0;
+	table = NULL;
+	table_count = 0;
+	pos = 0;
+	left = 0;
+	failed = false;
+	dir_mtime = 0;
+}
+
+
+
+index_map::~index_map()
+{
+	Close();
+}
+
+
+
+bool
+index_map::Open(CSZ path)
+{
+	Close();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || sb.st_size < treeindex_header_len)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	// the mapping stays
+	if (p == MAP_FAILED)
+		return false;
+
+	base = (const unsigned char *)p;
+	size = sb.st_size;
+	madvise(p, size, MADV_RANDOM);
+
+	const uint64_t dirs_off = GetLE64(base + 16);
+	const uint64_t sig_off = GetLE64(base + 24);
+	const uint32_t sig_len = GetLE32(base + 32);
+	table_count = GetLE64(base + 8);
+
+	if (memcmp(base, TREEINDEX_MAGIC, 4) != 0
+			|| GetLE32(base + 4) != treeindex_version
+			|| dirs_off > size
+			|| table_count > (size - dirs_off) / treeindex_dir_len
+			|| sig_off > size || sig_len > size - sig_off)
+	{
+		Close();
+		return false;
+	}
+
+	table = base + dirs_off;
+	signature.assign((CSZ)base + sig_off, sig_len);
+	failed = false;
+	return true;
+}
+
+
+
+void
+index_map::Close()
+{
+	if (base != NULL)
+		munmap((void *)base, size);
+	base = NULL;
+	size = 0;
+	table = NULL;
+	table_count = 0;
+	left = 0;
+}
+
+
+
+bool
+index_map::Find(CSREF path)
+{
+	left = 0;
+
+	uint64_t lo = 0;
+	uint64_t hi = table_count;
+	while (lo < hi)
+	{
+		const uint64_t mid = lo + (hi - lo) / 2;
+		const unsigned char *rec = table + mid * treeindex_dir_len;
+		const uint64_t path_off = GetLE64(rec);
+		const size_t path_len = GetLE32(rec + 8);
+
+		if (path_off > size || path_len > size - path_off)
+		{
+			failed = true;
+			return false;
+		}
+
+		int rc = memcmp(base + path_off, path.data(),
+				min(path_len, path.length()));
+		if (rc == 0 && path_len != path.length())
+			rc = (path_len < path.length()) ? -1 : 1;
+
+		if (rc < 0)
+			lo = mid + 1;
+		else if (rc > 0)
+			hi = mid;
+		else
+		{
+			left = GetLE32(rec + 12);
+			pos = GetLE64(rec + 16);
+			dir_mtime = GetLE64(rec + 24);
+			if (pos > size)
+			{
+				failed = true;
+				left = 0;
+				return false;
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+
+bool
+index_map::Next()
+{
+	if (left == 0 || failed)
+		return false;
+
+	if (size - pos < size_t(treeindex_entry_len))
+	{
+		failed = true;
+		return false;
+	}
+
+	const unsigned char *rec = base + pos;
+	const size_t len = GetLE32(rec + 4);
+	const size_t rec_len = treeindex_entry_len + len + Padding(len);
+
+	if (size - pos < rec_len)
+	{
+		failed = true;
+		return false;
+	}
+
+	kind = index_kind(rec[0]);
+	name_len = len;
+	ext_at = GetLE32(rec + 8);
+	entry_size = GetLE64(rec + 16);
+	mtime = GetLE64(rec + 24);
+	name = (CSZ)rec + treeindex_entry_len;
+
+	if (ext_at > name_len)
+	{
+		failed = true;
+		return false;
+	}
+
+	pos += rec_len;
+	--left;
+	return true;
+}
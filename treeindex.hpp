@@ -0,0 +1,248 @@
+// treeindex.hpp
+//
+// The tree index written by "lf --build-index=DB ROOT" and read by
+// "lf --index=DB": every directory under ROOT, with the names in each
+// one already looked up, split into basename and extension, and sorted.
+// lf can then list any of those directories straight from the mapped
+// file, without reading the directory or calling stat() on anything.
+//
+// The index is built by a pool of threads, each reading a directory at
+// a time and putting the ones it finds in a shared queue; the names of
+// each directory are classified and sorted on the thread that read it,
+// by a function the caller passes in.
+//
+// Like an lfbin file (see lfbin.hpp), the index is designed to be read
+// with mmap(): every field is at a fixed offset within its record, and
+// every record starts on an 8-byte boundary.  All integers are
+// little-endian, whatever the host is.
+//
+// header (40 bytes)
+//		magic		4 bytes, "LFI1"
+//		version		uint32, currently 1
+//		dir_count	uint64, records in the directory table
+//		dirs_off	uint64, where the directory table starts
+//		sig_off		uint64, where the signature starts
+//		sig_len		uint32
+//		reserved	uint32, always 0
+//
+// directory (32 bytes); the table is sorted by path, byte by byte, so a
+// directory is found with a binary search
+//		path_off	uint64, where the path starts
+//		path_len	uint32
+//		count		uint32, entries in the directory's block
+//		block_off	uint64, where the block of entries starts
+//		mtime		int64, of the directory, in nanoseconds
+//
+// entry (32 bytes, then variable)
+//		kind		uint8, one of the index_kind values
+//		reserved	3 bytes, always 0
+//		name_len	uint32
+//		ext_at		uint32, where the extension starts in the name (one
+//				past the dot), or 0 for none
+//		reserved	uint32, always 0
+//		size		int64, in bytes
+//		mtime		int64, in nanoseconds
+//		name		name_len bytes, not NUL-terminated
+//		padding		0 to 7 bytes of zeros, to the next 8-byte boundary
+//
+// A path is absolute, as realpath() gives it.  A block holds the
+// directories first, then the files of each extension, the extensions
+// in order; each of those runs is in name order.  The signature is a
+// string that says how the names were split and sorted (the sort order,
+// the extension limit and so on); if it doesn't match the options lf is
+// run with, lf splits and sorts the names again itself.
+//
+// Author: Steve R. Hastings <steve@hastings.org>
+
+
+
+// example of how to use this:
+//
+// index_builder b;
+// if (!b.Build("src.lfi", "/src", signature, OrderDir, 16))
+//	error...
+//
+// index_map m;
+// if (!m.Open("src.lfi"))
+//	error...
+// if (m.Find("/src/lib"))
+// {
+//	while (m.Next())
+//		do something with m.kind, m.name, m.name_len, m.ext_at...
+//	if (!m.good())
+//		error: the index is damaged...
+// }
+
+
+
+#ifndef TREEINDEX_HPP
+
+#define TREEINDEX_HPP
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+
+
+#define TREEINDEX_MAGIC "LFI1"
+const uint32_t treeindex_version = 1;
+
+const int treeindex_header_len = 40;
+const int treeindex_dir_len = 32;
+const int treeindex_entry_len = 32;	// fixed part of an entry
+
+enum index_kind
+{
+	ik_file = 0,
+	ik_dir = 1,
+	ik_bad = 2,	// stat() failed, such as for a dangling link
+};
+
+
+
+// index_entry, index_dir
+//
+// One directory read by index_builder, and the names in it.  The order
+// function sets ext_at for each entry and puts them in order.
+
+struct index_entry
+{
+	std::string name;
+	index_kind kind;
+	uint32_t ext_at;
+	long long size;
+	long long mtime;
+};
+
+struct index_dir
+{
+	std::string path;
+	long long mtime;
+	std::vector<index_entry> entries;
+};
+
+typedef void (*index_order_fn)(index_dir& dir);
+
+
+
+class index_builder
+{
+	private:
+		index_order_fn order;
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::vector<std::string> queue;	// directories to read
+		unsigned busy;	// workers reading a directory
+
+		int fd;	// the new index
+		uint64_t end;	// where the next block goes
+		bool failed;
+
+		struct dir_record
+		{
+			std::string path;
+			uint64_t path_off;
+			uint32_t count;
+			uint64_t block_off;
+			long long mtime;
+
+			bool operator<(const dir_record& rhs) const
+					{ return path < rhs.path; }
+		};
+		std::vector<dir_record> dirs;
+
+		void Worker();
+		bool ReadDir(index_dir& dir, std::vector<std::string>& subdirs);
+		void WriteDir(const index_dir& dir, std::string& buf);
+		bool WriteAt(uint64_t off, const void *p, size_t len);
+		bool Finish(CSREF signature);
+
+		// not copyable
+		index_builder(const index_builder& rhs);
+		index_builder& operator=(const index_builder& rhs);
+
+	public:
+		index_builder();
+
+		// walks the tree under root (an absolute path with no links in
+		// it) with up to threads threads, and writes the index to
+		// db_path; the old index there, if any, is only replaced once
+		// the new one is complete
+		bool Build(CSREF db_path, CSREF root, CSREF signature,
+				index_order_fn order, unsigned threads);
+
+		// after Build(): the directories and names in the index, and
+		// the directories that could not be read (and are left out)
+		uint64_t dir_count;
+		uint64_t name_count;
+		std::vector<std::string> bad_dirs;
+};
+
+
+
+class index_map
+{
+	private:
+		const unsigned char *base;	// the mapped file, or NULL
+		size_t size;
+		const unsigned char *table;	// the directory table
+		uint64_t table_count;
+		size_t pos;	// offset of the next entry
+		uint32_t left;	// entries not read yet
+		bool failed;
+
+		// not copyable
+		index_map(const index_map& rhs);
+		index_map& operator=(const index_map& rhs);
+
+	public:
+		index_map();
+		~index_map();
+
+		// maps the index and checks its header; returns false if it
+		// can't be read or isn't an index of a known version
+		bool Open(CSZ path);
+		void Close();
+		bool is_open() const { return base != NULL; }
+
+		// looks up a directory (an absolute path, as realpath() gives
+		// it), and makes its entries the ones Next() reads; returns
+		// false if it isn't in the index
+		bool Find(CSREF path);
+
+		// reads the next entry; returns false at the end or on error
+		bool Next();
+
+		// true if no record ran past the end of the file
+		bool good() const { return !failed; }
+
+		// from Open()
+		std::string signature;
+
+		// from Find(): the modification time of the directory when the
+		// index was built
+		long long dir_mtime;
+
+		// the entry Next() read; the name points into the mapping and
+		// is not NUL-terminated
+		index_kind kind;
+		CSZ name;
+		size_t name_len;
+		size_t ext_at;
+		long long entry_size;
+		long long mtime;
+};
+
+
+
+#endif // TREEINDEX_HPP
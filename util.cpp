@@ -9,6 +9,9 @@
 #include <cctype>
 #include <cstdlib>
 
+// for clock_gettime()
+#include <time.h>
+
 
 #include "util.hpp"
 
@@ -111,3 +114,20 @@ ConvertAtoI(CSREF s, int& i)
 {
 	return ConvertAtoI(s.c_str(), i);
 }
+
+
+
+// ClockNs()
+//
+// Returns the time on the given clock, in nanoseconds.  The stats and
+// trace code both time things with this.
+
+long
+ClockNs(clockid_t clock)
+{
+	timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
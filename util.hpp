@@ -11,14 +11,23 @@
 #define UTIL_HPP
 
 
+#include <cctype>
 #include <string>
 
+// for clockid_t
+#include <time.h>
+
+// for getcwd()
+#include <unistd.h>
+
 
 
 typedef const char *CSZ;	// may not assign through this pointer
 
 typedef const std::string& CSREF;	// const string reference
 
+typedef char const* const* ARGV;	// argv array, as main() gets it
+
 inline CSZ begin(CSREF s) { return s.data(); }
 inline CSZ end(CSREF s) { return s.data() + s.length(); }
 
@@ -61,6 +70,8 @@ Assert(bool b)
 bool ConvertAtoI(CSZ sz, int& i);
 bool ConvertAtoI(CSREF s, int& i);
 
+long ClockNs(clockid_t clock);
+
 
 
 // IsNum()
@@ -69,10 +80,8 @@ bool ConvertAtoI(CSREF s, int& i);
 // A zero-length string will return true as well.
 
 inline bool
-IsNum(CSREF s)
+IsNum(CSZ b, CSZ e)
 {
-	CSZ b = begin(s);
-	CSZ e = end(s);
 	for (CSZ p = b; p < e; ++p)
 	{
 		if (!isdigit(*p))
@@ -82,6 +91,12 @@ IsNum(CSREF s)
 	return true;	// only digits found
 }
 
+inline bool
+IsNum(CSREF s)
+{
+	return IsNum(begin(s), end(s));
+}
+
 
 
 const char dir_sep_char = '/';
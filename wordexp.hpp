@@ -53,8 +53,6 @@ enum WRDE
 
 
 
-typedef char const* const* ARGV;
-
 class wordexp
 {
 	private: